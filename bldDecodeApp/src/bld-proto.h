@@ -14,6 +14,7 @@
 #define DEFAULT_BLD_PORT 50000
 #define NUM_BLD_CHANNELS 31
 #define BLD_CHANNEL_SIZE sizeof(uint32_t)
+#define BLD_MAX_PAYLOAD_SIZE (NUM_BLD_CHANNELS * sizeof(uint64_t))
 
 typedef struct __attribute__((__packed__)) {
     uint64_t timeStamp;
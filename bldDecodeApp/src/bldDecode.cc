@@ -19,10 +19,11 @@
 #include <limits.h>
 #include <stdint.h>
 #include <signal.h>
+#include <time.h>
 #include <vector>
 #include <algorithm>
 #include <cassert>
-#include <stdarg.h>
+#include <atomic>
 
 #include <epicsTime.h>
 
@@ -32,25 +33,53 @@
 #include "util.h"
 #include "report.h"
 #include "bld-proto.h"
-
-#define MAXLINE 9000
-
-using ChannelType = pvxs::TypeCode::code_t;
+#include "recv.h"
+#include "packet.h"
+#include "source.h"
+#include "pipeline.h"
+#include "shard.h"
+#include "net.h"
+#include "schema.h"
+#include "stream.h"
+#include "listener.h"
+#include "pcap.h"
+#include "recorder.h"
+#include "export.h"
+#include "stats.h"
+#include "loss.h"
+#include "latency.h"
+#include "filter.h"
+#include "sampler.h"
+#include "gateway.h"
+#include "monitor.h"
+#include "output.h"
 
 static void cleanup();
+static int finish();
 
-static void print_data(uint32_t* data, size_t num, const std::vector<ChannelType>& formats, const std::vector<int>& channels, uint64_t);
 static void usage(const char* argv0);
-static std::vector<ChannelType> parse_channel_formats(const char* str);
 static std::vector<int> parse_channels(const char* str);
-static std::vector<int> parse_events(const char* str);
-static std::vector<ChannelType> read_channel_formats(const char* str);
-static void build_channel_list();
-static void bld_printf(const char* fmt, ...) EPICS_PRINTF_STYLE(1,2);
-
-static void timeoutHandler(int) {
-    printf("Timeout exceeded, exiting!\n");
-    exit(1);
+static std::vector<bool> parse_events(const char* str);
+static pvxs::client::Context& client_context();
+static DecodeResult decode_packet(const BldStream& stream, PacketValidator& validator, const PacketSlot& slot);
+static void output_packet(const BldStream& stream, Report* report, const PacketSlot& slot, const DecodeResult& result);
+static void output_event(const BldStream& stream, const StreamLayout& layout, const BldPacketView& packet,
+    const BldEvent& event);
+static void replay_pending(const BldStream& stream, Report* report);
+static bool start_layout(BldStream& s);
+static bool finish_layout(BldStream& s, bool wait);
+template<class Reader> static void decode_offline(Reader& reader, int64_t numPackets);
+
+static volatile sig_atomic_t timedOut = 0;
+
+/* Ctrl-C and the timeout only stop the receive loops, main cleans up once they have returned. A second Ctrl-C exits
+   right away, in case the first one came while waiting on something else */
+static void stopHandler(int sig) {
+    if (sig == SIGINT && stop_requested())
+        _exit(1);
+    if (sig == SIGALRM)
+        timedOut = 1;
+    request_stop();
 }
 
 static int show_data = 0;
@@ -59,23 +88,41 @@ static int verbose = 0;
 static int quiet = 0;
 static int generate_report = 0;
 static std::vector<int> enabled_channels;
-static std::vector<ChannelType> channel_formats;
-static std::vector<int> events;
-static int channel_remap[NUM_BLD_CHANNELS];     // Maps payload channels to their actual channel number
+static std::vector<bool> events;                        // Events to output, indexed by event index. Empty to output all
 static Report* report;
-static char reportFile[256] = "report.json";
-static int num_channels = 0;
-
-// List of channel labels
-static std::vector<std::string> channel_labels = []() -> std::vector<std::string> {
-    std::vector<std::string> labels;
-    for (int i = 0; i < NUM_BLD_CHANNELS; ++i) {
-        char ch[128];
-        snprintf(ch, sizeof(ch), "ch%02d", i);
-        labels.push_back(ch);
-    }
-    return labels;
-}();
+static ReportWriter* reportWriter;
+static ReportConfig reportConfig;
+static char reportFile[256] = "report.jsonl";
+static BldStream stream;                                // Stream received when not using a stream config
+static std::vector<std::unique_ptr<BldStream>> streams; // Streams loaded from a stream config
+static BatchReceiver* receiver;
+static Pipeline* pipeline;
+static ShardedReceiver* shards;
+static StreamListener* listener;
+static CaptureReader* capture;
+static PacketRecorder* recorder;
+static RecordingReader* recording;
+static ColumnExporter* exporter;
+static StatsConfig statsConfig;
+static LossTracker* loss;
+static LatencyTracker* latency;
+static SamplingConfig samplingConfig;
+static PvaGateway* gateway;
+static PayloadMonitor* monitor;                         // Only set if a stream has a payload PV
+static std::string schemaCache = default_schema_cache_dir(); // Empty to not cache payload PV layouts
+static const StreamLayout* exportLayout;                // Layout the export columns were created for
+static bool exportStopped = false;
+static bool statistics = false;                         // Print periodic per-channel summaries instead of every packet
+static EventPrinter* printer;                           // Only set when packets are printed
+static bool kernelFiltering = false;                    // The receive sockets have a socket filter attached
+static std::atomic<uint64_t> kernelFiltered(0);         // Datagrams rejected by the socket filter, or dropped by the kernel
+static std::atomic<uint64_t> userFiltered(0);           // Packets rejected by the filters of the decode stage
+
+// Packet filters and display settings
+static int64_t filter_version = -1;
+static int filter_sevr = 0;
+static uint64_t sevr_mask = 0;
+static bool display_data = false;
 
 #define LOG_VERBOSE(...) if (verbose) { printf(__VA_ARGS__); }
 
@@ -97,6 +144,33 @@ static option long_opts[] = {
     {"report", no_argument, NULL, 'r'},
     {"output", required_argument, NULL, 'o'},
     {"quiet", no_argument, NULL, 'q'},
+    {"batch", required_argument, NULL, 'm'},
+    {"pipeline", required_argument, NULL, 'P'},
+    {"ring-size", required_argument, NULL, 'R'},
+    {"shards", required_argument, NULL, 'S'},
+    {"streams", required_argument, NULL, 'l'},
+    {"input", required_argument, NULL, 'i'},
+    {"record", required_argument, NULL, 'w'},
+    {"segment-size", required_argument, NULL, 'W'},
+    {"pulse-range", required_argument, NULL, 'j'},
+    {"export", required_argument, NULL, 'x'},
+    {"stats", required_argument, NULL, 'T'},
+    {"histogram", required_argument, NULL, 'H'},
+    {"loss", no_argument, NULL, 'g'},
+    {"beam-rate", required_argument, NULL, 'B'},
+    {"report-size", required_argument, NULL, 'Z'},
+    {"retention", required_argument, NULL, 'K'},
+    {"report-flush", required_argument, NULL, 'F'},
+    {"output-format", required_argument, NULL, 'O'},
+    {"rcvbuf", required_argument, NULL, 'Q'},
+    {"latency", required_argument, NULL, 'L'},
+    {"filter", required_argument, NULL, 'E'},
+    {"kernel-filter", no_argument, NULL, 'y'},
+    {"sample", required_argument, NULL, 'D'},
+    {"gateway", required_argument, NULL, 'G'},
+    {"gateway-rate", required_argument, NULL, 'U'},
+    {"gateway-loopback", no_argument, NULL, 'A'},
+    {"schema-cache", required_argument, NULL, 'C'},
 };
 
 static const char* help_text[] = {
@@ -106,7 +180,7 @@ static const char* help_text[] = {
     "Filter packets by this severity mask",
     "Timeout to receive packets, in seconds",
     "Number of packets to receive before exiting",
-    "Data format (i.e. 'f,u,i,f' for float, uint32, int32, float)",
+    "Data format (i.e. 'f,u,i,d' for float, uint32, int32, double. 'l' and 'U' are int64 and uint64)",
     "Receive packets as unicast too",
     "Channels to display (i.e. '1,2,5' will display channels 1, 2 and 5)",
     "Display this help text",
@@ -117,29 +191,69 @@ static const char* help_text[] = {
     "Run in report generation mode",
     "File to place the generated report",
     "Disable all non-critical logging",
+    "Number of packets to receive per syscall (default: 1)",
+    "Run receive, decode and output on separate threads, with this many decode threads",
+    "Number of packet slots per decode thread in pipeline mode (default: 4096)",
+    "Receive on this many SO_REUSEPORT sockets, each served by its own pinned thread",
+    "Receive every stream listed in this file ('<group> <port> <payload PV | format=...>' per line)",
+    "Decode packets from a pcap/pcapng capture file or a recording segment instead of the network",
+    "Record every accepted packet to memory mapped segment files with this path prefix",
+    "Size of each recording segment, in MiB (default: 256)",
+    "Only decode pulse IDs in this range ('<first>[:<last>]') when reading a recording",
+    "Export the displayed events and channels as one column file per field, named <arg>.<label>.col",
+    "Print per-channel statistics every <arg> seconds of BLD time, or pulse IDs with a 'p' suffix (i.e. '5' or '1000p')",
+    "Histogram range for statistics mode ('<min>:<max>[:<bins>]', default: range of the first events, 16 bins)",
+    "Track pulse ID gaps, duplicates, reordering and arrival jitter per sender (always on in report mode)",
+    "Expected event rate in Hz for loss tracking (default: learn the pulse ID step from the data)",
+    "Memory for error packets stored in the report, in MiB (default: 16)",
+    "Error packets kept per reason in the report ('<header|timestamp|event|length|time-order|pulse-order|severity|unknown|all>:<first|last>:<count>[,...]', default: all:first:1000)",
+    "Seconds between writes of the buffered report lines to the report file (default: 1)",
+    "Format of the printed packets: text, csv or jsonl (default: text). Other messages go to stderr with csv and jsonl",
+    "Socket receive buffer size in KiB (default: system default). Needs root or a raised net.core.rmem_max to go past it",
+    "Print network and in-process latency percentiles every <arg> seconds, from kernel receive timestamps (i.e. '10')",
+    "Only process events matching this expression (i.e. 'pulse in 0x100:0x200 && sevr[2] < major && ch03 > 1.5')",
+    "Drop packets failing the version and severity filters, or too short for the payload, in the kernel with a socket filter",
+    "Sample the selected events ('every:<n>', 'pulse:<n>:<k>', 'rate:<events/s>', 'reservoir:<n>:<seconds>', comma separated stages)",
+    "Serve the decoded channels as PVs named <arg><label>, <arg><label>:WF and <arg><label>:STATS on a PVA server",
+    "PV updates per second in gateway mode, each batching every event since the last (default: 1)",
+    "Only serve gateway PVs on 127.0.0.1, for testing (default: EPICS_PVAS_* environment)",
+    "Directory caching the payload PV layouts between runs, or 'none' (default: $XDG_CACHE_HOME/bldDecode or ~/.cache/bldDecode)",
 };
 
 STATIC_ASSERT(arrayLength(long_opts) == arrayLength(help_text));
 
 int main(int argc, char *argv[]) {
     int sockfd;
-    char buffer[MAXLINE];
 
-    char mcastAddr[256] = "224.0.0.0";
-
-    int port = DEFAULT_BLD_PORT, needsSevr = 0;
-    int64_t version = -1, numPackets = INT64_MAX;
+    int64_t numPackets = INT64_MAX;
+    double reportFlush = DEFAULT_REPORT_FLUSH;
+    OutputFormat outputFormat = OutputFormat::Text;
+    int rcvBuf = 0;
     uint64_t timeout = UINT64_MAX;
-    uint64_t sevrMask = 0;
-
-    for (size_t i = 0; i < arrayLength(channel_remap); ++i)
-        channel_remap[i] = i;
-
-    signal(SIGALRM, timeoutHandler);
-    signal(SIGINT, [](int) {cleanup(); exit(0);});
+    unsigned batchSize = DEFAULT_BATCH_SIZE;
+    unsigned numDecoders = 0;
+    size_t ringSize = DEFAULT_RING_SIZE;
+    unsigned numShards = 0;
+    const char* streamConfig = nullptr;
+    const char* captureFile = nullptr;
+    bool groupSet = false;
+    const char* recordPrefix = nullptr;
+    size_t segmentSize = DEFAULT_SEGMENT_SIZE;
+    uint64_t firstPulse = 0, lastPulse = UINT64_MAX;
+    const char* exportPrefix = nullptr;
+    bool trackLoss = false;
+    double beamRate = 0;
+    double latencyInterval = 0;
+    const char* filterExpr = nullptr;
+    bool kernelFilter = false;
+    GatewayConfig gatewayConfig;
+    bool gatewayEnabled = false;
+
+    signal(SIGALRM, stopHandler);
+    signal(SIGINT, stopHandler);
 
     int opt = 0, longind = 0;
-    while ((opt = getopt_long(argc, argv, "rqvuhda:p:k:s:t:n:f:c:e:b:o:", long_opts, &longind)) != -1) {
+    while ((opt = getopt_long(argc, argv, "rqvuhdyAa:p:k:s:t:n:f:c:e:b:o:m:P:R:S:l:i:w:W:j:x:T:H:gB:Z:K:F:O:Q:L:E:D:G:U:C:", long_opts, &longind)) != -1) {
         /* Handle long opts */
         if (opt == 0) {
             if (long_opts[longind].val != 0)
@@ -156,14 +270,14 @@ int main(int argc, char *argv[]) {
             show_data = 1;
             break;
         case 'p':
-            port = atoi(optarg);
+            stream.port = atoi(optarg);
             break;
         case 'k':
-            version = atoll(optarg);
+            filter_version = atoll(optarg);
             break;
         case 's':
-            sevrMask = strtoull(optarg, NULL, num_str_base(optarg));
-            needsSevr = 1;
+            sevr_mask = strtoull(optarg, NULL, num_str_base(optarg));
+            filter_sevr = 1;
             break;
         case 't':
             timeout = strtoull(optarg, NULL, num_str_base(optarg));
@@ -175,7 +289,8 @@ int main(int argc, char *argv[]) {
             usage(argv[0]);
             exit(0);
         case 'f':
-            channel_formats = parse_channel_formats(optarg);
+            if (!parse_channel_formats(optarg, stream.schema))
+                exit(1);
             break;
         case 'c':
             enabled_channels = parse_channels(optarg);
@@ -184,24 +299,160 @@ int main(int argc, char *argv[]) {
             events = parse_events(optarg);
             break;
         case 'b':
-            channel_formats = read_channel_formats(optarg);
+            stream.payloadPV = optarg;
             break;
         case 'u':
             unicast = 1;
             break;
         case 'a':
-            strcpy_safe(mcastAddr, optarg);
+            stream.mcastAddr = optarg;
+            groupSet = true;
             break;
         case 'o':
             strcpy_safe(reportFile, optarg);
             break;
         case 'r':
             generate_report = 1;
-            report = new Report();
             break;
         case 'q':
             quiet = 1;
             break;
+        case 'm':
+            batchSize = strtoul(optarg, NULL, num_str_base(optarg));
+            if (batchSize < 1 || batchSize > MAX_BATCH_SIZE) {
+                printf("Invalid batch size %u, must be between 1 and %d\n", batchSize, MAX_BATCH_SIZE);
+                exit(1);
+            }
+            break;
+        case 'P':
+            numDecoders = strtoul(optarg, NULL, 10);
+            break;
+        case 'R':
+            ringSize = strtoul(optarg, NULL, num_str_base(optarg));
+            if (ringSize == 0 || (ringSize & (ringSize - 1)) != 0) {
+                printf("Invalid ring size %zu, must be a power of two\n", ringSize);
+                exit(1);
+            }
+            break;
+        case 'S':
+            numShards = strtoul(optarg, NULL, 10);
+            break;
+        case 'l':
+            streamConfig = optarg;
+            break;
+        case 'i':
+            captureFile = optarg;
+            break;
+        case 'w':
+            recordPrefix = optarg;
+            break;
+        case 'W':
+            segmentSize = strtoul(optarg, NULL, 10) << 20;
+            if (segmentSize < MIN_SEGMENT_SIZE) {
+                printf("Invalid segment size %s, must be at least 1 MiB\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'j': {
+            char* end;
+            firstPulse = strtoull(optarg, &end, num_str_base(optarg));
+            if (*end == ':')
+                lastPulse = strtoull(end + 1, NULL, num_str_base(end + 1));
+            if (lastPulse < firstPulse) {
+                printf("Invalid pulse range %s\n", optarg);
+                exit(1);
+            }
+            break;
+        }
+        case 'x':
+            exportPrefix = optarg;
+            break;
+        case 'T':
+            if (!parse_stats_interval(optarg, statsConfig))
+                exit(1);
+            statistics = true;
+            break;
+        case 'H':
+            if (!parse_histogram_range(optarg, statsConfig))
+                exit(1);
+            break;
+        case 'g':
+            trackLoss = true;
+            break;
+        case 'B':
+            beamRate = strtod(optarg, NULL);
+            if (beamRate <= 0) {
+                printf("Invalid beam rate %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'Z':
+            reportConfig.maxBytes = strtoul(optarg, NULL, 10) << 20;
+            if (reportConfig.maxBytes == 0) {
+                printf("Invalid report size %s, must be at least 1 MiB\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'K':
+            if (!parse_retention(optarg, reportConfig))
+                exit(1);
+            break;
+        case 'F':
+            reportFlush = strtod(optarg, NULL);
+            if (!(reportFlush > 0)) {
+                printf("Invalid report flush interval %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'O':
+            if (!parse_output_format(optarg, outputFormat))
+                exit(1);
+            break;
+        case 'Q': {
+            // The kernel doubles the size it is given, that has to fit in an int
+            char* end;
+            const unsigned long kib = strtoul(optarg, &end, 10);
+            if (end == optarg || *end || kib == 0 || kib > (INT_MAX / 2) >> 10) {
+                printf("Invalid receive buffer size %s, must be 1 to %d KiB\n", optarg, (INT_MAX / 2) >> 10);
+                exit(1);
+            }
+            rcvBuf = int(kib << 10);
+            break;
+        }
+        case 'L':
+            latencyInterval = strtod(optarg, NULL);
+            if (!(latencyInterval > 0)) {
+                printf("Invalid latency interval %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'E':
+            filterExpr = optarg;
+            break;
+        case 'y':
+            kernelFilter = true;
+            break;
+        case 'D':
+            if (!parse_sampling(optarg, samplingConfig))
+                exit(1);
+            break;
+        case 'G':
+            gatewayConfig.prefix = optarg;
+            gatewayEnabled = true;
+            break;
+        case 'U':
+            gatewayConfig.rate = strtod(optarg, NULL);
+            if (!(gatewayConfig.rate > 0)) {
+                printf("Invalid gateway rate %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'A':
+            gatewayConfig.loopback = true;
+            break;
+        case 'C':
+            schemaCache = strcmp(optarg, "none") == 0 ? "" : optarg;
+            break;
         case '?':
             usage(argv[0]);
             exit(EXIT_FAILURE);
@@ -209,195 +460,566 @@ int main(int argc, char *argv[]) {
         }
     }
 
-    if (!enabled_channels.empty())
-        build_channel_list();
+    // Sharded receivers keep a report per shard, merged into this one on exit
+    if (generate_report) {
+        reportWriter = new ReportWriter(reportFile, reportFlush);
+        if (!reportWriter->open())
+            exit(1);
+        report = new Report(reportConfig);
+        report->set_writer(reportWriter);
+    }
+
+    // Export columns and gateway PVs are laid out at startup, and a capture would overflow the hold buffer before a
+    // PV could be read: those wait for the payload PVs, anything else starts right away and holds the packets
+    const bool waitForLayout = exportPrefix || gatewayEnabled || captureFile;
+
+    if (!streamConfig) {
+        stream.channels = enabled_channels;
+        stream.filterExpr = filterExpr ? filterExpr : "";
+        if (!start_layout(stream) || !finish_layout(stream, waitForLayout))
+            exit(1);
+        if (monitor)
+            monitor->start_watchdog();
+    }
 
     if (timeout != UINT_MAX)
         alarm(timeout);
 
-    struct sockaddr_in servaddr, cliaddr;
-    bldMulticastPacket_t *ptr;
-    bldMulticastComplementaryPacket_t *compptr;
+    display_data = show_data && !quiet && !report;
 
-    // Creating socket file descriptor
-    if ( (sockfd = socket(AF_INET, SOCK_DGRAM, 0)) < 0 ) {
-        perror("socket creation failed");
-        exit(EXIT_FAILURE);
+    // Packets are printed unless the output is reserved for reports, statistics or the gateway
+    if (verbose || !(quiet || report || statistics || gatewayEnabled)) {
+        FILE* fp = stdout;
+        if (outputFormat != OutputFormat::Text) {
+            if (outputFormat == OutputFormat::Csv && streamConfig) {
+                printf("CSV output is not supported with a stream config, the streams don't share a payload layout\n");
+                exit(1);
+            }
+            // Keep machine readable output clean: it gets the original stdout, every other message goes to stderr
+            fflush(stdout);
+            fp = fdopen(dup(STDOUT_FILENO), "w");
+            dup2(STDERR_FILENO, STDOUT_FILENO);
+        }
+        printer = new EventPrinter(outputFormat, fp);
     }
 
-    memset(&servaddr, 0, sizeof(servaddr));
-    memset(&cliaddr, 0, sizeof(cliaddr));
+    if (exportPrefix) {
+        if (streamConfig) {
+            printf("Column export is not supported with a stream config, the streams don't share a payload layout\n");
+            exit(1);
+        }
+        exportLayout = stream.layout();
+        exporter = new ColumnExporter(exportPrefix, exportLayout->schema);
+        LOG_VERBOSE("export: %s transpose kernels\n", simd_level_name(simd_level()));
+        if (!exporter->open())
+            exit(1);
+    }
 
-    // Filling server information
-    servaddr.sin_family = AF_INET; // IPv4
-    servaddr.sin_addr.s_addr = INADDR_ANY;
-    servaddr.sin_port = htons(port);
+    if (trackLoss || report) {
+        loss = new LossTracker(beamRate, quiet ? nullptr : stdout);
+        if (report)
+            report->set_loss_tracker(loss);
+    }
 
-    // Bind the socket with the server address
-    if ( bind(sockfd, (const struct sockaddr *)&servaddr,
-            sizeof(servaddr)) < 0 )
-    {
-        perror("bind failed");
-        exit(EXIT_FAILURE);
+    // Captures and recordings carry their original receive times, only the network latency is meaningful
+    if (latencyInterval > 0) {
+        latency = new LatencyTracker(latencyInterval, !captureFile);
+        if (report)
+            report->set_latency_tracker(latency);
     }
 
-    // If we're multicast, add ourselves to the group
-    if (!unicast) {
-        printf("Listening for multicast packets on %s\n", mcastAddr);
-        ip_mreq mreq;
-        mreq.imr_interface.s_addr = INADDR_ANY;
-        mreq.imr_multiaddr.s_addr = inet_addr(mcastAddr);
+    if (statistics && !streamConfig)
+        stream.statistics = new ChannelStatistics(stream, statsConfig);
 
-        if (setsockopt(sockfd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0) {
-            perror("failed to opt into multicast: setsockoptfailed");
-            exit(EXIT_FAILURE);
+    if (!samplingConfig.selectors.empty() && !streamConfig)
+        stream.sampler = new EventSampler(stream, samplingConfig);
+
+    if (gatewayEnabled) {
+        gateway = new PvaGateway(gatewayConfig);
+        if (!streamConfig) {
+            if (!gateway->add_stream(stream))
+                exit(1);
+            gateway->start();
         }
     }
 
-    const bool ignoreFirst = !events.empty() && std::find(events.begin(), events.end(), 0) == events.end();
+    if (recordPrefix) {
+        recorder = new PacketRecorder(recordPrefix, segmentSize);
+        if (!recorder->open())
+            exit(1);
+    }
 
-    const bool showData = show_data && !quiet && !report;
+    if (captureFile && RecordingReader::is_recording(captureFile)) {
+        recording = new RecordingReader();
+        if (!recording->open(captureFile))
+            exit(1);
+        recording->set_pulse_range(firstPulse, lastPulse);
+        decode_offline(*recording, numPackets);
+        return finish();
+    }
 
-    PacketValidator validator;
+    if (captureFile) {
+        capture = new CaptureReader();
+        if (!capture->open(captureFile))
+            exit(1);
+        // Captures usually hold more than BLD traffic, only filter on the group if one was given
+        capture->set_filter(stream.port, groupSet && !unicast ? inet_addr(stream.mcastAddr.c_str()) : INADDR_ANY);
+        decode_offline(*capture, numPackets);
+        return finish();
+    }
 
-    while(1)
-    {
-        // Clear buffer so we can easily cast to our structure types without printing junk
-        memset(buffer, 0, sizeof(buffer));
+    // Report mode keeps short packets, they're reported as errors
+    HeaderFilter headerFilter;
+    headerFilter.version = filter_version;
+    headerFilter.matchSevr = filter_sevr;
+    headerFilter.sevrMask = sevr_mask;
+    headerFilter.checkLength = !generate_report;
+    // Layouts read from a payload PV may change at run time, only the header length is checked for those
+    const StreamLayout* layout = stream.layout();
+    headerFilter.payloadSize = layout && stream.payloadPV.empty() ? layout->schema.payload_size() : 0;
+
+    if (streamConfig) {
+        if (!load_stream_config(streamConfig, unicast, streams))
+            exit(1);
 
-        if (numPackets-- <= 0)
-            break;
+        // Monitor every payload PV before waiting on any, so the reads overlap
+        for (auto& s : streams) {
+            s->channels = enabled_channels;
+            s->filterExpr = filterExpr ? filterExpr : "";
+            if (!start_layout(*s))
+                exit(1);
+        }
+
+        for (auto& s : streams) {
+            if (!finish_layout(*s, waitForLayout))
+                exit(1);
+            if (statistics)
+                s->statistics = new ChannelStatistics(*s, statsConfig);
+            if (!samplingConfig.selectors.empty())
+                s->sampler = new EventSampler(*s, samplingConfig);
+            if (gateway && !gateway->add_stream(*s))
+                exit(1);
+        }
+        if (monitor)
+            monitor->start_watchdog();
+        if (gateway)
+            gateway->start();
+
+        if (!unicast) {
+            for (auto& s : streams)
+                printf("Listening for multicast packets on %s\n", s->name.c_str());
+        }
+
+        kernelFiltering = kernelFilter;
+        listener = new StreamListener(streams, unicast, rcvBuf, kernelFilter ? &headerFilter : nullptr, batchSize,
+            decode_packet, output_packet, report);
+        listener->run(numPackets);
+        return finish();
+    }
+
+    SocketOptions sockOpts;
+    sockOpts.port = stream.port;
+    sockOpts.mcastAddr = stream.mcastAddr.c_str();
+    sockOpts.unicast = unicast;
+    sockOpts.reusePort = false;
+    sockOpts.rcvBuf = rcvBuf;
+    sockOpts.filter = kernelFilter ? &headerFilter : nullptr;
+    kernelFiltering = kernelFilter || (numShards > 1 && !unicast);
+
+    if (!unicast)
+        printf("Listening for multicast packets on %s\n", stream.mcastAddr.c_str());
+
+    if (numShards > 0) {
+        // Serialize output across shards so the lines of different packets don't interleave
+        shards = new ShardedReceiver(stream, sockOpts, numShards, batchSize, decode_packet, output_packet, generate_report ? &reportConfig : nullptr, verbose || (!quiet && !generate_report));
+        shards->set_report_writer(reportWriter);
+        shards->run(numPackets);
+        return finish();
+    }
+
+    if ((sockfd = open_bld_socket(sockOpts)) < 0)
+        exit(EXIT_FAILURE);
 
-        char * bufptr = buffer;
-        socklen_t len = sizeof(cliaddr); //len is value/result
+    if (numDecoders > 0) {
+        pipeline = new Pipeline(stream, sockfd, numDecoders, ringSize, batchSize, decode_packet, output_packet, report);
+        pipeline->run(numPackets, verbose);
+        return finish();
+    }
+
+    PacketValidator validator;
+
+    receiver = new BatchReceiver(batchSize);
 
-        const ssize_t totalRead = recvfrom(sockfd, (char *)buffer, MAXLINE,
-                                MSG_WAITALL, ( struct sockaddr *) &cliaddr,
-                                &len);
-        auto n = totalRead;
-        if (n < 0) {
-            perror("recvfrom failed");
+    while (numPackets > 0 && !stop_requested())
+    {
+        const int count = receiver->receive(sockfd);
+        if (count < 0) {
+            perror("recvmmsg failed");
             exit(EXIT_FAILURE);
         }
 
-        size_t packSize = size_t(n) < sizeof(bldMulticastPacket_t) ? n : sizeof(bldMulticastPacket_t);
-        ptr = (bldMulticastPacket_t *)buffer;
+        LOG_VERBOSE("Received batch of %d/%u packets\n", count, receiver->batch_size());
 
-        // Check if we need to skip this packet
-        if (version >= 0 && ptr->version != version)
-            continue;
+        for (int i = 0; i < count && numPackets > 0; ++i, --numPackets)
+            output_packet(stream, report, (*receiver)[i], decode_packet(stream, validator, (*receiver)[i]));
+    }
 
-        // Now check if severity mask matches
-        if (needsSevr && ptr->severityMask != sevrMask)
-            continue;
+    return finish();
+}
 
-        // Packet accepted for display, cancel any pending timeouts
-        alarm(0);
+/* Decode every packet from a capture file or recording, as fast as they can be read */
+template<class Reader>
+static void decode_offline(Reader& reader, int64_t numPackets) {
+    PacketValidator validator;
+    std::unique_ptr<PacketSlot> slot(new PacketSlot);
+    uint64_t count = 0, bytes = 0;
+
+    epicsTimeStamp start, end;
+    epicsTimeGetCurrent(&start);
+    for (; numPackets > 0 && !stop_requested() && reader.next(*slot); --numPackets) {
+        ++count;
+        bytes += slot->len;
+        output_packet(stream, report, *slot, decode_packet(stream, validator, *slot));
+    }
+    epicsTimeGetCurrent(&end);
 
-        bld_printf("====== new packet size %li ======\n", n);
+    const double elapsed = epicsTimeDiffInSeconds(&end, &start);
+    printf("Decoded %lu packets in %.3f s (%.0f packets/s, %.1f MB/s)\n", count, elapsed,
+        elapsed > 0 ? count / elapsed : 0.0, elapsed > 0 ? bytes / elapsed / 1e6 : 0.0);
+}
 
-        LOG_VERBOSE("Received size: %li\n", n);
+/* Decode stage: filter and validate a single received datagram. May run on a decode thread in pipeline mode */
+static DecodeResult decode_packet(const BldStream& stream, PacketValidator& validator, const PacketSlot& slot) {
+    DecodeResult result;
+    const StreamLayout* layout = stream.layout();
+    if (!layout) {
+        result.held = true;
+        return result;
+    }
+    result.layout = layout;
+    const BldPacketView packet(slot.data, slot.len, layout->schema.payload_size());
 
-        const size_t payloadSize = sizeof(uint32_t) * num_channels;
+    // Check if we need to skip this packet
+    if (filter_version >= 0 && packet.version() != filter_version)
+        return result;
 
-        PacketError packetError;
-        if ((packetError = validator.validate(ptr, packSize)) != PacketError::None) {
-            printf("Invalid packet received: %s, len=%lu\n", to_string(packetError).c_str(), packSize);
-            if (report)
-                report->report_packet_error(packetError, buffer, n);
-            continue;
-        }
+    // Now check if severity mask matches
+    if (filter_sevr && packet.severity_mask() != sevr_mask)
+        return result;
 
-        if (!ignoreFirst) {
-            uint32_t sec, nsec;
-            extract_ts(ptr->timeStamp, sec, nsec);
+    if (layout->filterFailed || (layout->filter && !layout->filter->match_packet(slot, packet)))
+        return result;
 
-            time_t sect = sec;
-            auto tinfo = localtime(&sect);
-            char tmbuf[64];
-            strftime(tmbuf, sizeof(tmbuf), "%Y:%m:%d %H:%M:%S", tinfo);
+    result.accepted = true;
 
-            bld_printf("Num channels : %d\n", num_channels);
-            bld_printf("timeStamp    : 0x%016lX %u sec, %u nsec (%s)\n", ptr->timeStamp, sec, nsec, format_ts(sec, nsec).c_str());
-            bld_printf("pulseID      : 0x%016lX\n", ptr->pulseID);
-            bld_printf("severityMask : 0x%016lX\n", ptr->severityMask);
-            bld_printf("version      : 0x%08X\n", ptr->version);
+    // Packet accepted for display, cancel any pending timeouts
+    alarm(0);
 
-            // Display payload
-            if (showData)
-                print_data(ptr->signals, num_channels, channel_formats, enabled_channels, ptr->severityMask);
+    if ((result.headerError = validator.validate(packet, source_key(slot.from), result.failedChecks)) == PacketError::None)
+        result.eventError = validator.validate_events(packet, layout->schema.numChannels, result.failedChecks);
+    return result;
+}
+
+/* Time a packet reached the output stage, in ns since the Unix epoch like the kernel receive timestamps */
+static inline uint64_t output_time() {
+    timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return uint64_t(now.tv_sec) * 1000000000ULL + now.tv_nsec;
+}
+
+/* Output stage: display and report a decoded datagram. Runs on the output thread in pipeline mode */
+static void output_packet(const BldStream& stream, Report* report, const PacketSlot& slot, const DecodeResult& result) {
+    // Kernel drops belong to the socket rather than this packet, count them even if the packet is filtered out.
+    // The kernel counts datagrams rejected by a socket filter as drops too, there's no telling them apart
+    if (slot.kernelDrops && kernelFiltering)
+        kernelFiltered.fetch_add(slot.kernelDrops, std::memory_order_relaxed);
+    else if (slot.kernelDrops) {
+        if (report)
+            report->report_kernel_drops(slot.kernelDrops);
+        if (!quiet) {
+            if (printer)
+                printer->flush();
+            printf("Kernel dropped %u datagrams%s%s, the receive buffer is full\n", slot.kernelDrops,
+                stream.name.empty() ? "" : " on ", stream.name.c_str());
         }
+    }
 
-        n -= payloadSize + bldMulticastPacketHeaderSize;
-
-        LOG_VERBOSE("n is %li size of packet=%lu eventData=%lu\n", n, sizeof(bldMulticastPacket_t), sizeof(bldMulticastComplementaryPacket_t));
-        bufptr += payloadSize + bldMulticastPacketHeaderSize;
-        
-        // Display additional events
-        int eventNum = 1, isError = 0;
-        while (n > 0)
-        {
-            compptr = (bldMulticastComplementaryPacket_t*)(bufptr);
-         
-            // Validate event
-            auto compSize = bldMulticastComplementaryPacketHeaderSize + payloadSize;
-            if ((packetError = validator.validate(compptr, compSize)) != PacketError::None) {
-                if (report)
-                    report->report_packet_error(packetError, buffer, totalRead);
-                printf("Invalid event received: %s, len=%lu\n", to_string(packetError).c_str(), compSize);
-                isError = 1;
-                break;
-            }
+    if (result.held) {
+        if (stream.pending)
+            stream.pending->hold(slot);
+        return;
+    }
 
-            // Skip the event if requested
-            if (events.empty() || std::find(events.begin(), events.end(), eventNum) != events.end()) {
-                // Compute new timestamp and pulse ID
-                uint64_t newTS = compptr->deltaTimeStamp + ptr->timeStamp;
-                uint64_t newPulse = compptr->deltaPulseID + ptr->pulseID;
-                
-                uint32_t sec, nsec;
-                extract_ts(newTS, sec, nsec);
-
-                bld_printf("===> event %d\n", eventNum);
-                bld_printf("Timestamp     : 0x%016lX %u sec, %u nsec (%s) delta 0x%X\n", newTS, sec, nsec, format_ts(sec, nsec).c_str(), compptr->deltaTimeStamp);
-                bld_printf("Pulse ID      : 0x%016lX delta 0x%X\n", newPulse, compptr->deltaPulseID);
-                bld_printf("severity mask : 0x%016lX\n", compptr->severityMask);
-                if (showData)
-                    print_data(compptr->signals, num_channels, channel_formats, enabled_channels, compptr->severityMask);
-            }
+    // The first packet decoded against a layout brings out the packets held before it, in order
+    if (stream.pending && !stream.pending->empty())
+        replay_pending(stream, report);
 
-            n -= compSize;
-            bufptr += compSize;
+    if (!result.accepted) {
+        userFiltered.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
 
-            LOG_VERBOSE("%li bytes remaining\n", n < 0 ? 0 : n);
-            eventNum++;
-        }
+    if (recorder)
+        recorder->record(slot);
+
+    const StreamLayout& layout = *result.layout;
+    const BldPacketView packet(slot.data, slot.len, layout.schema.payload_size());
 
-        if (isError)
+    if (printer) {
+        printer->begin_packet(stream, slot.len);
+        // Keep anything printed directly in order with the formatted output
+        if (verbose || loss || result.headerError != PacketError::None)
+            printer->flush();
+    }
+
+    LOG_VERBOSE("Received size: %li\n", slot.len);
+
+    if (report && result.failedChecks)
+        report->report_failed_checks(result.failedChecks);
+
+    if (result.headerError != PacketError::None) {
+        printf("Invalid packet received: %s, len=%li\n", to_string(result.headerError).c_str(), slot.len);
+        if (report)
+            report->report_packet_error(result.headerError, slot.data, slot.len, slot.recvTime, source_key(slot.from));
+        return;
+    }
+
+    if (loss)
+        loss->track(slot, packet);
+
+    if (latency && latency->track(slot, packet, output_time())) {
+        if (printer)
+            printer->flush();
+        latency->print_summary(stdout);
+    }
+
+    LOG_VERBOSE("header size=%lu event size=%lu events=%lu\n", packet.header_size(), packet.event_size(), packet.num_events());
+
+    for (const auto& event : packet) {
+        // Skip the event if requested
+        if (!events.empty() && (size_t(event.index) >= events.size() || !events[event.index]))
             continue;
 
+        if (layout.filter && !layout.filter->match_event(slot, packet, event))
+            continue;
+
+        if (stream.sampler && !stream.sampler->select(layout, packet, event, output_event))
+            continue;
+
+        output_event(stream, layout, packet, event);
+    }
+
+    if (exporter)
+        exporter->commit();
+    if (stream.statistics) {
+        if (printer)
+            printer->flush();
+        stream.statistics->commit(stdout);
+    }
+
+    // Short payload, trailing partial event, events out of order or stray severity bits. The events were output anyway
+    if (result.eventError != PacketError::None) {
         if (report)
-            report->report_packet_recv();
+            report->report_packet_error(result.eventError, slot.data, slot.len, slot.recvTime, source_key(slot.from));
+        if (printer)
+            printer->flush();
+        if (result.eventError == PacketError::BadEvent)
+            printf("Invalid event received: %s, len=%lu\n", to_string(result.eventError).c_str(), packet.trailing_bytes());
+        else
+            printf("Invalid event received: %s, len=%li\n", to_string(result.eventError).c_str(), slot.len);
+        return;
+    }
 
-        bld_printf("====== Packet finished ======\n");
+    if (report)
+        report->report_packet_recv(source_key(slot.from));
+
+    if (printer)
+        printer->end_packet();
+}
+
+/* Output a selected event. Events emitted by a sampler are committed with the packet being output */
+static void output_event(const BldStream& stream, const StreamLayout& layout, const BldPacketView& packet,
+    const BldEvent& event) {
+    // The export files have the columns of the layout at startup, a change of the payload PV ends the export
+    if (exporter) {
+        if (&layout == exportLayout)
+            exporter->append(event);
+        else if (!exportStopped) {
+            exportStopped = true;
+            printf("Payload layout changed, column export stopped\n");
+        }
     }
+    if (stream.statistics)
+        stream.statistics->add(layout, event);
+    if (stream.gateway)
+        stream.gateway->add(layout, event);
+    if (printer)
+        printer->event(stream, layout, packet, event, display_data);
+}
 
-    cleanup();
+/* Decode and output the packets a stream received before its first layout. Runs on the output stage */
+static void replay_pending(const BldStream& stream, Report* report) {
+    PacketValidator validator;
+    stream.pending->replay([&](const PacketSlot& slot) {
+        output_packet(stream, report, slot, decode_packet(stream, validator, slot));
+    });
+}
+
+/* Publish the layout of a stream's format, or the one cached for its payload PV, and start monitoring the PV */
+static bool start_layout(BldStream& s) {
+    if (s.payloadPV.empty())
+        return s.set_layout(s.schema);
+
+    if (!schemaCache.empty() && load_cached_schema(schemaCache, s.payloadPV, s.schema)) {
+        printf("Using the cached layout of %s, %d channels, until the PV is read\n", s.payloadPV.c_str(),
+            s.schema.numChannels);
+        if (!s.set_layout(s.schema))
+            return false;
+    }
 
-    return 0;
+    if (!monitor)
+        monitor = new PayloadMonitor(client_context(), schemaCache, verbose);
+    LOG_VERBOSE("Monitor payload PV: %s\n", s.payloadPV.c_str());
+    monitor->watch(s);
+    return true;
+}
+
+/* Wait for the first layout of a stream, or have its packets held until the layout arrives */
+static bool finish_layout(BldStream& s, bool wait) {
+    if (!s.layout()) {
+        if (!wait) {
+            s.pending = new PendingPackets();
+            return true;
+        }
+        // The filter is compiled against the layout as it is published, a mismatch has already been printed
+        if (!monitor->wait(s) || s.layout()->filterFailed)
+            return false;
+    }
+    LOG_VERBOSE("decode plan%s%s: %u channels, %s kernel\n", s.name.empty() ? "" : " for ", s.name.c_str(),
+        s.layout()->plan.size(), s.layout()->plan.kernel_name());
+    return true;
+}
+
+/* Clean up once the receive loops have returned, after numPackets or on a signal. \returns The exit status */
+static int finish() {
+    if (timedOut)
+        printf("Timeout exceeded, exiting!\n");
+    cleanup();
+    // A payload PV was never read, or its layout didn't fit the filter
+    return timedOut || (monitor && monitor->failed()) ? 1 : 0;
 }
 
 /* Handle some cleanup. Write reports and whatnot */
 static void cleanup() {
+    // Packets held for a payload PV that was read after the last packet arrived
+    if (monitor)
+        monitor->close();
+    if (stream.pending && stream.layout())
+        replay_pending(stream, report);
+    for (auto& s : streams) {
+        if (s->pending && s->layout())
+            replay_pending(*s, report);
+    }
+
+    // Output the sample of the reservoir windows still open
+    if (stream.sampler)
+        stream.sampler->flush(output_event);
+    for (auto& s : streams) {
+        if (s->sampler)
+            s->sampler->flush(output_event);
+    }
+    if (exporter)
+        exporter->commit();
+
+    if (printer)
+        printer->flush();
+
+    if (receiver && receiver->batch_size() > 1 && !quiet)
+        receiver->stats().print(stdout, receiver->batch_size());
+
+    if (pipeline && !quiet) {
+        if (pipeline->batch_size() > 1)
+            pipeline->batch_stats().print(stdout, pipeline->batch_size());
+        pipeline->print_stats(stdout);
+    }
+
+    if (listener && !quiet)
+        listener->print_stats(stdout);
+
+    if (capture)
+        capture->print_stats(stdout);
+
+    if (recording)
+        recording->print_stats(stdout);
+
+    if (recorder) {
+        recorder->close();
+        recorder->print_stats(stdout);
+    }
+
+    if (exporter) {
+        exporter->close();
+        exporter->print_stats(stdout);
+    }
+
+    if (loss)
+        loss->print_stats(stdout);
+
+    if ((kernelFiltering || userFiltered) && !quiet) {
+        printf("Filtered %lu packets in userspace", userFiltered.load());
+        if (kernelFiltering)
+            printf(", %lu in the kernel (including datagrams dropped for a full receive buffer)", kernelFiltered.load());
+        printf("\n");
+    }
+
+    if (latency) {
+        latency->print_summary(stdout);
+        latency->print_stats(stdout);
+    }
+
+    if (stream.statistics)
+        stream.statistics->print_summary(stdout);
+    for (auto& s : streams) {
+        if (s->statistics)
+            s->statistics->print_summary(stdout);
+    }
+
+    if (stream.sampler && !quiet)
+        stream.sampler->print_stats(stdout);
+    for (auto& s : streams) {
+        if (s->sampler && !quiet)
+            s->sampler->print_stats(stdout);
+    }
+
+    if (stream.pending && !quiet)
+        stream.pending->print_stats(stdout, stream.name);
+    for (auto& s : streams) {
+        if (s->pending && !quiet)
+            s->pending->print_stats(stdout, s->name);
+    }
+
+    if (gateway) {
+        gateway->stop();
+        if (!quiet)
+            gateway->print_stats(stdout);
+    }
+
+    if (shards) {
+        if (!quiet)
+            shards->print_stats(stdout);
+        if (report)
+            shards->merge_reports(*report);
+    }
+
     if (!report)
         return;
-    
-    std::ofstream stream(reportFile);
-    if (!stream.good()) {
-        printf("Error while writing report file %s!\n", reportFile);
-        return;
-    }
-    report->serialize(stream);
+
+    if (pipeline)
+        report->report_pipeline_drops(pipeline->dropped());
+    report->report_filtered(kernelFiltered, userFiltered);
+    report->print_stats(stdout);
+    report->serialize(*reportWriter);
+    reportWriter->close();
     printf("Report saved to %s\n", reportFile);
 }
 
@@ -422,77 +1044,6 @@ static void usage(const char* argv0) {
     puts("");
 }
 
-static void print_single_channel(int index, uint32_t data, pvxs::TypeCode format, uint64_t sevrMask) {
-    printf("  %s raw=0x%08X, ", channel_labels[index].c_str(), data);
-    switch(format.code) {
-    case pvxs::TypeCode::Float32:
-        printf("float=%g", *reinterpret_cast<float*>(&data));
-        break;
-    case pvxs::TypeCode::Int32:
-        printf("int32=%d", *reinterpret_cast<int*>(&data));
-        break;
-	case pvxs::TypeCode::UInt32A:
-    case pvxs::TypeCode::UInt32:
-        printf("uint32=%u", data);
-        break;
-    case pvxs::TypeCode::Int64:
-    case pvxs::TypeCode::UInt64:
-        printf("int64 not supported");
-        break;
-    default:
-        assert(0);
-        break;
-    }
-    printf(", sevr=%s\n", sevr_to_string(get_sevr(sevrMask, index)));
-}
-
-static void print_data(uint32_t* data, size_t num, const std::vector<pvxs::TypeCode::code_t>& formats, const std::vector<int>& channels, uint64_t sevrMask) {
-    printf("Data payload:\n");
-
-    // A bit ugly, but we need to pad out the channel formats if num > formats.size()
-    std::vector<ChannelType> actualFormats = formats;
-    while(actualFormats.size() < num)
-        actualFormats.push_back(ChannelType::UInt32);
-
-    if (channels.empty()) {
-        for (size_t i = 0; i < num; ++i)
-            print_single_channel(i, data[i], actualFormats[i], sevrMask);
-    }
-    else {
-        for (auto chan : channels) {
-            if (size_t(chan) >= num)
-                continue; // Skip anything we don't have
-            print_single_channel(chan, data[chan], actualFormats[chan], sevrMask);
-        }
-    }
-}
-
-static std::vector<ChannelType> parse_channel_formats(const char* str) {
-    char buf[512];
-    strcpy_safe(buf, str);
-
-    std::vector<ChannelType> fmt;
-    for (char* s = strtok(buf, ", "); s; s = strtok(nullptr, ", ")) {
-        switch(*s) {
-        case 'f':
-            fmt.push_back(ChannelType::Float32);
-            break;
-        case 'i':
-            fmt.push_back(ChannelType::Int32);
-            break;
-        case 'u':
-            fmt.push_back(ChannelType::UInt32);
-            break;
-        default:
-            printf("Unknown format '%c'! Valid types are 'f', 'i', and 'u'", *s);
-            exit(1);
-            return {};
-        }
-    }
-    num_channels = fmt.size();
-    return fmt;
-}
-
 static std::vector<int> parse_channels(const char* str) {
     char buf[512];
     strcpy_safe(buf, str);
@@ -505,93 +1056,33 @@ static std::vector<int> parse_channels(const char* str) {
             exit(1);
         }
     }
-    std::sort(channels.begin(), channels.end(), [](int a, int b) { return a < b; });
+    // Each channel once, the decode plan holds at most NUM_BLD_CHANNELS
+    std::sort(channels.begin(), channels.end());
+    channels.erase(std::unique(channels.begin(), channels.end()), channels.end());
     return channels;
 }
 
-static std::vector<int> parse_events(const char* str) {
+static std::vector<bool> parse_events(const char* str) {
     char buf[512];
     strcpy_safe(buf, str);
 
-    std::vector<int> evs;
+    // A lookup table, so skipping events costs the same however many are listed
+    std::vector<bool> evs;
     for (char* s = strtok(buf, ", "); s; s = strtok(nullptr, ", ")) {
         auto ev = strtol(s, nullptr, 10);
-        if (ev < 0) {
+        if (ev < 0 || ev >= MAXLINE) {
             printf("Invalid event number %li\n", ev);
             exit(1);
         }
-        evs.push_back(ev);
+        if (size_t(ev) >= evs.size())
+            evs.resize(ev + 1);
+        evs[ev] = true;
     }
     return evs;
 }
 
-static std::vector<ChannelType> read_channel_formats(const char* str) {
-    using namespace pvxs;
-
-    auto ctx = client::Context::fromEnv();
-    
-    LOG_VERBOSE("Read payload PV: %s\n", str);
-    Value result;
-    try {
-        result = ctx.get(str).exec()->wait(10.0);
-    }
-    catch(pvxs::client::Timeout& e) {
-        printf("Timeout while reading PV '%s', please specify channel formats manually with -f\n", str);
-        exit(1);
-    }
-
-    if (result.type() != TypeCode::Struct) {
-        printf("Payload PV '%s' is not of the expected type 'Struct'\n", str);
-        exit(1);
-    }
-    
-    auto structure = result["BldPayload"];
-    if (!structure.valid()) {
-        printf("Payload PV '%s' contains no 'BldPayload' field\n", str);
-        exit(1);
-    }
-
-    channel_labels.clear();
-
-    std::vector<ChannelType> format;
-    int i = 0, chi = 0;
-    for (auto ch : structure.ichildren()) {
-        format.push_back(ch.type().code);
-            
-        // Store label for display
-        channel_labels.push_back(structure.nameOf(ch));
-
-        // Store off remap
-        channel_remap[i] = chi++;
-        ++i;
-    }
-    num_channels = i;
-    return format;
-}
-
-static void build_channel_list() {
-    std::vector<int> chanList;
-    
-    // Remap user-provided enabled channels to the ones specified by BLD_PAYLOAD
-    for (auto c : enabled_channels) {
-        assert(c >= 0 && c < NUM_BLD_CHANNELS);
-        chanList.push_back(channel_remap[c]);
-        LOG_VERBOSE("remap: %d -> %d\n", c, channel_remap[c]);
-    }
-    enabled_channels = chanList;
-}
-
-// Printf helper to disable printing in certain scenarios
-// use printf/fprintf directly for things that should always be seen
-static void bld_printf(const char* fmt, ...) {
-    if ((quiet || report) && !verbose)
-        return;
-
-    char msg[65536];
-    va_list va;
-    va_start(va, fmt);
-    vsnprintf(msg, sizeof(msg), fmt, va);
-    va_end(va);
-
-    fputs(msg, stdout);
+// Shared client context, created on first use
+static pvxs::client::Context& client_context() {
+    static pvxs::client::Context ctx = pvxs::client::Context::fromEnv();
+    return ctx;
 }
@@ -168,10 +168,16 @@ int main(int argc, char** argv) {
 		memcpy(data, &packet, packetSize);
 		pdat += packetSize;
 
+		/* Deltas are relative to the header and increase from event to event, like a real sender's */
+		uint32_t deltaPulseID = 0, deltaTimeStamp = 0;
+		const uint32_t pulseStep = comp < (1<<12) ? ((1<<12) - 1) / (comp + 1) : 1;
+		const uint32_t timeStep = comp < (1<<10) ? (1<<10) : (1<<20) / (comp + 1);
 		for (int i = 0; i < comp; ++i) {
 			bldMulticastComplementaryPacket_t c;
-			c.deltaPulseID = rand() % (1<<12);
-			c.deltaTimeStamp = rand() % (1<<10);
+			deltaPulseID += 1 + rand() % pulseStep;
+			deltaTimeStamp += rand() % timeStep;
+			c.deltaPulseID = deltaPulseID;
+			c.deltaTimeStamp = deltaTimeStamp;
 			c.severityMask = sevr;
 			for (int sig = 0; sig < chans; ++sig)
 				c.signals[sig] = 2;
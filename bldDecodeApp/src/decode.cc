@@ -0,0 +1,254 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'bldDecode'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'bldDecode', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+#include "decode.h"
+
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+// Largest channel count with its own kernel instantiation
+#define MAX_UNROLLED_CHANNELS 8
+
+ValueKind value_kind(ChannelType type) {
+    switch (type) {
+    case ChannelType::Float32:
+        return ValueKind::Float32;
+    case ChannelType::Int32:
+        return ValueKind::Int32;
+    case ChannelType::UInt32A:
+    case ChannelType::UInt32:
+        return ValueKind::UInt32;
+    case ChannelType::Float64:
+        return ValueKind::Float64;
+    case ChannelType::Int64:
+        return ValueKind::Int64;
+    case ChannelType::UInt64:
+        return ValueKind::UInt64;
+    default:
+        return ValueKind::Unsupported;
+    }
+}
+
+// Raw value of a channel, loaded with the width of its kind
+template<ValueKind K>
+static inline uint64_t load_raw(const BldEvent& event, size_t offset) {
+    return is_wide(K) ? event.load<uint64_t>(offset) : event.load<uint32_t>(offset);
+}
+
+template<ValueKind K>
+static inline double to_value(uint64_t raw);
+
+template<>
+inline double to_value<ValueKind::Float32>(uint64_t raw) {
+    const uint32_t bits = uint32_t(raw);
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+template<>
+inline double to_value<ValueKind::Int32>(uint64_t raw) { return int32_t(raw); }
+
+template<>
+inline double to_value<ValueKind::UInt32>(uint64_t raw) { return uint32_t(raw); }
+
+template<>
+inline double to_value<ValueKind::Float64>(uint64_t raw) {
+    double d;
+    memcpy(&d, &raw, sizeof(d));
+    return d;
+}
+
+template<>
+inline double to_value<ValueKind::Int64>(uint64_t raw) { return double(int64_t(raw)); }
+
+template<>
+inline double to_value<ValueKind::UInt64>(uint64_t raw) { return double(raw); }
+
+template<>
+inline double to_value<ValueKind::Unsupported>(uint64_t) { return NAN; }
+
+static inline uint8_t channel_sevr(uint64_t mask, int channel) {
+    return (mask >> (2 * channel)) & 0x3;
+}
+
+DecodePlan::DecodePlan() :
+    m_kernel(generic_kernel),
+    m_kernelName("generic")
+{
+    memset(m_groupStart, 0, sizeof(m_groupStart));
+}
+
+DecodePlan::DecodePlan(const PayloadSchema& schema) :
+    DecodePlan()
+{
+    // Channels are decoded in display order
+    if (schema.enabledChannels.empty()) {
+        for (int i = 0; i < schema.numChannels && i < NUM_BLD_CHANNELS; ++i)
+            m_channels[m_size++] = i;
+    }
+    else {
+        for (size_t i = 0; i < schema.enabledChannels.size() && i < NUM_BLD_CHANNELS; ++i)
+            m_channels[m_size++] = schema.enabledChannels[i];
+    }
+
+    bool uniform = true, identity = true;
+    for (unsigned i = 0; i < m_size; ++i) {
+        const int chan = m_channels[i];
+        m_kinds[i] = size_t(chan) < schema.formats.size() ? value_kind(schema.formats[chan]) : ValueKind::UInt32;
+        m_offsets[i] = schema.offset(chan);
+        m_minBytes = std::max(m_minBytes, schema.offset(chan) + schema.width(chan));
+        uniform = uniform && m_kinds[i] == m_kinds[0];
+        identity = identity && chan == int(i);
+    }
+    m_allPresent = m_size >= 32 ? ~0u : (1u << m_size) - 1;
+
+    // Group positions by kind for the grouped kernel
+    unsigned n = 0;
+    for (unsigned k = 0; k < NUM_VALUE_KINDS; ++k) {
+        m_groupStart[k] = n;
+        for (unsigned i = 0; i < m_size; ++i) {
+            if (unsigned(m_kinds[i]) == k)
+                m_groupPos[n++] = i;
+        }
+    }
+    m_groupStart[NUM_VALUE_KINDS] = n;
+
+    if (m_size == 0)
+        return;
+
+    // A uniform payload has its channels at fixed strides, the unrolled kernels don't need the offsets
+    if (uniform && identity) {
+        m_kernel = select_uniform(m_kinds[0], m_size);
+        m_kernelName = m_size <= MAX_UNROLLED_CHANNELS ? "uniform, unrolled" : "uniform";
+    }
+    else {
+        m_kernel = grouped_kernel;
+        m_kernelName = "grouped";
+    }
+}
+
+template<ValueKind K, unsigned N>
+void DecodePlan::uniform_kernel(const DecodePlan& plan, const BldEvent& event, DecodedEvent& out) {
+    const size_t width = is_wide(K) ? sizeof(uint64_t) : sizeof(uint32_t);
+    if (event.payloadSize < N * width)
+        return generic_kernel(plan, event, out);
+
+    for (unsigned i = 0; i < N; ++i) {
+        const uint64_t raw = load_raw<K>(event, i * width);
+        out.raw[i] = raw;
+        out.value[i] = to_value<K>(raw);
+        out.sevr[i] = channel_sevr(event.severityMask, i);
+    }
+    out.present = plan.m_allPresent;
+}
+
+template<ValueKind K>
+void DecodePlan::uniform_kernel_n(const DecodePlan& plan, const BldEvent& event, DecodedEvent& out) {
+    const size_t width = is_wide(K) ? sizeof(uint64_t) : sizeof(uint32_t);
+    const unsigned n = plan.m_size;
+    if (event.payloadSize < n * width)
+        return generic_kernel(plan, event, out);
+
+    for (unsigned i = 0; i < n; ++i) {
+        const uint64_t raw = load_raw<K>(event, i * width);
+        out.raw[i] = raw;
+        out.value[i] = to_value<K>(raw);
+        out.sevr[i] = channel_sevr(event.severityMask, i);
+    }
+    out.present = plan.m_allPresent;
+}
+
+template<ValueKind K>
+inline void DecodePlan::decode_group(const DecodePlan& plan, const BldEvent& event, DecodedEvent& out) {
+    const unsigned end = plan.m_groupStart[unsigned(K) + 1];
+    for (unsigned j = plan.m_groupStart[unsigned(K)]; j < end; ++j) {
+        const unsigned pos = plan.m_groupPos[j];
+        const uint64_t raw = load_raw<K>(event, plan.m_offsets[pos]);
+        out.raw[pos] = raw;
+        out.value[pos] = to_value<K>(raw);
+        out.sevr[pos] = channel_sevr(event.severityMask, plan.m_channels[pos]);
+    }
+}
+
+void DecodePlan::grouped_kernel(const DecodePlan& plan, const BldEvent& event, DecodedEvent& out) {
+    if (event.payloadSize < plan.m_minBytes)
+        return generic_kernel(plan, event, out);
+
+    decode_group<ValueKind::Float32>(plan, event, out);
+    decode_group<ValueKind::Int32>(plan, event, out);
+    decode_group<ValueKind::UInt32>(plan, event, out);
+    decode_group<ValueKind::Float64>(plan, event, out);
+    decode_group<ValueKind::Int64>(plan, event, out);
+    decode_group<ValueKind::UInt64>(plan, event, out);
+    decode_group<ValueKind::Unsupported>(plan, event, out);
+    out.present = plan.m_allPresent;
+}
+
+// Handles payloads shorter than the schema, such as a truncated header. Not used for well formed packets
+void DecodePlan::generic_kernel(const DecodePlan& plan, const BldEvent& event, DecodedEvent& out) {
+    out.present = 0;
+    for (unsigned i = 0; i < plan.m_size; ++i) {
+        const ValueKind kind = plan.m_kinds[i];
+        const size_t offset = plan.m_offsets[i];
+        if (!event.contains(offset, is_wide(kind) ? sizeof(uint64_t) : sizeof(uint32_t)))
+            continue;
+        out.sevr[i] = channel_sevr(event.severityMask, plan.m_channels[i]);
+        out.present |= 1u << i;
+        switch (kind) {
+        case ValueKind::Float32:
+            out.raw[i] = load_raw<ValueKind::Float32>(event, offset);
+            out.value[i] = to_value<ValueKind::Float32>(out.raw[i]);
+            break;
+        case ValueKind::Int32:
+            out.raw[i] = load_raw<ValueKind::Int32>(event, offset);
+            out.value[i] = to_value<ValueKind::Int32>(out.raw[i]);
+            break;
+        case ValueKind::UInt32:
+            out.raw[i] = load_raw<ValueKind::UInt32>(event, offset);
+            out.value[i] = to_value<ValueKind::UInt32>(out.raw[i]);
+            break;
+        case ValueKind::Float64:
+            out.raw[i] = load_raw<ValueKind::Float64>(event, offset);
+            out.value[i] = to_value<ValueKind::Float64>(out.raw[i]);
+            break;
+        case ValueKind::Int64:
+            out.raw[i] = load_raw<ValueKind::Int64>(event, offset);
+            out.value[i] = to_value<ValueKind::Int64>(out.raw[i]);
+            break;
+        case ValueKind::UInt64:
+            out.raw[i] = load_raw<ValueKind::UInt64>(event, offset);
+            out.value[i] = to_value<ValueKind::UInt64>(out.raw[i]);
+            break;
+        default:
+            out.raw[i] = load_raw<ValueKind::Unsupported>(event, offset);
+            out.value[i] = to_value<ValueKind::Unsupported>(out.raw[i]);
+            break;
+        }
+    }
+}
+
+DecodePlan::Kernel DecodePlan::select_uniform(ValueKind kind, unsigned count) {
+#define KERNELS(K) { \
+        uniform_kernel_n<K>, uniform_kernel<K, 1>, uniform_kernel<K, 2>, uniform_kernel<K, 3>, uniform_kernel<K, 4>, \
+        uniform_kernel<K, 5>, uniform_kernel<K, 6>, uniform_kernel<K, 7>, uniform_kernel<K, 8> }
+    // Indexed by kind and channel count. Index 0 handles any count
+    static const Kernel kernels[NUM_VALUE_KINDS][MAX_UNROLLED_CHANNELS + 1] = {
+        KERNELS(ValueKind::Float32),
+        KERNELS(ValueKind::Int32),
+        KERNELS(ValueKind::UInt32),
+        KERNELS(ValueKind::Float64),
+        KERNELS(ValueKind::Int64),
+        KERNELS(ValueKind::UInt64),
+        KERNELS(ValueKind::Unsupported),
+    };
+#undef KERNELS
+    return kernels[unsigned(kind)][count <= MAX_UNROLLED_CHANNELS ? count : 0];
+}
@@ -0,0 +1,114 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'bldDecode'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'bldDecode', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include <cstdint>
+
+#include "bld-proto.h"
+#include "packet.h"
+#include "schema.h"
+
+/**
+ * How a channel is interpreted. The 64-bit kinds take 8 bytes of the payload, everything else a 32-bit slot
+ */
+enum class ValueKind : uint8_t {
+    Float32,
+    Int32,
+    UInt32,
+    Float64,
+    Int64,
+    UInt64,
+    Unsupported,    // Types the wire format can't carry, such as strings or 16-bit integers
+};
+
+#define NUM_VALUE_KINDS 7
+
+/**
+ * Typed values of one event, in the channel order of the plan that decoded it
+ */
+struct DecodedEvent {
+    uint32_t present;                   // Bit i is set if the plan's channel i was in the payload
+    uint64_t raw[NUM_BLD_CHANNELS];     // Raw bits, zero extended for 32-bit channels
+    double value[NUM_BLD_CHANNELS];     // Numeric value, NaN for unsupported types. 64-bit integers may be rounded
+    uint8_t sevr[NUM_BLD_CHANNELS];     // Severity, see get_sevr
+};
+
+/**
+ * A payload schema compiled into a decode kernel, built once the formats and channel selection are final.
+ * The byte offset and kind of every selected channel are resolved here, so decoding never walks the formats.
+ * Schemas with a single channel type and no channel selection use a kernel specialized for the type and, for up to
+ * 8 channels, the channel count. Anything else uses a kernel that decodes the channels grouped by type.
+ * Either way an event is decoded in one pass, without branching on the type of each channel.
+ */
+class DecodePlan {
+public:
+    /** An empty plan, decodes no channels */
+    DecodePlan();
+
+    /**
+     * \param schema Payload layout. Its enabled channels (or all channels, if none were selected) are decoded
+     */
+    explicit DecodePlan(const PayloadSchema& schema);
+
+    /**
+     * \brief Decode the selected channels of an event. Channels missing from a short payload are left out of out.present
+     */
+    inline void decode(const BldEvent& event, DecodedEvent& out) const { m_kernel(*this, event, out); }
+
+    /** \returns Number of channels decoded */
+    inline unsigned size() const { return m_size; }
+
+    /** \returns Payload channel decoded at position i */
+    inline int channel(unsigned i) const { return m_channels[i]; }
+
+    inline ValueKind kind(unsigned i) const { return m_kinds[i]; }
+
+    /** \returns Byte offset in the payload of the channel decoded at position i */
+    inline size_t offset(unsigned i) const { return m_offsets[i]; }
+
+    /** \returns Name of the selected kernel, for diagnostics */
+    inline const char* kernel_name() const { return m_kernelName; }
+
+private:
+    typedef void (*Kernel)(const DecodePlan& plan, const BldEvent& event, DecodedEvent& out);
+
+    template<ValueKind K, unsigned N>
+    static void uniform_kernel(const DecodePlan& plan, const BldEvent& event, DecodedEvent& out);
+
+    template<ValueKind K>
+    static void uniform_kernel_n(const DecodePlan& plan, const BldEvent& event, DecodedEvent& out);
+
+    template<ValueKind K>
+    static void decode_group(const DecodePlan& plan, const BldEvent& event, DecodedEvent& out);
+
+    static void grouped_kernel(const DecodePlan& plan, const BldEvent& event, DecodedEvent& out);
+    static void generic_kernel(const DecodePlan& plan, const BldEvent& event, DecodedEvent& out);
+
+    static Kernel select_uniform(ValueKind kind, unsigned count);
+
+    unsigned m_size = 0;
+    int m_channels[NUM_BLD_CHANNELS];
+    ValueKind m_kinds[NUM_BLD_CHANNELS];
+    uint16_t m_offsets[NUM_BLD_CHANNELS];
+    size_t m_minBytes = 0;                          // The fast kernels need a payload with at least this many bytes
+    uint32_t m_allPresent = 0;
+    uint8_t m_groupStart[NUM_VALUE_KINDS + 1];      // Positions of each kind's channels in m_groupPos
+    uint8_t m_groupPos[NUM_BLD_CHANNELS];
+    Kernel m_kernel;
+    const char* m_kernelName;
+};
+
+/** \returns The kind a channel format decodes as */
+ValueKind value_kind(ChannelType type);
+
+/** \returns True for the kinds that take 8 bytes of the payload */
+inline bool is_wide(ValueKind kind) {
+    return kind == ValueKind::Float64 || kind == ValueKind::Int64 || kind == ValueKind::UInt64;
+}
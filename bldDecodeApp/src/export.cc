@@ -0,0 +1,211 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'bldDecode'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'bldDecode', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+#include "export.h"
+
+#include <cerrno>
+#include <cctype>
+#include <cstddef>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+// timeStamp, pulseID and severityMask always come first
+#define NUM_HEADER_COLUMNS 3
+
+// numpy type string for a channel format, of the channel's width on the wire
+static const char* channel_dtype(ChannelType type) {
+    switch (type) {
+    case ChannelType::Float32:
+        return "<f4";
+    case ChannelType::Int32:
+        return "<i4";
+    case ChannelType::Float64:
+        return "<f8";
+    case ChannelType::Int64:
+        return "<i8";
+    case ChannelType::UInt64:
+        return "<u8";
+    default:
+        return "<u4"; // Unsupported formats take a 32-bit slot, keep the raw bits
+    }
+}
+
+// Labels come from a PV, keep only characters that are safe in a file name
+static std::string sanitize_label(const std::string& label) {
+    std::string s = label;
+    for (auto& c : s) {
+        if (!isalnum(static_cast<unsigned char>(c)) && c != '_' && c != '-')
+            c = '_';
+    }
+    return s;
+}
+
+// Write the whole buffer, retrying short writes
+static bool write_all(int fd, const void* data, size_t len) {
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    while (len > 0) {
+        const ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+ColumnExporter::ColumnExporter(const std::string& prefix, const PayloadSchema& schema, size_t blockRows) :
+    m_prefix(prefix),
+    m_blockRows(blockRows ? blockRows : 1),
+    m_batch(schema.payload_size() / BLD_CHANNEL_SIZE, schema.numChannels, m_blockRows, false)
+{
+    add_column("timeStamp", "<u8", sizeof(uint64_t), -1, 0);
+    add_column("pulseID", "<u8", sizeof(uint64_t), -1, 0);
+    add_column("severityMask", "<u8", sizeof(uint64_t), -1, 0);
+
+    std::vector<int> channels = schema.enabledChannels;
+    if (channels.empty()) {
+        for (int i = 0; i < schema.numChannels; ++i)
+            channels.push_back(i);
+    }
+    for (auto chan : channels) {
+        const ChannelType type = size_t(chan) < schema.formats.size() ? schema.formats[chan] : ChannelType::UInt32;
+        add_column(schema.labels[chan], channel_dtype(type), schema.width(chan), chan, schema.offset(chan) / BLD_CHANNEL_SIZE);
+        if (chan >= schema.numChannels)
+            m_zeros.resize(m_blockRows);
+        if (schema.width(chan) == sizeof(uint64_t))
+            m_wide.resize(m_blockRows);
+    }
+}
+
+ColumnExporter::~ColumnExporter() {
+    close();
+}
+
+void ColumnExporter::add_column(const std::string& label, const char* dtype, unsigned elemSize, int channel, unsigned word) {
+    Column col;
+    col.label = label;
+    std::string name = sanitize_label(label);
+    col.file = m_prefix + "." + name + ".col";
+
+    // A label matching a header field, or two labels sanitized to the same name, would open one file twice
+    for (size_t i = 0; i < m_columns.size(); ++i) {
+        if (m_columns[i].file == col.file) {
+            char suffix[16];
+            snprintf(suffix, sizeof(suffix), "_ch%02d", channel);
+            name += suffix;
+            col.file = m_prefix + "." + name + ".col";
+            i = size_t(-1);     // The new name may clash too, check again from the start
+        }
+    }
+    col.dtype = dtype;
+    col.elemSize = elemSize;
+    col.channel = channel;
+    col.word = word;
+    m_columns.push_back(std::move(col));
+}
+
+bool ColumnExporter::open() {
+    for (auto& col : m_columns) {
+        if ((col.fd = ::open(col.file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+            printf("Unable to create column file %s: %s\n", col.file.c_str(), strerror(errno));
+            return false;
+        }
+
+        ColumnFileHeader hdr;
+        memset(&hdr, 0, sizeof(hdr));
+        memcpy(hdr.magic, COLUMN_MAGIC, sizeof(hdr.magic));
+        hdr.version = COLUMN_VERSION;
+        hdr.elemSize = col.elemSize;
+        strncpy(hdr.dtype, col.dtype, sizeof(hdr.dtype) - 1);
+        strncpy(hdr.label, col.label.c_str(), sizeof(hdr.label) - 1);
+        if (!write_all(col.fd, &hdr, sizeof(hdr))) {
+            printf("Unable to write column file %s: %s\n", col.file.c_str(), strerror(errno));
+            return false;
+        }
+    }
+    return true;
+}
+
+void ColumnExporter::append(const BldEvent& event) {
+    std::lock_guard<std::mutex> lock(m_lock);
+
+    // Pending events belong to packets still being output, so their payloads are valid until commit()
+    if (m_batch.full()) {
+        m_batch.commit();
+        flush_block();
+    }
+    m_batch.add(event);
+    ++m_total;
+}
+
+void ColumnExporter::commit() {
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_batch.commit();
+}
+
+void ColumnExporter::flush_block() {
+    const size_t rows = m_batch.size();
+    const uint64_t* fields[NUM_HEADER_COLUMNS] = {m_batch.time_stamps(), m_batch.pulse_ids(), m_batch.severity_masks()};
+
+    for (size_t i = 0; i < m_columns.size() && !m_failed; ++i) {
+        const Column& col = m_columns[i];
+        if (col.fd < 0)
+            break;
+
+        // 32-bit channels are written straight from their word column, 64-bit ones join the low and high words
+        const void* data;
+        if (i < NUM_HEADER_COLUMNS)
+            data = fields[i];
+        else if (unsigned(col.channel) >= m_batch.num_channels())
+            data = m_zeros.data();
+        else if (col.elemSize == sizeof(uint64_t)) {
+            for (size_t r = 0; r < rows; ++r)
+                m_wide[r] = m_batch.wide(col.word, r);
+            data = m_wide.data();
+        }
+        else
+            data = m_batch.uints(col.word);
+
+        if (!write_all(col.fd, data, rows * col.elemSize)) {
+            printf("Unable to write column file %s: %s, export is incomplete\n", col.file.c_str(), strerror(errno));
+            m_failed = true;
+            break;
+        }
+        m_bytes += rows * col.elemSize;
+    }
+    m_batch.clear();
+}
+
+void ColumnExporter::close() {
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_batch.commit();
+    if (m_batch.size())
+        flush_block();
+
+    for (auto& col : m_columns) {
+        if (col.fd < 0)
+            continue;
+        // Record how many values made it to disk, so a reader never maps past the end
+        const uint64_t count = (lseek(col.fd, 0, SEEK_END) - sizeof(ColumnFileHeader)) / col.elemSize;
+        if (pwrite(col.fd, &count, sizeof(count), offsetof(ColumnFileHeader, count)) != sizeof(count))
+            printf("Unable to update column file %s: %s\n", col.file.c_str(), strerror(errno));
+        ::close(col.fd);
+        col.fd = -1;
+    }
+}
+
+void ColumnExporter::print_stats(FILE* fp) {
+    std::lock_guard<std::mutex> lock(m_lock);
+    fprintf(fp, "Export: %lu events in %zu columns (%lu bytes) to %s.*.col%s\n",
+        m_total, m_columns.size(), m_bytes, m_prefix.c_str(), m_failed ? ", incomplete" : "");
+}
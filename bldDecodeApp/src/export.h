@@ -0,0 +1,112 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'bldDecode'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'bldDecode', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <mutex>
+
+#include "packet.h"
+#include "schema.h"
+#include "transpose.h"
+
+/** Default number of events buffered per column before it is written out */
+#define DEFAULT_EXPORT_BLOCK_ROWS 65536
+
+#define COLUMN_MAGIC "BLDCOL1"
+#define COLUMN_VERSION 1
+
+/**
+ * Header at the start of every column file. The column's values follow it as one contiguous array of
+ * count elements, so the file can be mapped directly, e.g. np.memmap(file, dtype, mode='r', offset=64, shape=(count,))
+ */
+struct ColumnFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t elemSize;      // Size of one value in bytes
+    char dtype[8];          // numpy style type string, such as "<f4"
+    uint64_t count;         // Number of values, filled in when the export is closed
+    char label[32];         // Channel label, or the name of a header field
+};
+
+static_assert(sizeof(ColumnFileHeader) == 64, "column header layout changed");
+
+/**
+ * Writes decoded events in columnar form: one file per column, holding a typed array for a single channel or header
+ * field. Every event adds one row to all columns: timeStamp, pulseID and severityMask, then each displayed channel.
+ * Rows are transposed into an EventBatch and written in blocks, with one large sequential write per column.
+ * Safe to call from several output threads at once.
+ */
+class ColumnExporter {
+public:
+    /**
+     * \param prefix Path prefix for the column files, which are named <prefix>.<label>.col
+     * \param schema Payload layout. Its enabled channels (or all channels, if none were selected) are exported
+     * \param blockRows Number of rows buffered before writing
+     */
+    ColumnExporter(const std::string& prefix, const PayloadSchema& schema, size_t blockRows = DEFAULT_EXPORT_BLOCK_ROWS);
+    ~ColumnExporter();
+
+    ColumnExporter(const ColumnExporter&) = delete;
+    ColumnExporter& operator=(const ColumnExporter&) = delete;
+
+    /**
+     * \brief Create the column files
+     * \returns false on failure, the reason has already been printed
+     */
+    bool open();
+
+    /**
+     * \brief Append one event as a row. Channels missing from a short payload are written as 0.
+     * The packet holding the event must stay valid until commit() is called
+     */
+    void append(const BldEvent& event);
+
+    /**
+     * \brief Transpose the appended events, call once the events of a packet have been appended
+     */
+    void commit();
+
+    /**
+     * \brief Write out the last partial block and fill in the row counts
+     */
+    void close();
+
+    void print_stats(FILE* fp);
+
+private:
+    struct Column {
+        std::string label;
+        std::string file;
+        const char* dtype;
+        unsigned elemSize;
+        int channel;                // Payload channel, or -1 for a header field
+        unsigned word;              // First payload word of the channel
+        int fd = -1;
+    };
+
+    void add_column(const std::string& label, const char* dtype, unsigned elemSize, int channel, unsigned word);
+    void flush_block();
+
+    std::string m_prefix;
+    size_t m_blockRows;
+    std::vector<Column> m_columns;
+
+    std::vector<uint32_t> m_zeros;  // Block of zeros for selected channels beyond the payload
+    std::vector<uint64_t> m_wide;   // Block of 64-bit values, joined from two word columns
+
+    std::mutex m_lock;
+    EventBatch m_batch;             // Current block of rows
+    uint64_t m_total = 0;           // Rows written or buffered
+    uint64_t m_bytes = 0;           // Bytes written to all columns
+    bool m_failed = false;          // A write failed, the export is incomplete
+};
@@ -0,0 +1,499 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'bldDecode'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'bldDecode', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+#include "filter.h"
+#include "util.h"
+#include "decode.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <cerrno>
+#include <string>
+#include <strings.h>
+#include <arpa/inet.h>
+
+namespace {
+
+/**
+ * A compiled subexpression, and whether it only looks at the packet header
+ */
+struct Term {
+    std::vector<FilterOp> ops;
+    bool packetOnly = true;
+};
+
+/**
+ * Recursive descent parser for filter expressions:
+ *   expr       := and ('||' and)*
+ *   and        := unary ('&&' unary)*
+ *   unary      := '!' unary | '(' expr ')' | comparison
+ *   comparison := field op value | field 'in' value ':' value
+ */
+class FilterParser {
+public:
+    FilterParser(const char* str, const PayloadSchema& schema) : m_str(str), m_pos(str), m_schema(schema) {}
+
+    /**
+     * \brief Parse the whole expression, split into its top-level && terms
+     */
+    bool parse(std::vector<Term>& terms) {
+        if (!parse_and(terms))
+            return false;
+        if (accept("||")) {
+            // A top-level || leaves a single term
+            Term term = join_and(terms);
+            do {
+                std::vector<Term> rhs;
+                if (!parse_and(rhs))
+                    return false;
+                term = join(term, FilterOp::JumpIfTrue, join_and(rhs));
+            } while (accept("||"));
+            terms.assign(1, term);
+        }
+        skip_space();
+        if (*m_pos)
+            return error("unexpected input");
+        return true;
+    }
+
+    /**
+     * \brief Combine terms into one with && semantics
+     */
+    static Term join_and(const std::vector<Term>& terms) {
+        Term term = terms[0];
+        for (size_t i = 1; i < terms.size(); ++i)
+            term = join(term, FilterOp::JumpIfFalse, terms[i]);
+        return term;
+    }
+
+private:
+    /* lhs, then rhs unless the jump is taken and lhs decides the result */
+    static Term join(const Term& lhs, FilterOp::Code jump, const Term& rhs) {
+        Term term = lhs;
+        FilterOp op = {};
+        op.code = jump;
+        op.jump = uint16_t(rhs.ops.size());
+        term.ops.push_back(op);
+        term.ops.insert(term.ops.end(), rhs.ops.begin(), rhs.ops.end());
+        term.packetOnly = lhs.packetOnly && rhs.packetOnly;
+        return term;
+    }
+
+    bool parse_expr(Term& term) {
+        std::vector<Term> terms;
+        if (!parse_and(terms))
+            return false;
+        term = join_and(terms);
+        while (accept("||")) {
+            if (!parse_and(terms))
+                return false;
+            term = join(term, FilterOp::JumpIfTrue, join_and(terms));
+        }
+        return true;
+    }
+
+    bool parse_and(std::vector<Term>& terms) {
+        terms.clear();
+        do {
+            Term term;
+            if (!parse_unary(term))
+                return false;
+            terms.push_back(term);
+        } while (accept("&&"));
+        return true;
+    }
+
+    bool parse_unary(Term& term) {
+        if (accept("!")) {
+            if (!parse_unary(term))
+                return false;
+            FilterOp op = {};
+            op.code = FilterOp::Not;
+            term.ops.push_back(op);
+            return true;
+        }
+        if (accept("(")) {
+            if (!parse_expr(term))
+                return false;
+            return accept(")") || error("expected ')'");
+        }
+        return parse_comparison(term);
+    }
+
+    bool parse_comparison(Term& term) {
+        const char* start = m_pos;
+        std::string field;
+        if (!parse_ident(field))
+            return error("expected a field or channel label");
+
+        FilterOp op = {};
+        bool packetOnly = false;
+        if (field == "pulse")
+            op.code = FilterOp::Pulse;
+        else if (field == "time")
+            op.code = FilterOp::Time;
+        else if (field == "event")
+            op.code = FilterOp::Event;
+        else if (field == "version") {
+            op.code = FilterOp::Version;
+            packetOnly = true;
+        }
+        else if (field == "src") {
+            op.code = FilterOp::Source;
+            packetOnly = true;
+        }
+        else if (field == "sevr") {
+            op.code = FilterOp::Severity;
+            if (!parse_channel_index(op.channel))
+                return false;
+        }
+        else {
+            // A channel value, by number or label
+            if (field == "ch" && !parse_channel_index(op.channel))
+                return false;
+            if (field != "ch" && !find_label(field, start, op.channel))
+                return false;
+
+            op.offset = uint8_t(m_schema.offset(op.channel));
+            switch (value_kind(m_schema.formats[op.channel])) {
+            case ValueKind::Float32:
+                op.code = FilterOp::Float32;
+                break;
+            case ValueKind::Int32:
+                op.code = FilterOp::Int32;
+                break;
+            case ValueKind::UInt32:
+                op.code = FilterOp::UInt32;
+                break;
+            case ValueKind::Float64:
+                op.code = FilterOp::Float64;
+                break;
+            case ValueKind::Int64:
+                op.code = FilterOp::Int64;
+                break;
+            case ValueKind::UInt64:
+                op.code = FilterOp::UInt64;
+                break;
+            default:
+                m_pos = start;
+                return error("channel type can't be carried in a BLD payload");
+            }
+        }
+
+        if (!parse_cmp(op.cmp))
+            return false;
+        if (op.code == FilterOp::Source && op.cmp != FilterCmp::Eq && op.cmp != FilterCmp::Ne)
+            return error("src only supports == and !=");
+
+        if (!parse_operand(op, op.a))
+            return false;
+        if (op.cmp == FilterCmp::In) {
+            if (!accept(":"))
+                return error("expected ':' in range");
+            if (!parse_operand(op, op.b))
+                return false;
+        }
+
+        if (op.code == FilterOp::Source && !parse_netmask(op))
+            return false;
+
+        term.ops.push_back(op);
+        term.packetOnly = packetOnly;
+        return true;
+    }
+
+    bool parse_cmp(FilterCmp& cmp) {
+        static const struct {
+            const char* str;
+            FilterCmp cmp;
+        } cmps[] = {
+            {"==", FilterCmp::Eq}, {"!=", FilterCmp::Ne}, {"<=", FilterCmp::Le}, {">=", FilterCmp::Ge},
+            {"<", FilterCmp::Lt}, {">", FilterCmp::Gt},
+            {"in ", FilterCmp::In},     // A word, needs a separator before the value
+        };
+        for (size_t i = 0; i < arrayLength(cmps); ++i) {
+            if (accept(cmps[i].str)) {
+                cmp = cmps[i].cmp;
+                return true;
+            }
+        }
+        return error("expected ==, !=, <, <=, >, >= or in");
+    }
+
+    bool parse_operand(const FilterOp& op, FilterOp::Operand& value) {
+        skip_space();
+        char* end = nullptr;
+        switch (op.code) {
+        case FilterOp::Pulse:
+        case FilterOp::Event:
+        case FilterOp::Version:
+            if (*m_pos == '-')
+                return error("expected an unsigned number");
+            value.u = strtoull(m_pos, &end, num_str_base(m_pos));
+            break;
+        case FilterOp::Time: {
+            // Seconds past the EPICS epoch, as printed with each event, encoded like the wire timestamp
+            const double t = strtod(m_pos, &end);
+            if (end != m_pos && !(t >= 0 && t < 4294967296.0))
+                return error("time out of range");
+            const double sec = std::floor(t);
+            value.u = uint64_t(sec) << 32 | std::min(uint64_t(std::llround((t - sec) * 1e9)), uint64_t(999999999));
+            break;
+        }
+        case FilterOp::Severity: {
+            static const char* names[] = {"none", "minor", "major", "invalid"};
+            for (uint64_t i = 0; i < arrayLength(names); ++i) {
+                const size_t len = strlen(names[i]);
+                if (strncasecmp(m_pos, names[i], len) == 0 && !isalnum((unsigned char)m_pos[len])) {
+                    value.u = i;
+                    m_pos += len;
+                    return true;
+                }
+            }
+            value.u = strtoull(m_pos, &end, 10);
+            if (end != m_pos && value.u > 3)
+                return error("severity must be between 0 and 3");
+            break;
+        }
+        case FilterOp::Source: {
+            char addr[INET_ADDRSTRLEN];
+            size_t len = strspn(m_pos, "0123456789.");
+            in_addr in;
+            if (len == 0 || len >= sizeof(addr))
+                return error("expected an IPv4 address");
+            memcpy(addr, m_pos, len);
+            addr[len] = 0;
+            if (inet_pton(AF_INET, addr, &in) != 1)
+                return error("expected an IPv4 address");
+            value.u = ntohl(in.s_addr);
+            m_pos += len;
+            return true;
+        }
+        case FilterOp::Int64:
+        case FilterOp::UInt64: {
+            // Compared as integers, doubles can't hold every value past 2^53
+            const bool isSigned = op.code == FilterOp::Int64;
+            if (!isSigned && *m_pos == '-')
+                return error("expected an unsigned number");
+            errno = 0;
+            if (isSigned)
+                value.i = strtoll(m_pos, &end, num_str_base(m_pos));
+            else
+                value.u = strtoull(m_pos, &end, num_str_base(m_pos));
+            if (end != m_pos && (*end == '.' || *end == 'e' || *end == 'E'))
+                return error("expected an integer for a 64-bit integer channel");
+            if (end != m_pos && errno == ERANGE)
+                return error("number out of range for a 64-bit integer channel");
+            break;
+        }
+        case FilterOp::Float32:
+            // Compared in the channel's precision, so 'x == 0.1' matches the float nearest to 0.1
+            value.d = float(strtod(m_pos, &end));
+            break;
+        default:
+            value.d = strtod(m_pos, &end);
+            break;
+        }
+        if (end == m_pos)
+            return error("expected a number");
+        m_pos = end;
+        return true;
+    }
+
+    /* Optional '/<bits>' after a source address */
+    bool parse_netmask(FilterOp& op) {
+        unsigned long bits = 32;
+        if (*m_pos == '/') {
+            char* end;
+            bits = strtoul(++m_pos, &end, 10);
+            if (end == m_pos || bits > 32)
+                return error("expected a prefix length between 0 and 32");
+            m_pos = end;
+        }
+        op.b.u = bits ? ~uint64_t(0) << (32 - bits) & 0xFFFFFFFF : 0;
+        op.a.u &= op.b.u;
+        return true;
+    }
+
+    /* '[' <channel number or label> ']' */
+    bool parse_channel_index(uint8_t& channel) {
+        if (!accept("["))
+            return error("expected '['");
+        skip_space();
+        const char* start = m_pos;
+        std::string label;
+        if (isdigit((unsigned char)*m_pos)) {
+            char* end;
+            const unsigned long ch = strtoul(m_pos, &end, 10);
+            m_pos = end;
+            // Channel numbers are remapped like the --channels list
+            if (ch >= NUM_BLD_CHANNELS || m_schema.remap[ch] >= m_schema.numChannels) {
+                m_pos = start;
+                return error("channel is not in the payload");
+            }
+            channel = uint8_t(m_schema.remap[ch]);
+        }
+        else {
+            if (!parse_ident(label))
+                return error("expected a channel number or label");
+            if (!find_label(label, start, channel))
+                return false;
+        }
+        return accept("]") || error("expected ']'");
+    }
+
+    bool find_label(const std::string& label, const char* start, uint8_t& channel) {
+        for (int i = 0; i < m_schema.numChannels && size_t(i) < m_schema.labels.size(); ++i) {
+            if (m_schema.labels[i] == label) {
+                channel = uint8_t(i);
+                return true;
+            }
+        }
+        m_pos = start;
+        return error("unknown field or channel label");
+    }
+
+    bool parse_ident(std::string& ident) {
+        skip_space();
+        const char* start = m_pos;
+        if (!isalpha((unsigned char)*m_pos) && *m_pos != '_')
+            return false;
+        while (isalnum((unsigned char)*m_pos) || *m_pos == '_')
+            ++m_pos;
+        ident.assign(start, m_pos);
+        return true;
+    }
+
+    bool accept(const char* tok) {
+        skip_space();
+        const size_t len = strlen(tok);
+        if (strncmp(m_pos, tok, len) != 0)
+            return false;
+        m_pos += len;
+        return true;
+    }
+
+    inline void skip_space() {
+        while (isspace((unsigned char)*m_pos))
+            ++m_pos;
+    }
+
+    bool error(const char* what) {
+        printf("Invalid filter '%s': %s at column %ld\n", m_str, what, long(m_pos - m_str) + 1);
+        return false;
+    }
+
+    const char* m_str;
+    const char* m_pos;
+    const PayloadSchema& m_schema;
+};
+
+template<class T>
+inline bool compare(T x, FilterCmp cmp, T a, T b) {
+    switch (cmp) {
+    case FilterCmp::Eq: return x == a;
+    case FilterCmp::Ne: return x != a;
+    case FilterCmp::Lt: return x < a;
+    case FilterCmp::Le: return x <= a;
+    case FilterCmp::Gt: return x > a;
+    case FilterCmp::Ge: return x >= a;
+    case FilterCmp::In: return a <= x && x <= b;
+    }
+    return false;
+}
+
+inline bool compare_u(uint64_t x, const FilterOp& op) { return compare(x, op.cmp, op.a.u, op.b.u); }
+inline bool compare_i(int64_t x, const FilterOp& op) { return compare(x, op.cmp, op.a.i, op.b.i); }
+inline bool compare_d(double x, const FilterOp& op) { return compare(x, op.cmp, op.a.d, op.b.d); }
+
+}
+
+bool Filter::compile(const char* str, const PayloadSchema& schema) {
+    std::vector<Term> terms;
+    FilterParser parser(str, schema);
+    if (!parser.parse(terms))
+        return false;
+
+    std::vector<Term> packetTerms, eventTerms;
+    for (auto& term : terms)
+        (term.packetOnly ? packetTerms : eventTerms).push_back(term);
+
+    m_packet.clear();
+    m_event.clear();
+    if (!packetTerms.empty())
+        m_packet = FilterParser::join_and(packetTerms).ops;
+    if (!eventTerms.empty())
+        m_event = FilterParser::join_and(eventTerms).ops;
+
+    if (m_packet.size() > MAX_FILTER_OPS || m_event.size() > MAX_FILTER_OPS) {
+        printf("Invalid filter '%s': longer than %d operations\n", str, MAX_FILTER_OPS);
+        return false;
+    }
+    return true;
+}
+
+bool Filter::run(const std::vector<FilterOp>& ops, const PacketSlot& slot, const BldPacketView& packet, const BldEvent* event) {
+    bool r = true;
+    const FilterOp* end = ops.data() + ops.size();
+    for (const FilterOp* op = ops.data(); op < end; ++op) {
+        switch (op->code) {
+        case FilterOp::JumpIfFalse:
+            if (!r)
+                op += op->jump;
+            break;
+        case FilterOp::JumpIfTrue:
+            if (r)
+                op += op->jump;
+            break;
+        case FilterOp::Not:
+            r = !r;
+            break;
+        case FilterOp::Pulse:
+            r = compare_u(event->pulseID, *op);
+            break;
+        case FilterOp::Time:
+            r = compare_u(event->timeStamp, *op);
+            break;
+        case FilterOp::Event:
+            r = compare_u(uint64_t(event->index), *op);
+            break;
+        case FilterOp::Version:
+            r = compare_u(packet.version(), *op);
+            break;
+        case FilterOp::Source:
+            r = ((ntohl(slot.from.sin_addr.s_addr) & op->b.u) == op->a.u) == (op->cmp == FilterCmp::Eq);
+            break;
+        case FilterOp::Severity:
+            r = compare_u(uint64_t(get_sevr(event->severityMask, op->channel)), *op);
+            break;
+        case FilterOp::Float32:
+            r = event->contains(op->offset, sizeof(float)) && compare_d(event->load<float>(op->offset), *op);
+            break;
+        case FilterOp::Int32:
+            r = event->contains(op->offset, sizeof(int32_t)) && compare_d(event->load<int32_t>(op->offset), *op);
+            break;
+        case FilterOp::UInt32:
+            r = event->contains(op->offset, sizeof(uint32_t)) && compare_d(event->load<uint32_t>(op->offset), *op);
+            break;
+        case FilterOp::Float64:
+            r = event->contains(op->offset, sizeof(double)) && compare_d(event->load<double>(op->offset), *op);
+            break;
+        case FilterOp::Int64:
+            r = event->contains(op->offset, sizeof(int64_t)) && compare_i(event->load<int64_t>(op->offset), *op);
+            break;
+        case FilterOp::UInt64:
+            r = event->contains(op->offset, sizeof(uint64_t)) && compare_u(event->load<uint64_t>(op->offset), *op);
+            break;
+        }
+    }
+    return r;
+}
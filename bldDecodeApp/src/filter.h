@@ -0,0 +1,105 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'bldDecode'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'bldDecode', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "recv.h"
+#include "packet.h"
+#include "schema.h"
+
+/** Longest filter program, in ops */
+#define MAX_FILTER_OPS 256
+
+enum class FilterCmp : uint8_t {
+    Eq,
+    Ne,
+    Lt,
+    Le,
+    Gt,
+    Ge,
+    In,         // Inclusive range
+};
+
+/**
+ * A single instruction of a compiled filter. Comparisons set the result register, jumps skip forward over the ops of
+ * the right hand side of && and || when the left hand side already decides the result
+ */
+struct FilterOp {
+    enum Code : uint8_t {
+        JumpIfFalse,
+        JumpIfTrue,
+        Not,
+        Pulse,          // Pulse ID of the event
+        Time,           // BLD timestamp of the event, compared in its wire encoding
+        Event,          // Event index, 0 for the header
+        Version,        // Packet version
+        Source,         // Sender address, compared after masking with b
+        Severity,       // Severity of a channel, see get_sevr
+        Float32,        // Channel value, by payload type
+        Int32,
+        UInt32,
+        Float64,
+        Int64,
+        UInt64,
+    };
+
+    union Operand {
+        uint64_t u;     // Header fields, severities and uint64 channels
+        int64_t i;      // int64 channels
+        double d;       // Other channels. Rounded to float for float32 ones
+    };
+
+    Code code;
+    FilterCmp cmp;
+    uint8_t channel;    // Payload channel of Severity and value comparisons
+    uint8_t offset;     // Byte offset of the channel in the payload, for value comparisons
+    uint16_t jump;      // Ops skipped by a taken jump
+    Operand a;
+    Operand b;          // Upper limit of In, netmask of Source
+};
+
+/**
+ * A filter expression compiled against a stream's payload schema, such as
+ * 'pulse in 0x1000:0x2000 && sevr[3] < major && temp > 20.5 && src == 10.0.1.0/24'.
+ *
+ * Top-level && terms that only look at the packet header (version and source) form a packet program, checked in the
+ * decode stage so rejected packets go no further. The rest form an event program, checked against the raw view of
+ * every event before anything is decoded or formatted.
+ */
+class Filter {
+public:
+    /**
+     * \brief Parse and compile a filter expression
+     * \param schema Payload layout, resolves channel labels and numbers to payload channels and their types
+     * \returns false if the expression is invalid. The reason has already been printed
+     */
+    bool compile(const char* str, const PayloadSchema& schema);
+
+    /** \returns True if the packet passes the header terms of the filter */
+    inline bool match_packet(const PacketSlot& slot, const BldPacketView& packet) const {
+        return m_packet.empty() || run(m_packet, slot, packet, nullptr);
+    }
+
+    /** \returns True if an event of a packet that passed match_packet() passes the rest of the filter */
+    inline bool match_event(const PacketSlot& slot, const BldPacketView& packet, const BldEvent& event) const {
+        return m_event.empty() || run(m_event, slot, packet, &event);
+    }
+
+    /** \returns True if the filter has terms that look at events */
+    inline bool has_event_terms() const { return !m_event.empty(); }
+
+private:
+    static bool run(const std::vector<FilterOp>& ops, const PacketSlot& slot, const BldPacketView& packet, const BldEvent* event);
+
+    std::vector<FilterOp> m_packet;
+    std::vector<FilterOp> m_event;
+};
@@ -0,0 +1,285 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'bldDecode'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'bldDecode', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+#include "gateway.h"
+
+#include <cmath>
+#include <chrono>
+#include <algorithm>
+
+#include <epicsTime.h>
+#include <alarm.h>
+
+#include "pvxs/nt.h"
+
+#include "stream.h"
+
+/* Stamp a PV value with a BLD timestamp (seconds since the EPICS epoch << 32 | nanoseconds) */
+static void set_time(pvxs::Value& value, uint64_t ts) {
+    value["timeStamp.secondsPastEpoch"] = int64_t((ts >> 32) + POSIX_TIME_AT_EPICS_EPOCH);
+    value["timeStamp.nanoseconds"] = int32_t(ts & 0xFFFFFFFF);
+}
+
+static pvxs::Value stats_prototype() {
+    using namespace pvxs::members;
+    return pvxs::TypeDef(pvxs::TypeCode::Struct, "bldDecode:stats:1.0", {
+        UInt64("count"),
+        Float64("mean"),
+        Float64("std"),
+        Float64("min"),
+        Float64("max"),
+        Struct("timeStamp", "time_t", {
+            Int64("secondsPastEpoch"),
+            Int32("nanoseconds"),
+            Int32("userTag"),
+        }),
+    }).create();
+}
+
+GatewayStream::GatewayStream(const BldStream& stream, const std::string& prefix) :
+    m_prefix(prefix),
+    m_channels(stream.layout()->plan.size())
+{
+    const StreamLayout& layout = *stream.layout();
+    for (unsigned pos = 0; pos < m_channels.size(); ++pos) {
+        Channel& c = m_channels[pos];
+        c.name = prefix + layout.schema.labels[layout.plan.channel(pos)];
+        c.value = pvxs::server::SharedPV::buildReadonly();
+        c.waveform = pvxs::server::SharedPV::buildReadonly();
+        c.stats = pvxs::server::SharedPV::buildReadonly();
+        c.valueProto = pvxs::nt::NTScalar{pvxs::TypeCode::Float64}.create();
+        c.waveformProto = pvxs::nt::NTScalar{pvxs::TypeCode::Float64A}.create();
+        c.statsProto = stats_prototype();
+        c.window.points.reserve(GATEWAY_WAVEFORM_POINTS);
+        c.snapshot.points.reserve(GATEWAY_WAVEFORM_POINTS);
+        restart(c.window);
+
+        // Clients connecting before the first update get a disconnected alarm rather than a made up value
+        pvxs::Value initial = c.valueProto.cloneEmpty();
+        initial["alarm.severity"] = int32_t(epicsSevInvalid);
+        initial["alarm.message"] = "No data";
+        c.value.open(initial);
+        c.waveform.open(c.waveformProto.cloneEmpty());
+        c.stats.open(c.statsProto.cloneEmpty());
+    }
+    relayout(layout);
+}
+
+void GatewayStream::relayout(const StreamLayout& layout) {
+    m_layout = &layout;
+    m_map.assign(layout.plan.size(), -1);
+    for (unsigned pos = 0; pos < layout.plan.size(); ++pos) {
+        const std::string name = m_prefix + layout.schema.labels[layout.plan.channel(pos)];
+        for (size_t i = 0; i < m_channels.size(); ++i) {
+            if (m_channels[i].name == name)
+                m_map[pos] = int(i);
+        }
+    }
+}
+
+void GatewayStream::restart(Window& w) {
+    w.updated = false;
+    w.count = 0;
+    w.mean = 0;
+    w.m2 = 0;
+    w.min = INFINITY;
+    w.max = -INFINITY;
+    w.points.clear();
+    w.stride = 1;
+    w.seen = 0;
+}
+
+void GatewayStream::add(const StreamLayout& layout, const BldEvent& event) {
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (&layout != m_layout)
+        relayout(layout);
+    layout.plan.decode(event, m_decoded);
+    ++m_events;
+
+    for (unsigned pos = 0; pos < m_map.size(); ++pos) {
+        if (!(m_decoded.present & (1u << pos)) || m_map[pos] < 0)
+            continue;
+        Window& w = m_channels[m_map[pos]].window;
+        const double v = m_decoded.value[pos];
+        w.updated = true;
+        w.last = v;
+        w.sevr = m_decoded.sevr[pos];
+        w.time = event.timeStamp;
+
+        // NaN and infinite values are published as the latest value, but left out of the waveform and statistics
+        if (!std::isfinite(v))
+            continue;
+        ++w.count;
+        const double delta = v - w.mean;
+        w.mean += delta / w.count;
+        w.m2 += delta * (v - w.mean);
+        w.min = std::min(w.min, v);
+        w.max = std::max(w.max, v);
+
+        // Once the waveform is full, keep every other point and double the stride
+        if (w.seen++ % w.stride != 0)
+            continue;
+        if (w.points.size() == GATEWAY_WAVEFORM_POINTS) {
+            for (size_t i = 0; i < GATEWAY_WAVEFORM_POINTS / 2; ++i)
+                w.points[i] = w.points[2 * i];
+            w.points.resize(GATEWAY_WAVEFORM_POINTS / 2);
+            w.stride *= 2;
+            if ((w.seen - 1) % w.stride != 0)
+                continue;
+        }
+        w.points.push_back(v);
+    }
+}
+
+void GatewayStream::publish(bool window) {
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        for (auto& c : m_channels) {
+            Window& w = c.window;
+            c.snapshot.updated = w.updated;
+            c.snapshot.last = w.last;
+            c.snapshot.sevr = w.sevr;
+            c.snapshot.time = w.time;
+            w.updated = false;
+            if (!window)
+                continue;
+            c.snapshot.count = w.count;
+            c.snapshot.mean = w.mean;
+            c.snapshot.m2 = w.m2;
+            c.snapshot.min = w.min;
+            c.snapshot.max = w.max;
+            c.snapshot.points.swap(w.points);
+            restart(w);
+        }
+    }
+
+    // Posting copies the values into the server, keep it out of the lock so the output threads aren't held up
+    for (auto& c : m_channels) {
+        const Window& s = c.snapshot;
+        if (s.updated) {
+            pvxs::Value value = c.valueProto.cloneEmpty();
+            value["value"] = s.last;
+            value["alarm.severity"] = int32_t(s.sevr);
+            value["alarm.message"] = std::string();
+            set_time(value, s.time);
+            c.value.post(value);
+        }
+        if (!window || s.count == 0)
+            continue;
+
+        pvxs::shared_array<double> points(s.points.size());
+        std::copy(s.points.begin(), s.points.end(), points.begin());
+        pvxs::Value waveform = c.waveformProto.cloneEmpty();
+        waveform["value"] = points.freeze();
+        set_time(waveform, s.time);
+        c.waveform.post(waveform);
+
+        pvxs::Value stats = c.statsProto.cloneEmpty();
+        stats["count"] = s.count;
+        stats["mean"] = s.mean;
+        stats["std"] = s.count > 1 ? std::sqrt(s.m2 / (s.count - 1)) : 0.0;
+        stats["min"] = s.min;
+        stats["max"] = s.max;
+        set_time(stats, s.time);
+        c.stats.post(stats);
+    }
+}
+
+PvaGateway::PvaGateway(const GatewayConfig& config) :
+    m_config(config)
+{
+    pvxs::server::Config serverConfig = pvxs::server::Config::fromEnv();
+    if (config.loopback) {
+        serverConfig.interfaces = {"127.0.0.1"};
+        serverConfig.beaconDestinations = {"127.0.0.1"};
+        serverConfig.auto_beacon = false;
+    }
+    m_server = serverConfig.build();
+}
+
+PvaGateway::~PvaGateway() {
+    stop();
+}
+
+bool PvaGateway::add_stream(BldStream& stream) {
+    std::unique_ptr<GatewayStream> gs(new GatewayStream(stream, m_config.prefix));
+    for (auto& c : gs->m_channels) {
+        const std::string names[] = {c.name, c.name + ":WF", c.name + ":STATS"};
+        for (auto& name : names) {
+            if (std::find(m_names.begin(), m_names.end(), name) != m_names.end()) {
+                printf("PV %s is served for more than one channel, give the streams distinct channel labels\n",
+                    name.c_str());
+                return false;
+            }
+            m_names.push_back(name);
+        }
+        m_server.addPV(names[0], c.value);
+        m_server.addPV(names[1], c.waveform);
+        m_server.addPV(names[2], c.stats);
+    }
+    stream.gateway = gs.get();
+    m_streams.push_back(std::move(gs));
+    return true;
+}
+
+void PvaGateway::start() {
+    m_server.start();
+    // Where to point a client for testing, i.e. EPICS_PVA_ADDR_LIST=127.0.0.1 EPICS_PVA_AUTO_ADDR_LIST=NO
+    if (m_config.loopback) {
+        const pvxs::server::Config& effective = m_server.config();
+        printf("Gateway serving %zu PVs on 127.0.0.1, UDP port %u, TCP port %u\n", m_names.size(),
+            unsigned(effective.udp_port), unsigned(effective.tcp_port));
+    }
+    m_running = true;
+    m_thread = std::thread(&PvaGateway::run, this);
+}
+
+void PvaGateway::stop() {
+    {
+        std::lock_guard<std::mutex> lock(m_runLock);
+        if (!m_running)
+            return;
+        m_running = false;
+    }
+    m_wake.notify_all();
+    m_thread.join();
+    m_server.stop();
+}
+
+void PvaGateway::run() {
+    typedef std::chrono::steady_clock clock;
+    const auto period = std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(1.0 / m_config.rate));
+    // Rates below one update per window stretch the window to the update period
+    const uint64_t ticksPerWindow = std::max(uint64_t(1), uint64_t(std::llround(m_config.rate * GATEWAY_WINDOW)));
+
+    std::unique_lock<std::mutex> lock(m_runLock);
+    auto next = clock::now();
+    for (uint64_t tick = 1; ; ++tick) {
+        // Keep to the schedule, but don't try to catch up on updates missed while the process was stalled
+        next = std::max(next + period, clock::now());
+        if (m_wake.wait_until(lock, next, [this] { return !m_running; }))
+            break;
+        lock.unlock();
+        for (auto& s : m_streams)
+            s->publish(tick % ticksPerWindow == 0);
+        lock.lock();
+        ++m_updates;
+    }
+}
+
+void PvaGateway::print_stats(FILE* fp) {
+    size_t pvs = 0;
+    uint64_t events = 0;
+    for (auto& s : m_streams) {
+        pvs += s->num_pvs();
+        std::lock_guard<std::mutex> lock(s->m_lock);
+        events += s->m_events;
+    }
+    fprintf(fp, "Gateway: served %lu PVs, %lu events published in %lu updates\n", pvs, events, m_updates.load());
+}
@@ -0,0 +1,173 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'bldDecode'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'bldDecode', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+#include "pvxs/data.h"
+#include "pvxs/server.h"
+#include "pvxs/sharedpv.h"
+
+#include "packet.h"
+#include "decode.h"
+
+struct BldStream;
+struct StreamLayout;
+
+/** Default number of value updates posted per second */
+#define DEFAULT_GATEWAY_RATE 1.0
+
+/** Seconds covered by each waveform and statistics update */
+#define GATEWAY_WINDOW 1.0
+
+/** Most points in a waveform update. Longer windows are decimated to between half and all of this */
+#define GATEWAY_WAVEFORM_POINTS 1024
+
+/**
+ * Gateway settings
+ */
+struct GatewayConfig {
+    std::string prefix;             // Prepended to the channel labels to form the PV names
+    double rate = DEFAULT_GATEWAY_RATE;
+    bool loopback = false;          // Only serve on, and beacon to, 127.0.0.1
+};
+
+/**
+ * The PVs of one stream. Events are decoded into per-channel accumulators as they are output, and turned into PV
+ * updates by the gateway's publisher thread, so an update covers every event since the last one:
+ *  - <prefix><label>: NTScalar with the latest value, its BLD timestamp and its severity as the alarm severity
+ *  - <prefix><label>:WF: NTScalarArray of the values over the last GATEWAY_WINDOW, decimated to at most
+ *    GATEWAY_WAVEFORM_POINTS points
+ *  - <prefix><label>:STATS: count, mean, standard deviation, min and max over the last GATEWAY_WINDOW
+ * The PVs are those of the stream's layout at startup. When the layout changes, values go to the PV of the channel
+ * with the same label, channels the new layout doesn't have stop updating and new channels aren't served.
+ * Safe to call add() from several output threads at once.
+ */
+class GatewayStream {
+public:
+    /**
+     * \param stream Stream whose current decode plan selects the channels. Must outlive the gateway
+     */
+    GatewayStream(const BldStream& stream, const std::string& prefix);
+
+    GatewayStream(const GatewayStream&) = delete;
+    GatewayStream& operator=(const GatewayStream&) = delete;
+
+    /**
+     * \brief Decode an event into the accumulators of its channels
+     * \param layout Layout the packet is decoded against
+     */
+    void add(const StreamLayout& layout, const BldEvent& event);
+
+    /**
+     * \brief Post the latest values, and with window set the waveforms and statistics, then restart the window
+     */
+    void publish(bool window);
+
+    /** \returns Number of PVs served */
+    inline size_t num_pvs() const { return m_channels.size() * 3; }
+
+private:
+    friend class PvaGateway;
+
+    /** Everything published about a channel, copied out of the lock before posting */
+    struct Window {
+        bool updated = false;       // A value came in since the last update
+        double last = 0;
+        uint8_t sevr = 0;
+        uint64_t time = 0;          // BLD timestamp of the latest value
+        uint64_t count = 0;         // Finite values in the window
+        double mean = 0;
+        double m2 = 0;              // Sum of squared differences from the mean
+        double min = 0;
+        double max = 0;
+        std::vector<double> points; // Every stride-th value of the window
+        uint64_t stride = 1;
+        uint64_t seen = 0;          // Finite values offered to the waveform
+    };
+
+    struct Channel {
+        std::string name;
+        pvxs::server::SharedPV value;
+        pvxs::server::SharedPV waveform;
+        pvxs::server::SharedPV stats;
+        pvxs::Value valueProto;
+        pvxs::Value waveformProto;
+        pvxs::Value statsProto;
+        Window window;
+        Window snapshot;            // Only touched by the publisher thread
+    };
+
+    static void restart(Window& w);
+    /** Map the channels of another layout to the PVs by label. Called with m_lock held */
+    void relayout(const StreamLayout& layout);
+
+    std::string m_prefix;
+    std::mutex m_lock;
+    std::vector<Channel> m_channels;        // One per channel in the decode plan at startup
+    const StreamLayout* m_layout;
+    std::vector<int> m_map;                 // Index in m_channels of each channel of m_layout's plan, -1 if not served
+    DecodedEvent m_decoded;
+    uint64_t m_events = 0;
+};
+
+/**
+ * Publishes the decoded channels of every stream as PVs on a pvxs PVA server, configured from the EPICS_PVAS_*
+ * environment unless serving on loopback only. A publisher thread posts rate updates per second, each batching every
+ * event since the previous one, so clients see a bounded update rate however fast the BLD stream is.
+ */
+class PvaGateway {
+public:
+    explicit PvaGateway(const GatewayConfig& config);
+    ~PvaGateway();
+
+    PvaGateway(const PvaGateway&) = delete;
+    PvaGateway& operator=(const PvaGateway&) = delete;
+
+    /**
+     * \brief Create the PVs of a stream and attach them to it. Call before start()
+     * \returns false if a PV name is already taken by another stream. The reason has already been printed
+     */
+    bool add_stream(BldStream& stream);
+
+    /**
+     * \brief Start serving the PVs and publishing updates
+     */
+    void start();
+
+    /**
+     * \brief Stop publishing and shut the server down
+     */
+    void stop();
+
+    void print_stats(FILE* fp);
+
+private:
+    void run();
+
+    GatewayConfig m_config;
+    pvxs::server::Server m_server;
+    std::vector<std::unique_ptr<GatewayStream>> m_streams;
+    std::vector<std::string> m_names;
+
+    std::thread m_thread;
+    std::mutex m_runLock;
+    std::condition_variable m_wake;
+    bool m_running = false;
+    std::atomic<uint64_t> m_updates {0};   // Bumped by the publisher thread, read by print_stats
+};
@@ -0,0 +1,159 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'bldDecode'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'bldDecode', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+#include "latency.h"
+
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+#include <epicsTime.h>
+
+#include "util.h"
+
+/* Percentiles printed and serialized */
+static const double percentiles[] = {50, 90, 99, 99.9};
+static const char* percentile_names[] = {"p50", "p90", "p99", "p999"};
+
+/* BLD timestamps (seconds since the EPICS epoch << 32 | nanoseconds) in ns since the Unix epoch */
+static inline uint64_t bld_ts_to_unix_ns(uint64_t ts) {
+    return ((ts >> 32) + POSIX_TIME_AT_EPICS_EPOCH) * 1000000000ull + (ts & 0xFFFFFFFF);
+}
+
+void LatencyHistogram::merge(const LatencyHistogram& other) {
+    for (unsigned i = 0; i < LATENCY_BUCKETS; ++i)
+        m_counts[i] += other.m_counts[i];
+    m_count += other.m_count;
+    m_sum += other.m_sum;
+    m_min = std::min(m_min, other.m_min);
+    m_max = std::max(m_max, other.m_max);
+}
+
+void LatencyHistogram::reset() {
+    memset(m_counts, 0, sizeof(m_counts));
+    m_count = 0;
+    m_sum = 0;
+    m_min = UINT64_MAX;
+    m_max = 0;
+}
+
+uint64_t LatencyHistogram::bucket_limit(unsigned index) {
+    if (index < LATENCY_SUB_BUCKETS)
+        return index;
+    if (index == LATENCY_BUCKETS - 1)
+        return UINT64_MAX;
+    const unsigned shift = index / LATENCY_SUB_BUCKETS - 1;
+    const uint64_t lower = uint64_t(LATENCY_SUB_BUCKETS + index % LATENCY_SUB_BUCKETS) << shift;
+    return lower + (uint64_t(1) << shift) - 1;
+}
+
+uint64_t LatencyHistogram::percentile(double p) const {
+    if (m_count == 0)
+        return 0;
+    const uint64_t rank = std::max(uint64_t(1), uint64_t(std::ceil(p / 100 * m_count)));
+    uint64_t seen = 0;
+    for (unsigned i = 0; i < LATENCY_BUCKETS; ++i) {
+        seen += m_counts[i];
+        if (seen >= rank)
+            return std::min(bucket_limit(i), m_max);
+    }
+    return m_max;
+}
+
+LatencyTracker::LatencyTracker(double interval, bool process) :
+    m_interval(uint64_t(interval * 1e9)),
+    m_process(process)
+{
+}
+
+bool LatencyTracker::track(const PacketSlot& slot, const BldPacketView& packet, uint64_t outputTime) {
+    // Simple pcapng packet blocks have no receive time
+    if (!slot.recvTime)
+        return false;
+
+    // The packet can't have been sent before its newest event
+    const uint64_t sendTime = bld_ts_to_unix_ns(packet.event(packet.num_events()).timeStamp);
+
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (slot.recvTime >= sendTime)
+        m_current.network.record(slot.recvTime - sendTime);
+    else
+        ++m_current.ahead;
+    if (m_process && outputTime >= slot.recvTime)
+        m_current.process.record(outputTime - slot.recvTime);
+
+    // Output threads may see receive times slightly out of order
+    if (m_intervalStart == 0)
+        m_intervalStart = slot.recvTime;
+    else if (!m_due && int64_t(slot.recvTime - m_intervalStart) >= int64_t(m_interval)) {
+        m_due = true;
+        return true;
+    }
+    return false;
+}
+
+void LatencyTracker::print(FILE* fp, const char* name, const LatencyHistogram& hist) {
+    if (hist.count() == 0)
+        return;
+    fprintf(fp, "  %-8s", name);
+    for (size_t i = 0; i < arrayLength(percentiles); ++i)
+        fprintf(fp, " %s %.1f us,", percentile_names[i], hist.percentile(percentiles[i]) / 1e3);
+    fprintf(fp, " min %.1f us, mean %.1f us, max %.1f us\n", hist.min() / 1e3, hist.mean() / 1e3, hist.max() / 1e3);
+}
+
+void LatencyTracker::print(FILE* fp, const char* title, const Latencies& lat) {
+    fprintf(fp, "Latency %s: %lu packets", title, lat.network.count() + lat.ahead);
+    if (lat.ahead)
+        fprintf(fp, ", %lu with a BLD timestamp ahead of the receive time", lat.ahead);
+    fprintf(fp, "\n");
+    print(fp, "network", lat.network);
+    print(fp, "process", lat.process);
+}
+
+void LatencyTracker::print_summary(FILE* fp) {
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (m_current.network.count() + m_current.ahead > 0)
+        print(fp, "since the last summary", m_current);
+
+    m_total.network.merge(m_current.network);
+    m_total.process.merge(m_current.process);
+    m_total.ahead += m_current.ahead;
+    m_current.network.reset();
+    m_current.process.reset();
+    m_current.ahead = 0;
+    m_intervalStart = 0;
+    m_due = false;
+}
+
+void LatencyTracker::print_stats(FILE* fp) {
+    std::lock_guard<std::mutex> lock(m_lock);
+    Latencies total = m_total;
+    total.network.merge(m_current.network);
+    total.process.merge(m_current.process);
+    total.ahead += m_current.ahead;
+    print(fp, "overall", total);
+}
+
+void LatencyTracker::serialize(std::ostream& stream) {
+    std::lock_guard<std::mutex> lock(m_lock);
+    for (int path = 0; path < (m_process ? 2 : 1); ++path) {
+        LatencyHistogram hist = path == 0 ? m_total.network : m_total.process;
+        hist.merge(path == 0 ? m_current.network : m_current.process);
+
+        stream << "{\"type\": \"latency\", \"path\": \"" << (path == 0 ? "network" : "process") << "\"";
+        stream << ", \"count\": " << hist.count();
+        if (path == 0)
+            stream << ", \"ahead\": " << m_total.ahead + m_current.ahead;
+        stream << ", \"minNs\": " << hist.min();
+        stream << ", \"meanNs\": " << hist.mean();
+        for (size_t i = 0; i < arrayLength(percentiles); ++i)
+            stream << ", \"" << percentile_names[i] << "Ns\": " << hist.percentile(percentiles[i]);
+        stream << ", \"maxNs\": " << hist.max() << "}\n";
+    }
+}
@@ -0,0 +1,146 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'bldDecode'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'bldDecode', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <ostream>
+#include <mutex>
+
+#include "recv.h"
+#include "packet.h"
+
+/** Linear sub-buckets per power of two, as a power of two. 6 bits keeps every bucket within 1.6% of its values */
+#define LATENCY_SUB_BUCKET_BITS 6
+#define LATENCY_SUB_BUCKETS (1u << LATENCY_SUB_BUCKET_BITS)
+
+/** Latencies from 2^LATENCY_MAX_BITS ns (about 18 minutes) up are counted in the last bucket */
+#define LATENCY_MAX_BITS 40
+
+#define LATENCY_BUCKETS ((LATENCY_MAX_BITS - LATENCY_SUB_BUCKET_BITS + 1) * LATENCY_SUB_BUCKETS)
+
+/** Default interval between latency summaries, in seconds */
+#define DEFAULT_LATENCY_INTERVAL 10.0
+
+/**
+ * Log-linear histogram of latencies in ns, in the style of HdrHistogram: values below LATENCY_SUB_BUCKETS are
+ * counted exactly, above that every power of two is split into LATENCY_SUB_BUCKETS equal buckets. Recording is a
+ * count leading zeros and an increment, nothing is allocated. Not thread safe.
+ */
+class LatencyHistogram {
+public:
+    LatencyHistogram() { reset(); }
+
+    inline void record(uint64_t ns) {
+        ++m_counts[bucket(ns)];
+        ++m_count;
+        m_sum += ns;
+        if (ns < m_min)
+            m_min = ns;
+        if (ns > m_max)
+            m_max = ns;
+    }
+
+    void merge(const LatencyHistogram& other);
+    void reset();
+
+    /**
+     * \brief Latency that p percent of the recorded values don't exceed
+     * \returns Upper bound of the bucket holding that value, or 0 if nothing was recorded
+     */
+    uint64_t percentile(double p) const;
+
+    inline uint64_t count() const { return m_count; }
+    inline uint64_t min() const { return m_count ? m_min : 0; }
+    inline uint64_t max() const { return m_max; }
+    inline double mean() const { return m_count ? double(m_sum) / m_count : 0.0; }
+
+private:
+    static inline unsigned bucket(uint64_t ns) {
+        if (ns < LATENCY_SUB_BUCKETS)
+            return unsigned(ns);
+        const unsigned exp = 63 - __builtin_clzll(ns);
+        if (exp >= LATENCY_MAX_BITS)
+            return LATENCY_BUCKETS - 1;
+        const unsigned shift = exp - LATENCY_SUB_BUCKET_BITS;
+        return (shift + 1) * LATENCY_SUB_BUCKETS + unsigned((ns >> shift) & (LATENCY_SUB_BUCKETS - 1));
+    }
+
+    /** \returns Largest value counted in a bucket */
+    static uint64_t bucket_limit(unsigned index);
+
+    uint64_t m_counts[LATENCY_BUCKETS];
+    uint64_t m_count;
+    uint64_t m_sum;
+    uint64_t m_min;
+    uint64_t m_max;
+};
+
+/**
+ * Measures the latency of the BLD path from two histograms:
+ *  - network: receive time minus the BLD timestamp of the newest event in the packet, which is when the sender
+ *    could have sent it at the earliest. Includes the sender's own delay, and any offset between its clock and ours.
+ *  - process: time from the receive to the output stage, covering queueing and decoding in this process.
+ * The receive times are the kernel's SO_TIMESTAMPNS timestamps. Percentiles of the latencies since the last summary
+ * are printed every interval of receive time, and of all latencies on exit.
+ * Safe to call from several output threads at once.
+ */
+class LatencyTracker {
+public:
+    /**
+     * \param interval Seconds of receive time between summaries
+     * \param process Measure the process latency. Off when reading captures, whose receive times are long past
+     */
+    LatencyTracker(double interval, bool process);
+
+    LatencyTracker(const LatencyTracker&) = delete;
+    LatencyTracker& operator=(const LatencyTracker&) = delete;
+
+    /**
+     * \brief Record the latencies of a packet with a valid header
+     * \param outputTime Time the packet reached the output stage, in ns since the Unix epoch
+     * \returns True if the interval has elapsed and print_summary() should be called
+     */
+    bool track(const PacketSlot& slot, const BldPacketView& packet, uint64_t outputTime);
+
+    /**
+     * \brief Print the percentiles since the last summary, if there were any packets, and restart the interval
+     */
+    void print_summary(FILE* fp);
+
+    /**
+     * \brief Print the percentiles of every packet tracked
+     */
+    void print_stats(FILE* fp);
+
+    /**
+     * \brief Write the overall histograms as JSON Lines, one {"type": "latency", ...} object each
+     */
+    void serialize(std::ostream& stream);
+
+private:
+    struct Latencies {
+        LatencyHistogram network;
+        LatencyHistogram process;
+        uint64_t ahead = 0;             // Packets whose BLD timestamp is later than their receive time
+    };
+
+    static void print(FILE* fp, const char* name, const LatencyHistogram& hist);
+    void print(FILE* fp, const char* title, const Latencies& lat);
+
+    uint64_t m_interval;                // ns
+    bool m_process;
+
+    std::mutex m_lock;
+    uint64_t m_intervalStart = 0;       // Receive time the current interval started at
+    bool m_due = false;
+    Latencies m_current;                // Since the last summary
+    Latencies m_total;
+};
@@ -0,0 +1,176 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'bldDecode'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'bldDecode', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+#include "listener.h"
+#include "net.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+
+#define MAX_EPOLL_EVENTS 64
+
+bool load_stream_config(const char* file, bool unicast, std::vector<std::unique_ptr<BldStream>>& streams) {
+    std::ifstream stream(file);
+    if (!stream.good()) {
+        printf("Unable to open stream config %s\n", file);
+        return false;
+    }
+
+    std::string line;
+    for (int lineNum = 1; std::getline(stream, line); ++lineNum) {
+        // Strip comments
+        auto comment = line.find('#');
+        if (comment != std::string::npos)
+            line.erase(comment);
+
+        std::istringstream fields(line);
+        std::string group, payload;
+        int port;
+        if (!(fields >> group))
+            continue; // Blank line
+
+        if (!(fields >> port >> payload) || port <= 0 || port > 65535) {
+            printf("%s:%d: expected '<group> <port> <payload PV | format=...>'\n", file, lineNum);
+            return false;
+        }
+
+        // Unicast sockets sharing a port would have the kernel spread each sender's packets across them
+        if (unicast) {
+            for (auto& other : streams) {
+                if (other->port == port) {
+                    printf("%s:%d: port %d is already used by %s, unicast streams need distinct ports\n", file, lineNum,
+                        port, other->name.c_str());
+                    return false;
+                }
+            }
+        }
+
+        std::unique_ptr<BldStream> s(new BldStream);
+        s->mcastAddr = group;
+        s->port = port;
+        s->name = group + ":" + std::to_string(port);
+
+        static const std::string formatPrefix = "format=";
+        if (payload.compare(0, formatPrefix.size(), formatPrefix) == 0) {
+            if (!parse_channel_formats(payload.c_str() + formatPrefix.size(), s->schema)) {
+                printf("\n%s:%d: invalid format\n", file, lineNum);
+                return false;
+            }
+        }
+        else
+            s->payloadPV = payload;
+
+        streams.push_back(std::move(s));
+    }
+
+    if (streams.empty()) {
+        printf("No streams defined in %s\n", file);
+        return false;
+    }
+    return true;
+}
+
+StreamListener::StreamListener(std::vector<std::unique_ptr<BldStream>>& streams, bool unicast, int rcvBuf, const HeaderFilter* filter,
+    unsigned batchSize, DecodeFn decode, OutputFn output, Report* report) :
+    m_receiver(batchSize),
+    m_decode(decode),
+    m_output(output),
+    m_report(report)
+{
+    if ((m_epollfd = epoll_create1(0)) < 0) {
+        perror("epoll_create1 failed");
+        exit(EXIT_FAILURE);
+    }
+
+    for (auto& s : streams) {
+        SocketOptions opts;
+        opts.port = s->port;
+        opts.mcastAddr = s->mcastAddr.c_str();
+        opts.unicast = unicast;
+        opts.rcvBuf = rcvBuf;
+        HeaderFilter streamFilter;
+        if (filter) {
+            streamFilter = *filter;
+            // Layouts read from a payload PV may change at run time, only the header length is checked for those
+            streamFilter.payloadSize = s->payloadPV.empty() ? s->layout()->schema.payload_size() : 0;
+            opts.filter = &streamFilter;
+        }
+        // Several multicast streams may share a port on different groups
+        opts.reusePort = !unicast;
+
+        std::unique_ptr<Entry> entry(new Entry);
+        entry->stream = s.get();
+        if ((entry->sockfd = open_bld_socket(opts)) < 0)
+            exit(EXIT_FAILURE);
+
+        // Streams are only read when epoll says they're ready, never block on one
+        fcntl(entry->sockfd, F_SETFL, fcntl(entry->sockfd, F_GETFL) | O_NONBLOCK);
+
+        epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = entry.get();
+        if (epoll_ctl(m_epollfd, EPOLL_CTL_ADD, entry->sockfd, &ev) < 0) {
+            perror("epoll_ctl failed");
+            exit(EXIT_FAILURE);
+        }
+        m_entries.push_back(std::move(entry));
+    }
+}
+
+StreamListener::~StreamListener() {
+    for (auto& entry : m_entries)
+        close(entry->sockfd);
+    close(m_epollfd);
+}
+
+void StreamListener::run(int64_t numPackets) {
+    epoll_event events[MAX_EPOLL_EVENTS];
+
+    while (numPackets > 0 && !stop_requested()) {
+        const int nev = epoll_wait(m_epollfd, events, MAX_EPOLL_EVENTS, -1);
+        if (nev < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("epoll_wait failed");
+            exit(EXIT_FAILURE);
+        }
+
+        for (int e = 0; e < nev && numPackets > 0 && !stop_requested(); ++e) {
+            auto& entry = *static_cast<Entry*>(events[e].data.ptr);
+
+            // One batch per wakeup; epoll is level triggered and will report the stream again if more is pending
+            const int count = m_receiver.receive(entry.sockfd);
+            if (count < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                    continue;
+                perror("recvmmsg failed");
+                exit(EXIT_FAILURE);
+            }
+
+            for (int i = 0; i < count && numPackets > 0; ++i, --numPackets) {
+                const DecodeResult result = m_decode(*entry.stream, entry.validator, m_receiver[i]);
+                m_output(*entry.stream, m_report, m_receiver[i], result);
+                ++entry.packets;
+            }
+        }
+    }
+}
+
+void StreamListener::print_stats(FILE* fp) const {
+    for (auto& entry : m_entries)
+        fprintf(fp, "Stream %s: %lu packets\n", entry->stream->name.c_str(), entry->packets);
+    if (m_receiver.batch_size() > 1)
+        m_receiver.stats().print(fp, m_receiver.batch_size());
+}
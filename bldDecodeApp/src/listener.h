@@ -0,0 +1,75 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'bldDecode'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'bldDecode', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+#include "recv.h"
+#include "report.h"
+#include "stream.h"
+#include "net.h"
+
+/**
+ * \brief Load a list of streams from a config file.
+ * Each line describes one stream as '<group> <port> <payload>', where payload is either the name of a BLD_PAYLOAD PV
+ * or a format string prefixed with 'format=' (i.e. 'format=f,u,i'). Blank lines and lines starting with '#' are ignored.
+ * \param unicast Streams are received as unicast, so each needs a port of its own
+ * \returns false if the file can't be read or contains errors. The reason has already been printed
+ */
+bool load_stream_config(const char* file, bool unicast, std::vector<std::unique_ptr<BldStream>>& streams);
+
+/**
+ * Serves any number of BLD streams from a single epoll event loop.
+ * Every stream keeps its own socket and validator; streams are serviced one batch at a time so a busy stream can't starve the others.
+ */
+class StreamListener {
+public:
+    /**
+     * \param streams Streams to listen to. Must outlive the listener
+     * \param unicast Don't join the multicast groups
+     * \param rcvBuf Receive buffer size of each stream's socket in bytes, 0 to keep the system default
+     * \param filter Header checks to make in the kernel, with the length checked against each stream's payload.
+     *        nullptr for none
+     * \param batchSize Maximum number of packets received per syscall
+     * \param report Report handed to the output callback, may be nullptr
+     */
+    StreamListener(std::vector<std::unique_ptr<BldStream>>& streams, bool unicast, int rcvBuf, const HeaderFilter* filter,
+        unsigned batchSize,
+        DecodeFn decode, OutputFn output, Report* report);
+    ~StreamListener();
+
+    StreamListener(const StreamListener&) = delete;
+    StreamListener& operator=(const StreamListener&) = delete;
+
+    /**
+     * \brief Run the event loop until numPackets have been received across all streams
+     */
+    void run(int64_t numPackets);
+
+    /** Print per-stream packet counts and batch statistics */
+    void print_stats(FILE* fp) const;
+
+private:
+    struct Entry {
+        BldStream* stream;
+        int sockfd;
+        PacketValidator validator;
+        uint64_t packets = 0;
+    };
+
+    std::vector<std::unique_ptr<Entry>> m_entries;
+    BatchReceiver m_receiver;
+    DecodeFn m_decode;
+    OutputFn m_output;
+    Report* m_report;
+    int m_epollfd;
+};
@@ -0,0 +1,145 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'bldDecode'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'bldDecode', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+#include "loss.h"
+
+#include <cmath>
+#include <algorithm>
+#include <string>
+#include <cstring>
+
+/* BLD timestamps (seconds << 32 | nanoseconds) in plain nanoseconds, for differences */
+static inline uint64_t bld_ts_to_ns(uint64_t ts) {
+    return (ts >> 32) * 1000000000ull + (ts & 0xFFFFFFFF);
+}
+
+LossTracker::LossTracker(double beamRate, FILE* live) :
+    m_step(beamRate > 0 ? std::max(uint64_t(1), uint64_t(llround(PULSE_ID_RATE / beamRate))) : 0),
+    m_beamRate(beamRate),
+    m_live(live)
+{
+}
+
+void LossTracker::track(const PacketSlot& slot, const BldPacketView& packet) {
+    const uint64_t key = source_key(slot.from);
+    const uint64_t headerTime = bld_ts_to_ns(packet.time_stamp());
+
+    std::lock_guard<std::mutex> lock(m_lock);
+    SenderStats* sender = m_senders.find_or_add(key);
+    if (!sender)
+        return;
+    SenderStats& s = *sender;
+
+    if (s.packets == 0) {
+        s.step = m_step;
+        s.firstPulse = s.lastPulse = packet.pulse_id();
+        s.firstTime = headerTime;
+        s.firstRecv = slot.recvTime;
+    }
+    else if (slot.recvTime && s.lastRecv) {
+        // Arrival interval
+        const double interval = double(int64_t(slot.recvTime - s.lastRecv));
+        const double delta = interval - s.intervalMean;
+        s.intervalMean += delta / ++s.intervals;
+        s.intervalM2 += delta * (interval - s.intervalMean);
+        s.intervalMax = std::max(s.intervalMax, interval);
+
+        // Transit time variation, RFC 3550 section 6.4.1
+        const double d = interval - double(int64_t(headerTime - s.lastHeaderTime));
+        s.jitter += (std::fabs(d) - s.jitter) / 16;
+    }
+    ++s.packets;
+    s.lastRecv = slot.recvTime;
+    s.lastHeaderTime = headerTime;
+
+    for (const auto& event : packet) {
+        // The first pulse of a sender has nothing to compare to
+        if (s.events++ > 0)
+            track_pulse(key, s, event.pulseID);
+        s.lastTime = std::max(s.lastTime, bld_ts_to_ns(event.timeStamp));
+    }
+}
+
+void LossTracker::track_pulse(uint64_t key, SenderStats& s, uint64_t pulseID) {
+    if (pulseID == s.lastPulse) {
+        ++s.duplicates;
+        if (m_live)
+            fprintf(m_live, "Duplicate pulse ID 0x%lX from %s\n", pulseID, source_name(key).c_str());
+        return;
+    }
+    if (pulseID < s.lastPulse) {
+        ++s.reordered;
+        if (m_live)
+            fprintf(m_live, "Pulse ID 0x%lX from %s arrived after 0x%lX\n", pulseID, source_name(key).c_str(), s.lastPulse);
+        return;
+    }
+
+    const uint64_t delta = pulseID - s.lastPulse;
+    s.lastPulse = pulseID;
+
+    // Without a beam rate, the step is the smallest seen so far. Gaps found before the step settles are undercounted
+    if (s.step == 0 || (m_step == 0 && delta < s.step)) {
+        s.step = delta;
+        return;
+    }
+
+    if (delta > s.step) {
+        const uint64_t missing = delta / s.step - (delta % s.step == 0);
+        ++s.gaps;
+        s.missing += missing;
+        if (m_live)
+            fprintf(m_live, "Pulse ID gap from %s: 0x%lX -> 0x%lX, %lu pulses missing\n", source_name(key).c_str(),
+                pulseID - delta, pulseID, missing);
+    }
+}
+
+void LossTracker::print_stats(FILE* fp) {
+    std::lock_guard<std::mutex> lock(m_lock);
+    for (size_t i = 0; i < m_senders.size(); ++i) {
+        const SenderStats& s = m_senders.value(i);
+        const uint64_t expected = s.step ? (s.lastPulse - s.firstPulse) / s.step + 1 : s.events;
+        const double span = (s.lastTime - s.firstTime) / 1e9;
+        const double recvSpan = (s.lastRecv - s.firstRecv) / 1e9;
+        const double expectedRate = m_beamRate > 0 ? m_beamRate : s.step ? PULSE_ID_RATE / s.step : 0;
+
+        fprintf(fp, "Sender %s: %lu packets, %lu events, pulse ID 0x%lX-0x%lX\n", source_name(m_senders.key(i)).c_str(),
+            s.packets, s.events, s.firstPulse, s.lastPulse);
+        fprintf(fp, "  %lu gaps, %lu pulses missing (%.3f%% loss), %lu duplicates, %lu reordered, step %lu\n",
+            s.gaps, s.missing, expected ? 100.0 * s.missing / expected : 0.0, s.duplicates, s.reordered, s.step);
+        fprintf(fp, "  event rate %.1f Hz (expected %.1f Hz), packet rate %.1f Hz\n",
+            span > 0 ? (s.events - 1) / span : 0.0, expectedRate, recvSpan > 0 ? (s.packets - 1) / recvSpan : 0.0);
+        if (s.intervals > 0) {
+            fprintf(fp, "  arrival interval mean %.1f us, std %.1f us, max %.1f us, jitter %.1f us\n",
+                s.intervalMean / 1e3, s.intervals > 1 ? sqrt(s.intervalM2 / (s.intervals - 1)) / 1e3 : 0.0,
+                s.intervalMax / 1e3, s.jitter / 1e3);
+        }
+    }
+    if (m_senders.overflowed())
+        fprintf(fp, "%lu packets from senders beyond the first %d were not tracked\n", m_senders.overflowed(), MAX_SOURCES);
+}
+
+void LossTracker::serialize(std::ostream& stream) {
+    std::lock_guard<std::mutex> lock(m_lock);
+    for (size_t i = 0; i < m_senders.size(); ++i) {
+        const SenderStats& s = m_senders.value(i);
+        stream << "{\"type\": \"sender\", \"sender\": \"" << source_name(m_senders.key(i)) << "\"";
+        stream << ", \"packets\": " << s.packets;
+        stream << ", \"events\": " << s.events;
+        stream << ", \"firstPulseID\": " << s.firstPulse;
+        stream << ", \"lastPulseID\": " << s.lastPulse;
+        stream << ", \"pulseIDStep\": " << s.step;
+        stream << ", \"gaps\": " << s.gaps;
+        stream << ", \"missing\": " << s.missing;
+        stream << ", \"duplicates\": " << s.duplicates;
+        stream << ", \"reordered\": " << s.reordered;
+        stream << ", \"intervalMeanNs\": " << s.intervalMean;
+        stream << ", \"intervalMaxNs\": " << s.intervalMax;
+        stream << ", \"jitterNs\": " << s.jitter << "}\n";
+    }
+}
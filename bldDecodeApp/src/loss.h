@@ -0,0 +1,89 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'bldDecode'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'bldDecode', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <ostream>
+#include <mutex>
+
+#include "recv.h"
+#include "packet.h"
+#include "source.h"
+
+/** Pulse ID rate of the LCLS-II timing system (1300 MHz / 1400), in Hz */
+constexpr double PULSE_ID_RATE = 1300e6 / 1400;
+
+/**
+ * Follows the pulse IDs of every sender across packet headers and complementary events, counting gaps, duplicates
+ * and reordering, and measures how regularly the packets arrive.
+ *
+ * The expected pulse ID step comes from the beam rate if one is given, otherwise it is the smallest step seen from
+ * that sender. Arrival jitter is the RFC 3550 interarrival jitter: the smoothed difference between the spacing of
+ * the receive times and the spacing of the BLD timestamps, so it only grows with delay added between the source and
+ * us. Senders are looked up in a SourceTable, so tracking never allocates; senders beyond MAX_SOURCES are only counted.
+ * Safe to call from several output threads at once, but packets from one sender must be tracked in the order
+ * they were received for the reordering count to mean anything.
+ */
+class LossTracker {
+public:
+    struct SenderStats {
+        uint64_t packets = 0;
+        uint64_t events = 0;
+        uint64_t gaps = 0;              // Jumps larger than the expected step
+        uint64_t missing = 0;           // Pulses missing in those jumps
+        uint64_t duplicates = 0;        // Pulse ID seen twice in a row
+        uint64_t reordered = 0;         // Pulse ID lower than the last one
+        uint64_t step = 0;              // Expected pulse ID step, 0 until known
+        uint64_t firstPulse = 0;
+        uint64_t lastPulse = 0;         // Highest pulse ID seen
+        uint64_t firstTime = 0;         // BLD timestamps of the first and last event, in ns
+        uint64_t lastTime = 0;
+        uint64_t firstRecv = 0;         // Receive times of the first and last packet, in ns since the Unix epoch
+        uint64_t lastRecv = 0;
+        uint64_t intervals = 0;         // Arrival intervals measured
+        double intervalMean = 0;        // Mean and sum of squared differences of the arrival interval, in ns
+        double intervalM2 = 0;
+        double intervalMax = 0;
+        double jitter = 0;              // RFC 3550 interarrival jitter, in ns
+        uint64_t lastHeaderTime = 0;    // BLD timestamp of the last packet header, in ns
+    };
+
+    /**
+     * \param beamRate Expected event rate in Hz, 0 to learn the pulse ID step from the data
+     * \param live Print gaps and reordering as they are found, nullptr to only count them
+     */
+    explicit LossTracker(double beamRate = 0, FILE* live = nullptr);
+
+    LossTracker(const LossTracker&) = delete;
+    LossTracker& operator=(const LossTracker&) = delete;
+
+    /**
+     * \brief Track the events of a packet with a valid header
+     */
+    void track(const PacketSlot& slot, const BldPacketView& packet);
+
+    void print_stats(FILE* fp);
+
+    /**
+     * \brief Write the per-sender counters as JSON Lines, one {"type": "sender", ...} object per sender
+     */
+    void serialize(std::ostream& stream);
+
+private:
+    void track_pulse(uint64_t key, SenderStats& s, uint64_t pulseID);
+
+    uint64_t m_step;                    // Step derived from the beam rate, 0 to learn it
+    double m_beamRate;
+    FILE* m_live;
+
+    std::mutex m_lock;
+    SourceTable<SenderStats> m_senders;
+};
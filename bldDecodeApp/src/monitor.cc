@@ -0,0 +1,168 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'bldDecode'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'bldDecode', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+#include "monitor.h"
+#include "net.h"
+
+#include <algorithm>
+#include <chrono>
+
+bool PendingPackets::hold(const PacketSlot& slot) {
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (m_data.size() + slot.len > m_capacity) {
+        ++m_dropped;
+        return false;
+    }
+    Held h;
+    h.offset = m_data.size();
+    h.len = slot.len;
+    h.from = slot.from;
+    h.recvTime = slot.recvTime;
+    m_data.insert(m_data.end(), slot.data, slot.data + slot.len);
+    m_held.push_back(h);
+    m_count = m_held.size();
+    return true;
+}
+
+void PendingPackets::print_stats(FILE* fp, const std::string& name) {
+    fprintf(fp, "Held %lu packets%s%s until the payload layout was read", m_replayed, name.empty() ? "" : " on ",
+        name.c_str());
+    if (m_dropped)
+        fprintf(fp, ", dropped %lu more for lack of space", m_dropped);
+    if (!m_held.empty())
+        fprintf(fp, ", %lu never decoded", m_held.size());
+    fprintf(fp, "\n");
+}
+
+PayloadMonitor::PayloadMonitor(pvxs::client::Context& ctx, const std::string& cacheDir, bool verbose) :
+    m_ctx(ctx),
+    m_cacheDir(cacheDir),
+    m_verbose(verbose)
+{
+}
+
+PayloadMonitor::~PayloadMonitor() {
+    close();
+}
+
+void PayloadMonitor::watch(BldStream& stream) {
+    BldStream* s = &stream;
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_watched.push_back({s, false});
+    }
+    m_subs.push_back(m_ctx.monitor(stream.payloadPV)
+        .maskConnected(true)
+        .maskDisconnected(false)
+        .event([this, s](pvxs::client::Subscription& sub) {
+            try {
+                for (;;) {
+                    pvxs::Value value = sub.pop();
+                    if (!value.valid())
+                        break;
+                    update(*s, value);
+                }
+            }
+            catch(pvxs::client::Disconnect& e) {
+                printf("Payload PV '%s' disconnected, keeping its last layout\n", s->payloadPV.c_str());
+            }
+            catch(std::exception& e) {
+                printf("Error monitoring payload PV '%s': %s\n", s->payloadPV.c_str(), e.what());
+            }
+        })
+        .exec());
+}
+
+void PayloadMonitor::update(BldStream& stream, const pvxs::Value& value) {
+    PayloadSchema schema;
+    if (!schema_from_value(value, stream.payloadPV.c_str(), schema))
+        return;
+
+    // Every (re)connect delivers the whole value, only publish it if the payload changed
+    const StreamLayout* current = stream.layout();
+    if (current && same_payload(current->schema, schema)) {
+        if (m_verbose)
+            printf("Payload layout of '%s' matches the one in use\n", stream.payloadPV.c_str());
+    }
+    else {
+        // A filter that compiled against the previous layout, or was waiting for this one, matches nothing now
+        if (!stream.set_layout(schema)) {
+            printf("The filter does not fit the payload layout of '%s', stopping\n", stream.payloadPV.c_str());
+            fail();
+        }
+        else if (current)
+            printf("Payload layout of '%s' changed, now %d channels\n", stream.payloadPV.c_str(), schema.numChannels);
+        else if (m_verbose)
+            printf("Read payload layout of '%s', %d channels\n", stream.payloadPV.c_str(), schema.numChannels);
+
+        if (!m_cacheDir.empty())
+            save_cached_schema(m_cacheDir, stream.payloadPV, schema);
+    }
+
+    std::lock_guard<std::mutex> lock(m_lock);
+    for (auto& w : m_watched) {
+        if (w.stream == &stream)
+            w.read = true;
+    }
+    m_published.notify_all();
+}
+
+void PayloadMonitor::fail() {
+    m_failed = true;
+    request_stop();
+}
+
+void PayloadMonitor::start_watchdog(double timeout) {
+    if (!m_watchdog.joinable())
+        m_watchdog = std::thread(&PayloadMonitor::watchdog, this, timeout);
+}
+
+void PayloadMonitor::watchdog(double timeout) {
+    std::unique_lock<std::mutex> lock(m_lock);
+    const bool done = m_published.wait_for(lock, std::chrono::duration<double>(timeout), [this] {
+        return m_closing || std::all_of(m_watched.begin(), m_watched.end(), [](const Watched& w) { return w.read; });
+    });
+    if (done)
+        return;
+
+    for (const auto& w : m_watched) {
+        if (w.read)
+            continue;
+        if (w.stream->layout())
+            printf("Payload PV '%s' not read after %g s, still decoding with its cached layout, which may be stale\n",
+                w.stream->payloadPV.c_str(), timeout);
+        else {
+            printf("Timeout while reading PV '%s', please specify channel formats manually with -f\n",
+                w.stream->payloadPV.c_str());
+            fail();
+        }
+    }
+}
+
+bool PayloadMonitor::wait(const BldStream& stream, double timeout) {
+    std::unique_lock<std::mutex> lock(m_lock);
+    if (m_published.wait_for(lock, std::chrono::duration<double>(timeout), [&stream] { return stream.layout() != nullptr; }))
+        return true;
+    printf("Timeout while reading PV '%s', please specify channel formats manually with -f\n", stream.payloadPV.c_str());
+    return false;
+}
+
+void PayloadMonitor::close() {
+    for (auto& sub : m_subs)
+        sub->cancel();
+    m_subs.clear();
+
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_closing = true;
+    }
+    m_published.notify_all();
+    if (m_watchdog.joinable())
+        m_watchdog.join();
+}
@@ -0,0 +1,171 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'bldDecode'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'bldDecode', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+#include "pvxs/client.h"
+
+#include "recv.h"
+#include "stream.h"
+
+/** Most packet data held per stream while its payload PV is read, further packets are dropped */
+#define PENDING_PACKET_BYTES (64UL << 20)
+
+/** Seconds to wait for a payload PV when its layout is needed before receiving */
+#define PAYLOAD_PV_TIMEOUT 10.0
+
+/**
+ * Copies of the packets a stream received before its first layout, replayed through the decode and output stages once
+ * it's known. Packets are stored back to back in one buffer, only taking the space of their data.
+ * Safe to use from several output threads at once, as the shards do when their output isn't serialized.
+ */
+class PendingPackets {
+public:
+    explicit PendingPackets(size_t capacity = PENDING_PACKET_BYTES) : m_capacity(capacity) {}
+
+    PendingPackets(const PendingPackets&) = delete;
+    PendingPackets& operator=(const PendingPackets&) = delete;
+
+    /**
+     * \brief Copy a packet into the buffer
+     * \returns false if the buffer is full, the packet is dropped and counted
+     */
+    bool hold(const PacketSlot& slot);
+
+    /**
+     * \brief Call fn(const PacketSlot&) for every held packet, in the order they were received, then free the buffer.
+     * Packets held meanwhile, by fn itself or by other threads, are kept for the next replay. Returns right away if
+     * a replay is already running, on another thread or further up this one's stack
+     */
+    template<class Fn>
+    void replay(Fn fn) {
+        bool idle = false;
+        if (!m_replaying.compare_exchange_strong(idle, true))
+            return;
+
+        std::vector<char> data;
+        std::vector<Held> held;
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            data.swap(m_data);
+            held.swap(m_held);
+            m_count = 0;
+        }
+        for (const auto& h : held) {
+            memcpy(m_slot.data, data.data() + h.offset, h.len);
+            m_slot.len = h.len;
+            m_slot.from = h.from;
+            m_slot.recvTime = h.recvTime;
+            m_slot.kernelDrops = 0;
+            fn(m_slot);
+        }
+        m_replayed += held.size();
+        m_replaying = false;
+    }
+
+    inline bool empty() const { return m_count == 0; }
+
+    void print_stats(FILE* fp, const std::string& name);
+
+private:
+    struct Held {
+        size_t offset;
+        ssize_t len;
+        sockaddr_in from;
+        uint64_t recvTime;
+    };
+
+    size_t m_capacity;
+    std::mutex m_lock;                      // Guards the held packets
+    std::atomic<bool> m_replaying {false};  // Set by the thread replaying, guards m_slot and m_replayed
+    std::vector<char> m_data;
+    std::vector<Held> m_held;
+    std::atomic<size_t> m_count {0};        // Packets held, checked on every packet without taking the lock
+    PacketSlot m_slot;
+    uint64_t m_replayed = 0;
+    uint64_t m_dropped = 0;
+};
+
+/**
+ * Keeps the layouts of streams described by a payload PV up to date. Each PV is monitored, and every update with a
+ * different payload is published as a new layout of its stream, atomically for the decode and output stages, and
+ * written to the schema cache for the next start. Updates arrive on pvxs worker threads.
+ */
+class PayloadMonitor {
+public:
+    /**
+     * \param cacheDir Directory of the schema cache, empty to not cache the layouts
+     */
+    PayloadMonitor(pvxs::client::Context& ctx, const std::string& cacheDir, bool verbose);
+    ~PayloadMonitor();
+
+    PayloadMonitor(const PayloadMonitor&) = delete;
+    PayloadMonitor& operator=(const PayloadMonitor&) = delete;
+
+    /**
+     * \brief Start monitoring the payload PV of a stream. The stream must outlive the monitor
+     */
+    void watch(BldStream& stream);
+
+    /**
+     * \brief Wait until a stream has a layout
+     * \returns false on timeout. The reason has already been printed
+     */
+    bool wait(const BldStream& stream, double timeout = PAYLOAD_PV_TIMEOUT);
+
+    /**
+     * \brief Check from a thread of its own that every payload PV is read within the timeout. A stream still without a
+     * layout by then can't be decoded, the timeout is printed and the receive loops are stopped. A stream decoding its
+     * cached layout carries on, with a warning that the layout may be stale
+     */
+    void start_watchdog(double timeout = PAYLOAD_PV_TIMEOUT);
+
+    /**
+     * \returns True if a payload PV was never read, or a layout read from one doesn't fit the filter expression
+     */
+    inline bool failed() const { return m_failed; }
+
+    /**
+     * \brief Stop monitoring, the streams keep their current layouts
+     */
+    void close();
+
+private:
+    struct Watched {
+        BldStream* stream;
+        bool read;                  // The PV has delivered a layout, cached layouts are confirmed or replaced
+    };
+
+    void update(BldStream& stream, const pvxs::Value& value);
+    void watchdog(double timeout);
+    void fail();
+
+    pvxs::client::Context& m_ctx;
+    std::string m_cacheDir;
+    bool m_verbose;
+    std::vector<std::shared_ptr<pvxs::client::Subscription>> m_subs;
+    std::thread m_watchdog;
+    std::atomic<bool> m_failed {false};
+
+    std::mutex m_lock;
+    std::condition_variable m_published;    // A stream's PV was read, or the monitor is closing
+    std::vector<Watched> m_watched;
+    bool m_closing = false;
+};
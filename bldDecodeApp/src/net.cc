@@ -0,0 +1,197 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'bldDecode'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'bldDecode', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+#include "net.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <cstddef>
+#include <vector>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <linux/filter.h>
+
+#include "bld-proto.h"
+
+// Sockets shut down by request_stop(). Only appended to by the main thread, read from a signal handler
+static std::atomic<bool> s_stop(false);
+static int s_stopSockets[MAX_STOP_SOCKETS];
+static std::atomic<unsigned> s_numStopSockets(0);
+
+void request_stop() {
+    s_stop = true;
+    const unsigned n = s_numStopSockets;
+    for (unsigned i = 0; i < n; ++i)
+        shutdown(s_stopSockets[i], SHUT_RD);
+}
+
+bool stop_requested() {
+    return s_stop.load(std::memory_order_relaxed);
+}
+
+int open_bld_socket(const SocketOptions& opts) {
+    int sockfd;
+    struct sockaddr_in servaddr;
+
+    // Creating socket file descriptor
+    if ( (sockfd = socket(AF_INET, SOCK_DGRAM, 0)) < 0 ) {
+        perror("socket creation failed");
+        return -1;
+    }
+
+    int one = 1;
+    if (opts.reusePort) {
+        if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0) {
+            perror("failed to set SO_REUSEPORT: setsockopt failed");
+            close(sockfd);
+            return -1;
+        }
+    }
+
+    // Have the kernel timestamp each datagram on arrival, so recordings don't include our own queueing delay
+    if (setsockopt(sockfd, SOL_SOCKET, SO_TIMESTAMPNS, &one, sizeof(one)) < 0) {
+        perror("failed to set SO_TIMESTAMPNS: setsockopt failed");
+        close(sockfd);
+        return -1;
+    }
+
+    // Have the kernel tell us how many datagrams it dropped because we didn't keep up
+    if (setsockopt(sockfd, SOL_SOCKET, SO_RXQ_OVFL, &one, sizeof(one)) < 0) {
+        perror("failed to set SO_RXQ_OVFL: setsockopt failed");
+        close(sockfd);
+        return -1;
+    }
+
+    if (opts.rcvBuf > 0) {
+        // SO_RCVBUFFORCE can go past net.core.rmem_max but needs CAP_NET_ADMIN, SO_RCVBUF is capped by it
+        if (setsockopt(sockfd, SOL_SOCKET, SO_RCVBUFFORCE, &opts.rcvBuf, sizeof(opts.rcvBuf)) < 0 &&
+            setsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &opts.rcvBuf, sizeof(opts.rcvBuf)) < 0) {
+            perror("failed to set SO_RCVBUF: setsockopt failed");
+            close(sockfd);
+            return -1;
+        }
+
+        // The kernel doubles the requested size to account for its own overhead
+        int actual = 0;
+        socklen_t len = sizeof(actual);
+        if (getsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &actual, &len) == 0 && actual / 2 < opts.rcvBuf)
+            printf("Receive buffer limited to %d bytes by net.core.rmem_max (requested %d), run as root or raise the limit\n",
+                actual / 2, opts.rcvBuf);
+    }
+
+    // Attached before binding, so no unfiltered datagram gets queued
+    if (has_socket_filter(opts) &&
+        attach_bld_filter(sockfd, opts.filter, opts.unicast ? 0 : opts.shard, opts.unicast ? 1 : opts.numShards) < 0) {
+        perror("failed to attach socket filter: setsockopt failed");
+        close(sockfd);
+        return -1;
+    }
+
+    memset(&servaddr, 0, sizeof(servaddr));
+
+    // Filling server information
+    servaddr.sin_family = AF_INET; // IPv4
+    servaddr.sin_addr.s_addr = INADDR_ANY;
+    servaddr.sin_port = htons(opts.port);
+
+    // Bind the socket with the server address
+    if ( bind(sockfd, (const struct sockaddr *)&servaddr,
+            sizeof(servaddr)) < 0 )
+    {
+        perror("bind failed");
+        close(sockfd);
+        return -1;
+    }
+
+    // If we're multicast, add ourselves to the group
+    if (!opts.unicast) {
+        ip_mreq mreq;
+        mreq.imr_interface.s_addr = INADDR_ANY;
+        mreq.imr_multiaddr.s_addr = inet_addr(opts.mcastAddr);
+
+        if (setsockopt(sockfd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0) {
+            perror("failed to opt into multicast: setsockoptfailed");
+            close(sockfd);
+            return -1;
+        }
+
+        // Only deliver datagrams for the group joined on this socket, not every group joined on the host
+        int zero = 0;
+        if (setsockopt(sockfd, IPPROTO_IP, IP_MULTICAST_ALL, &zero, sizeof(zero)) < 0) {
+            perror("failed to disable IP_MULTICAST_ALL: setsockopt failed");
+            close(sockfd);
+            return -1;
+        }
+    }
+
+    const unsigned n = s_numStopSockets;
+    if (n < MAX_STOP_SOCKETS) {
+        s_stopSockets[n] = sockfd;
+        s_numStopSockets = n + 1;
+    }
+    return sockfd;
+}
+
+int attach_bld_filter(int sockfd, const HeaderFilter* header, unsigned shard, unsigned numShards) {
+    // Filters on UDP sockets see the UDP header at offset 0, followed by the BLD header. The IP header is reached
+    // through SKF_NET_OFF. Loads are big endian, so header fields are compared with their bytes in network order
+    const uint32_t udpHeader = 8;
+    std::vector<sock_filter> code;
+    std::vector<size_t> rejects;    // Jumps to patch with the offset of the final drop
+
+    auto reject_unless_eq = [&](uint32_t k) {
+        rejects.push_back(code.size());
+        code.push_back(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, k, 0, 0));
+    };
+    auto load_word = [&](size_t offset) {
+        code.push_back(BPF_STMT(BPF_LD | BPF_W | BPF_ABS, uint32_t(udpHeader + offset)));
+    };
+
+    if (header && header->checkLength) {
+        code.push_back(BPF_STMT(BPF_LD | BPF_W | BPF_LEN, 0));                  // A = datagram length
+        rejects.push_back(code.size());
+        code.push_back(BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K,
+            uint32_t(udpHeader + bldMulticastPacketHeaderSize + header->payloadSize), 0, 0));
+    }
+    if (header && header->version >= 0) {
+        load_word(offsetof(bldMulticastPacket_t, version));
+        reject_unless_eq(ntohl(uint32_t(header->version)));
+    }
+    if (header && header->matchSevr) {
+        uint32_t words[2];
+        memcpy(words, &header->sevrMask, sizeof(words));
+        load_word(offsetof(bldMulticastPacket_t, severityMask));
+        reject_unless_eq(ntohl(words[0]));
+        load_word(offsetof(bldMulticastPacket_t, severityMask) + 4);
+        reject_unless_eq(ntohl(words[1]));
+    }
+    if (numShards > 1) {
+        code.push_back(BPF_STMT(BPF_LD | BPF_W | BPF_ABS, uint32_t(SKF_NET_OFF + 12)));  // A = IP source address
+        code.push_back(BPF_STMT(BPF_MISC | BPF_TAX, 0));                                // X = A
+        code.push_back(BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 0));                          // A = UDP source port
+        code.push_back(BPF_STMT(BPF_ALU | BPF_XOR | BPF_X, 0));                         // A ^= X
+        code.push_back(BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, numShards));                 // A %= numShards
+        reject_unless_eq(shard);
+    }
+    code.push_back(BPF_STMT(BPF_RET | BPF_K, 0xFFFFFFFF));                             // Accept the whole datagram
+    code.push_back(BPF_STMT(BPF_RET | BPF_K, 0));                                      // Drop
+
+    // Loads past the end of a short datagram drop it too
+    for (size_t i : rejects)
+        code[i].jf = uint8_t(code.size() - 1 - (i + 1));
+
+    struct sock_fprog prog;
+    prog.len = code.size();
+    prog.filter = code.data();
+    return setsockopt(sockfd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog));
+}
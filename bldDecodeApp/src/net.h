@@ -0,0 +1,80 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'bldDecode'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'bldDecode', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+/**
+ * Header checks made in the kernel by the socket filter, before a datagram is queued on the socket
+ */
+struct HeaderFilter {
+    int64_t version = -1;       // Only accept this packet version, -1 for any
+    bool matchSevr = false;     // Only accept this exact severity mask
+    uint64_t sevrMask = 0;
+    bool checkLength = false;   // Only accept datagrams holding a full header and its payload
+    size_t payloadSize = 0;     // Payload size of the stream, used by checkLength
+};
+
+/**
+ * Settings for a BLD receive socket
+ */
+struct SocketOptions {
+    int port;
+    const char* mcastAddr;
+    bool unicast;       // Don't join the multicast group
+    bool reusePort;     // Set SO_REUSEPORT, allowing several sockets to bind the same port
+    int rcvBuf = 0;     // Receive buffer size in bytes, 0 to keep the system default
+    const HeaderFilter* filter = nullptr;   // Header checks to make in the kernel, nullptr for none
+    unsigned shard = 0;         // Only accept multicast senders hashing to this shard of numShards
+    unsigned numShards = 1;
+};
+
+/**
+ * \brief Create, bind and (optionally) join the multicast group for a BLD receive socket.
+ * The socket reports the kernel's drop count with every datagram (SO_RXQ_OVFL), see PacketSlot::kernelDrops.
+ * The kernel counts datagrams rejected by a socket filter as drops too, see has_socket_filter()
+ * \returns The socket, or -1 on failure. The reason has already been printed with perror
+ */
+int open_bld_socket(const SocketOptions& opts);
+
+/** Most sockets request_stop() can wake up, later ones are only stopped once they next receive */
+#define MAX_STOP_SOCKETS 1024
+
+/**
+ * \brief Ask every receive loop to stop, e.g. on Ctrl-C. Async-signal-safe: it only sets a flag and shuts down the
+ * sockets opened by open_bld_socket(), so receives blocked on them return right away with no packets
+ */
+void request_stop();
+
+/**
+ * \returns True once request_stop() has been called. Receive loops check it before every receive
+ */
+bool stop_requested();
+
+/**
+ * \returns True if open_bld_socket() attaches a socket filter for these options
+ */
+inline bool has_socket_filter(const SocketOptions& opts) {
+    return opts.filter || (!opts.unicast && opts.numShards > 1);
+}
+
+/**
+ * \brief Attach a classic BPF socket filter that drops unwanted datagrams in the kernel, so they never wake us up.
+ * It applies the header checks, if any, then only accepts multicast datagrams whose source address and port hash to
+ * this shard. The kernel copies every multicast datagram to all sockets bound to the group, even with SO_REUSEPORT,
+ * so this is what spreads multicast senders across shards. Unicast is already balanced by SO_REUSEPORT.
+ * \param sockfd Socket to attach to
+ * \param header Header checks, nullptr for none
+ * \param shard Index of this shard
+ * \param numShards Total number of shards, 1 to accept every sender
+ * \returns 0 on success, -1 on failure (errno is set)
+ */
+int attach_bld_filter(int sockfd, const HeaderFilter* header, unsigned shard, unsigned numShards);
@@ -0,0 +1,441 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'bldDecode'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'bldDecode', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+#include "output.h"
+#include "util.h"
+
+#include <cmath>
+#include <ctime>
+#include <unistd.h>
+
+// Two digit pairs for every value 0-99, so integers are converted two digits at a time
+static const char DIGIT_PAIRS[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+static const char HEX_DIGITS[] = "0123456789ABCDEF";
+
+// Exact powers of ten, for scaling a value to its significant digits
+static const long double POW10[] = {
+    1e0L, 1e1L, 1e2L, 1e3L, 1e4L, 1e5L, 1e6L, 1e7L, 1e8L, 1e9L, 1e10L, 1e11L, 1e12L, 1e13L, 1e14L, 1e15L,
+    1e16L, 1e17L, 1e18L, 1e19L, 1e20L, 1e21L, 1e22L, 1e23L, 1e24L, 1e25L, 1e26L, 1e27L,
+};
+
+// Significant digits that round-trip any float32 and float64, used by the machine readable formats
+#define FLOAT32_DIGITS 9
+#define FLOAT64_DIGITS 17
+
+bool parse_output_format(const char* str, OutputFormat& format) {
+    if (!strcmp(str, "text"))
+        format = OutputFormat::Text;
+    else if (!strcmp(str, "csv"))
+        format = OutputFormat::Csv;
+    else if (!strcmp(str, "jsonl"))
+        format = OutputFormat::Jsonl;
+    else {
+        printf("Invalid output format '%s', expected text, csv or jsonl\n", str);
+        return false;
+    }
+    return true;
+}
+
+void OutputBuffer::put_dec(uint64_t v) {
+    char tmp[20];
+    char* p = tmp + sizeof(tmp);
+    while (v >= 100) {
+        const unsigned i = unsigned(v % 100) * 2;
+        v /= 100;
+        *--p = DIGIT_PAIRS[i + 1];
+        *--p = DIGIT_PAIRS[i];
+    }
+    if (v >= 10) {
+        *--p = DIGIT_PAIRS[v * 2 + 1];
+        *--p = DIGIT_PAIRS[v * 2];
+    }
+    else
+        *--p = char('0' + v);
+    put(p, tmp + sizeof(tmp) - p);
+}
+
+void OutputBuffer::put_dec(int64_t v) {
+    if (v < 0) {
+        put('-');
+        put_dec(uint64_t(0) - uint64_t(v));
+    }
+    else
+        put_dec(uint64_t(v));
+}
+
+void OutputBuffer::put_hex(uint64_t v, unsigned width) {
+    char tmp[16];
+    char* p = tmp + sizeof(tmp);
+    do {
+        *--p = HEX_DIGITS[v & 0xF];
+        v >>= 4;
+    } while (v);
+    while (p > tmp && unsigned(tmp + sizeof(tmp) - p) < width)
+        *--p = '0';
+    put(p, tmp + sizeof(tmp) - p);
+}
+
+// v * 10^exp, rounded to the nearest integer (ties to even, like printf)
+static uint64_t scale_pow10(double v, int exp) {
+    long double x = v;
+    while (exp > 27) {
+        x *= POW10[27];
+        exp -= 27;
+    }
+    while (exp < -27) {
+        x /= POW10[27];
+        exp += 27;
+    }
+    x = exp >= 0 ? x * POW10[exp] : x / POW10[-exp];
+    return uint64_t(nearbyintl(x));
+}
+
+void OutputBuffer::put_double(double v, int precision) {
+    // Scaling in long double only rounds exactly up to MAX_DOUBLE_PRECISION digits
+    if (precision > MAX_DOUBLE_PRECISION) {
+        char tmp[32];
+        put(tmp, snprintf(tmp, sizeof(tmp), "%.*g", precision, v));
+        return;
+    }
+    if (std::isnan(v)) {
+        put(std::signbit(v) ? "-nan" : "nan");
+        return;
+    }
+    if (std::signbit(v)) {
+        put('-');
+        v = -v;
+    }
+    if (std::isinf(v)) {
+        put("inf");
+        return;
+    }
+    if (v == 0) {
+        put('0');
+        return;
+    }
+
+    // Round to the significant digits. log10 may be off by one near powers of ten, fix the exponent up
+    precision = std::max(1, std::min(precision, MAX_DOUBLE_PRECISION));
+    const uint64_t high = uint64_t(POW10[precision]), low = high / 10;
+    int exp = int(std::floor(std::log10(v)));
+    uint64_t digits = scale_pow10(v, precision - 1 - exp);
+    if (digits < low)
+        digits = scale_pow10(v, precision - 1 - --exp);
+    if (digits >= high)
+        digits = scale_pow10(v, precision - 1 - ++exp);
+    // Rounding carried into a new digit, i.e. 999999.5
+    if (digits >= high) {
+        digits /= 10;
+        ++exp;
+    }
+
+    char d[MAX_DOUBLE_PRECISION];
+    for (int i = precision - 1; i >= 0; --i, digits /= 10)
+        d[i] = char('0' + digits % 10);
+    int ndigits = precision;
+    while (ndigits > 1 && d[ndigits - 1] == '0')
+        --ndigits;
+
+    if (exp < -4 || exp >= precision) {
+        put(d[0]);
+        if (ndigits > 1) {
+            put('.');
+            put(d + 1, ndigits - 1);
+        }
+        put(exp < 0 ? "e-" : "e+");
+        const unsigned e = exp < 0 ? -exp : exp;
+        if (e < 10)
+            put('0');
+        put_dec(uint64_t(e));
+    }
+    else if (exp >= 0) {
+        const int intDigits = exp + 1;
+        put(d, std::min(intDigits, precision));
+        if (ndigits > intDigits) {
+            put('.');
+            put(d + intDigits, ndigits - intDigits);
+        }
+    }
+    else {
+        put("0.");
+        for (int i = -1; i > exp; --i)
+            put('0');
+        put(d, ndigits);
+    }
+}
+
+void OutputBuffer::put_json_string(const std::string& s) {
+    put('"');
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            put('\\');
+            put(c);
+        }
+        else if (static_cast<unsigned char>(c) < 0x20) {
+            put("\\u00");
+            put_hex(static_cast<unsigned char>(c), 2);
+        }
+        else
+            put(c);
+    }
+    put('"');
+}
+
+void OutputBuffer::flush(FILE* fp) {
+    if (m_used)
+        fwrite(m_buf.data(), 1, m_used, fp);
+    m_used = 0;
+}
+
+static uint64_t monotonic_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return uint64_t(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+EventPrinter::EventPrinter(OutputFormat format, FILE* fp) :
+    m_format(format),
+    m_fp(fp),
+    m_tty(isatty(fileno(fp)))
+{
+}
+
+void EventPrinter::put_time(uint32_t sec) {
+    if (!m_time.valid || m_time.sec != sec) {
+        // Same as format_ts(), which only has second resolution
+        epicsTimeStamp ts = { sec, 0 };
+        time_t t;
+        epicsTimeToTime_t(&t, &ts);
+        tm tinfo;
+        localtime_r(&t, &tinfo);
+        m_time.len = strftime(m_time.str, sizeof(m_time.str), "%Y:%m:%d %H:%M:%S", &tinfo);
+        m_time.sec = sec;
+        m_time.valid = true;
+    }
+    m_buf.put(m_time.str, m_time.len);
+}
+
+void EventPrinter::begin_packet(const BldStream& stream, size_t len) {
+    if (m_format != OutputFormat::Text)
+        return;
+    m_buf.put("====== new packet size ");
+    m_buf.put_dec(uint64_t(len));
+    if (!stream.name.empty()) {
+        m_buf.put(" on ");
+        m_buf.put(stream.name);
+    }
+    m_buf.put(" ======\n");
+}
+
+void EventPrinter::end_packet() {
+    if (m_format == OutputFormat::Text)
+        m_buf.put("====== Packet finished ======\n");
+
+    if (m_tty || m_buf.size() >= OUTPUT_FLUSH_SIZE || monotonic_ns() - m_lastFlush >= uint64_t(OUTPUT_FLUSH_INTERVAL * 1e9))
+        flush();
+}
+
+void EventPrinter::flush() {
+    // Large blocks go straight through to write(), past the stdio buffer
+    m_buf.flush(m_fp);
+    fflush(m_fp);
+    m_lastFlush = monotonic_ns();
+}
+
+void EventPrinter::event(const BldStream& stream, const StreamLayout& layout, const BldPacketView& packet,
+    const BldEvent& event, bool showData) {
+    switch (m_format) {
+    case OutputFormat::Text:
+        text_event(layout, packet, event, showData);
+        break;
+    case OutputFormat::Csv:
+        csv_event(stream, layout, event);
+        break;
+    case OutputFormat::Jsonl:
+        jsonl_event(stream, layout, event);
+        break;
+    }
+}
+
+void EventPrinter::text_event(const StreamLayout& layout, const BldPacketView& packet, const BldEvent& event, bool showData) {
+    uint32_t sec, nsec;
+    extract_ts(event.timeStamp, sec, nsec);
+
+    if (event.index == 0) {
+        m_buf.put("Num channels : ");
+        m_buf.put_dec(int64_t(layout.schema.numChannels));
+        m_buf.put("\ntimeStamp    : 0x");
+        m_buf.put_hex(event.timeStamp, 16);
+        m_buf.put(' ');
+        m_buf.put_dec(uint64_t(sec));
+        m_buf.put(" sec, ");
+        m_buf.put_dec(uint64_t(nsec));
+        m_buf.put(" nsec (");
+        put_time(sec);
+        m_buf.put(")\npulseID      : 0x");
+        m_buf.put_hex(event.pulseID, 16);
+        m_buf.put("\nseverityMask : 0x");
+        m_buf.put_hex(event.severityMask, 16);
+        m_buf.put("\nversion      : 0x");
+        m_buf.put_hex(packet.version(), 8);
+        m_buf.put('\n');
+    }
+    else {
+        m_buf.put("===> event ");
+        m_buf.put_dec(int64_t(event.index));
+        m_buf.put("\nTimestamp     : 0x");
+        m_buf.put_hex(event.timeStamp, 16);
+        m_buf.put(' ');
+        m_buf.put_dec(uint64_t(sec));
+        m_buf.put(" sec, ");
+        m_buf.put_dec(uint64_t(nsec));
+        m_buf.put(" nsec (");
+        put_time(sec);
+        m_buf.put(") delta 0x");
+        m_buf.put_hex(event.deltaTimeStamp, 1);
+        m_buf.put("\nPulse ID      : 0x");
+        m_buf.put_hex(event.pulseID, 16);
+        m_buf.put(" delta 0x");
+        m_buf.put_hex(event.deltaPulseID, 1);
+        m_buf.put("\nseverity mask : 0x");
+        m_buf.put_hex(event.severityMask, 16);
+        m_buf.put('\n');
+    }
+
+    if (!showData)
+        return;
+
+    // Indexed by ValueKind
+    static const char* valueNames[NUM_VALUE_KINDS] = {"float=", "int32=", "uint32=", "double=", "int64=", "uint64=",
+        "type not supported"};
+
+    m_buf.put("Data payload:\n");
+    layout.plan.decode(event, m_decoded);
+    for (unsigned i = 0; i < layout.plan.size(); ++i) {
+        if (!(m_decoded.present & (1u << i)))
+            continue; // Skip anything we don't have
+        const ValueKind kind = layout.plan.kind(i);
+        m_buf.put("  ");
+        m_buf.put(layout.schema.labels[layout.plan.channel(i)]);
+        m_buf.put(" raw=0x");
+        m_buf.put_hex(m_decoded.raw[i], is_wide(kind) ? 16 : 8);
+        m_buf.put(", ");
+        m_buf.put(valueNames[unsigned(kind)]);
+        if (kind == ValueKind::Float32 || kind == ValueKind::Float64)
+            m_buf.put_double(m_decoded.value[i]);
+        else if (kind != ValueKind::Unsupported)
+            put_value(kind, m_decoded.raw[i], m_decoded.value[i], "");
+        m_buf.put(", sevr=");
+        m_buf.put(sevr_to_string(m_decoded.sevr[i]));
+        m_buf.put('\n');
+    }
+}
+
+// 64-bit integers are printed from the raw bits, a double can't hold all of them exactly
+void EventPrinter::put_value(ValueKind kind, uint64_t raw, double value, const char* none) {
+    switch (kind) {
+    case ValueKind::Int64:
+        m_buf.put_dec(int64_t(raw));
+        break;
+    case ValueKind::UInt64:
+        m_buf.put_dec(raw);
+        break;
+    case ValueKind::Unsupported:
+        m_buf.put(none);
+        break;
+    default:
+        if (!std::isfinite(value))
+            m_buf.put(none);
+        else if (kind == ValueKind::Float32)
+            m_buf.put_double(value, FLOAT32_DIGITS);
+        else if (kind == ValueKind::Float64)
+            m_buf.put_double(value, FLOAT64_DIGITS);
+        else
+            m_buf.put_dec(int64_t(value));
+        break;
+    }
+}
+
+void EventPrinter::put_csv_header(const StreamLayout& layout) {
+    m_buf.put("stream,event,sec,nsec,pulseID,severityMask");
+    for (unsigned i = 0; i < layout.plan.size(); ++i) {
+        m_buf.put(',');
+        m_buf.put(layout.schema.labels[layout.plan.channel(i)]);
+    }
+    m_buf.put('\n');
+    m_headerLayout = &layout;
+}
+
+void EventPrinter::csv_event(const BldStream& stream, const StreamLayout& layout, const BldEvent& event) {
+    // A new header row starts the rows of every change of the payload layout
+    if (&layout != m_headerLayout)
+        put_csv_header(layout);
+
+    uint32_t sec, nsec;
+    extract_ts(event.timeStamp, sec, nsec);
+
+    m_buf.put(stream.name);
+    m_buf.put(',');
+    m_buf.put_dec(int64_t(event.index));
+    m_buf.put(',');
+    m_buf.put_dec(uint64_t(sec));
+    m_buf.put(',');
+    m_buf.put_dec(uint64_t(nsec));
+    m_buf.put(',');
+    m_buf.put_dec(event.pulseID);
+    m_buf.put(",0x");
+    m_buf.put_hex(event.severityMask, 1);
+
+    // Channels missing from the payload and unsupported types are left empty
+    layout.plan.decode(event, m_decoded);
+    for (unsigned i = 0; i < layout.plan.size(); ++i) {
+        m_buf.put(',');
+        if (m_decoded.present & (1u << i))
+            put_value(layout.plan.kind(i), m_decoded.raw[i], m_decoded.value[i], "");
+    }
+    m_buf.put('\n');
+}
+
+void EventPrinter::jsonl_event(const BldStream& stream, const StreamLayout& layout, const BldEvent& event) {
+    uint32_t sec, nsec;
+    extract_ts(event.timeStamp, sec, nsec);
+
+    m_buf.put("{\"stream\": ");
+    m_buf.put_json_string(stream.name);
+    m_buf.put(", \"event\": ");
+    m_buf.put_dec(int64_t(event.index));
+    m_buf.put(", \"timeStamp\": ");
+    m_buf.put_dec(uint64_t(sec));
+    m_buf.put(", \"nsec\": ");
+    m_buf.put_dec(uint64_t(nsec));
+    m_buf.put(", \"pulseID\": ");
+    m_buf.put_dec(event.pulseID);
+    m_buf.put(", \"severityMask\": ");
+    m_buf.put_dec(event.severityMask);
+    m_buf.put(", \"channels\": {");
+
+    // Channels missing from the payload are left out, unsupported types are null
+    layout.plan.decode(event, m_decoded);
+    bool first = true;
+    for (unsigned i = 0; i < layout.plan.size(); ++i) {
+        if (!(m_decoded.present & (1u << i)))
+            continue;
+        if (!first)
+            m_buf.put(", ");
+        first = false;
+        m_buf.put_json_string(layout.schema.labels[layout.plan.channel(i)]);
+        m_buf.put(": ");
+        put_value(layout.plan.kind(i), m_decoded.raw[i], m_decoded.value[i], "null");
+    }
+    m_buf.put("}}\n");
+}
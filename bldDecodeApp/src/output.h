@@ -0,0 +1,170 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'bldDecode'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'bldDecode', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "packet.h"
+#include "stream.h"
+
+/** Formatted output is written out once this much has been buffered */
+#define OUTPUT_FLUSH_SIZE (1UL << 20)
+
+/** Initial size of the output formatting buffer */
+#define DEFAULT_OUTPUT_BUFFER (OUTPUT_FLUSH_SIZE + (64UL << 10))
+
+/**
+ * Most significant digits OutputBuffer::put_double() formats itself, enough to round-trip a float32.
+ * Higher precisions are left to printf
+ */
+#define MAX_DOUBLE_PRECISION 9
+
+/** Longest time formatted output stays buffered, in seconds */
+#define OUTPUT_FLUSH_INTERVAL 0.1
+
+enum class OutputFormat {
+    Text,       // Human readable, one line per field
+    Csv,        // One row per event, with a header row
+    Jsonl,      // One JSON object per event
+};
+
+/**
+ * \brief Parse an output format name: text, csv or jsonl
+ * \returns false if the name is invalid. The reason has already been printed
+ */
+bool parse_output_format(const char* str, OutputFormat& format);
+
+/**
+ * Append-only character buffer with printf-free number formatting. Reused between packets, so it only allocates
+ * while growing to the size of the largest packet's output.
+ */
+class OutputBuffer {
+public:
+    explicit OutputBuffer(size_t capacity = DEFAULT_OUTPUT_BUFFER) : m_buf(capacity) {}
+
+    inline void put(char c) {
+        reserve(1)[0] = c;
+        ++m_used;
+    }
+
+    inline void put(const char* s, size_t len) {
+        memcpy(reserve(len), s, len);
+        m_used += len;
+    }
+
+    inline void put(const char* s) { put(s, strlen(s)); }
+    inline void put(const std::string& s) { put(s.data(), s.size()); }
+
+    /** Append a decimal integer */
+    void put_dec(uint64_t v);
+    void put_dec(int64_t v);
+
+    /** Append an upper case hexadecimal integer, zero padded to at least width digits */
+    void put_hex(uint64_t v, unsigned width);
+
+    /** Append a double the way printf's %.<precision>g does: trailing zeros removed, exponent if it is large or small */
+    void put_double(double v, int precision = 6);
+
+    /** Append a string as a quoted JSON string */
+    void put_json_string(const std::string& s);
+
+    /**
+     * \brief Write the buffered output to a stdio stream and empty the buffer
+     */
+    void flush(FILE* fp);
+
+    inline size_t size() const { return m_used; }
+
+private:
+    inline char* reserve(size_t len) {
+        if (m_used + len > m_buf.size())
+            m_buf.resize(std::max(m_buf.size() * 2, m_used + len));
+        return m_buf.data() + m_used;
+    }
+
+    std::vector<char> m_buf;
+    size_t m_used = 0;
+};
+
+/**
+ * Formats the packets and events accepted by the output stage in one of the output formats.
+ * Packets are formatted into one reusable buffer that is written out in large blocks, once OUTPUT_FLUSH_SIZE is
+ * buffered or OUTPUT_FLUSH_INTERVAL has passed, so a slow stream still shows up promptly. A terminal gets every
+ * packet as soon as it is complete. Not thread safe, output callbacks must be serialized.
+ */
+class EventPrinter {
+public:
+    /**
+     * \param format Output format
+     * \param fp Stream the formatted output is written to
+     */
+    EventPrinter(OutputFormat format, FILE* fp);
+
+    EventPrinter(const EventPrinter&) = delete;
+    EventPrinter& operator=(const EventPrinter&) = delete;
+
+    /**
+     * \brief Start a packet. Only prints in text format
+     */
+    void begin_packet(const BldStream& stream, size_t len);
+
+    /**
+     * \brief Print one event of a packet with a valid header
+     * \param layout Layout the packet is decoded against
+     * \param showData Print the channel values in text format. They are always part of the csv and jsonl formats
+     */
+    void event(const BldStream& stream, const StreamLayout& layout, const BldPacketView& packet, const BldEvent& event,
+        bool showData);
+
+    /**
+     * \brief Finish a packet. Only prints in text format
+     */
+    void end_packet();
+
+    /**
+     * \brief Write out everything formatted so far, i.e. before something else is printed to the same stream
+     */
+    void flush();
+
+    inline OutputFormat format() const { return m_format; }
+
+private:
+    /**
+     * Calendar time of a BLD timestamp, formatted once per second since consecutive events share it
+     */
+    struct TimeCache {
+        uint32_t sec = 0;
+        bool valid = false;
+        char str[32];
+        size_t len = 0;
+    };
+
+    void put_time(uint32_t sec);
+    /** Append a channel value for the machine readable formats, or none if there is no number to print */
+    void put_value(ValueKind kind, uint64_t raw, double value, const char* none);
+    void put_csv_header(const StreamLayout& layout);
+    void text_event(const StreamLayout& layout, const BldPacketView& packet, const BldEvent& event, bool showData);
+    void csv_event(const BldStream& stream, const StreamLayout& layout, const BldEvent& event);
+    void jsonl_event(const BldStream& stream, const StreamLayout& layout, const BldEvent& event);
+
+    OutputFormat m_format;
+    FILE* m_fp;
+    bool m_tty;
+    const StreamLayout* m_headerLayout = nullptr;   // Layout of the last CSV header row
+    uint64_t m_lastFlush = 0;       // Monotonic time of the last flush of m_fp, in ns
+    OutputBuffer m_buf;
+    TimeCache m_time;
+    DecodedEvent m_decoded;
+};
@@ -0,0 +1,45 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'bldDecode'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'bldDecode', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+#include "packet.h"
+
+#include <cassert>
+
+BldEvent BldPacketView::event(size_t index) const {
+    assert(has_header() && index <= num_events());
+
+    BldEvent ev;
+    ev.index = index;
+
+    if (index == 0) {
+        ev.timeStamp = time_stamp();
+        ev.pulseID = pulse_id();
+        ev.severityMask = severity_mask();
+        ev.deltaTimeStamp = 0;
+        ev.deltaPulseID = 0;
+        ev.payload = m_data + bldMulticastPacketHeaderSize;
+        // Header payload may be truncated, only expose what was actually received
+        const size_t avail = m_len - bldMulticastPacketHeaderSize;
+        ev.payloadSize = avail < m_payloadSize ? avail : m_payloadSize;
+        return ev;
+    }
+
+    const uint8_t* p = m_data + header_size() + (index - 1) * event_size();
+
+    // deltaTimeStamp:20 and deltaPulseID:12 share the first 32-bit word
+    const uint32_t deltas = load_unaligned<uint32_t>(p);
+    ev.deltaTimeStamp = deltas & 0xFFFFF;
+    ev.deltaPulseID = deltas >> 20;
+    ev.timeStamp = bld_ts_add_ns(time_stamp(), ev.deltaTimeStamp);
+    ev.pulseID = pulse_id() + ev.deltaPulseID;
+    ev.severityMask = load_unaligned<uint64_t>(p + offsetof(bldMulticastComplementaryPacket_t, severityMask));
+    ev.payload = p + bldMulticastComplementaryPacketHeaderSize;
+    ev.payloadSize = m_payloadSize;
+    return ev;
+}
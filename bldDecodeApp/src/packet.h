@@ -0,0 +1,157 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'bldDecode'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'bldDecode', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+
+#include "bld-proto.h"
+
+/**
+ * Load a value of type T from a possibly unaligned location
+ */
+template<class T>
+inline T load_unaligned(const void* p) {
+    T v;
+    memcpy(&v, p, sizeof(T));
+    return v;
+}
+
+/**
+ * Add a nanosecond delta to a BLD encoded timestamp, carrying into the seconds field
+ */
+inline uint64_t bld_ts_add_ns(uint64_t ts, uint32_t deltaNs) {
+    uint64_t sec = ts >> 32;
+    uint64_t nsec = (ts & 0xFFFFFFFF) + deltaNs;
+    if (nsec >= 1000000000ull) {
+        sec += nsec / 1000000000ull;
+        nsec %= 1000000000ull;
+    }
+    return (sec << 32) | nsec;
+}
+
+/**
+ * A single event within a BLD packet. Index 0 is the packet header, the rest are complementary events.
+ * The timestamp and pulse ID are absolute, with the deltas of complementary events already applied.
+ */
+struct BldEvent {
+    int index;
+    uint64_t timeStamp;
+    uint64_t pulseID;
+    uint64_t severityMask;
+    uint32_t deltaTimeStamp;    // Always 0 for the header
+    uint32_t deltaPulseID;      // Always 0 for the header
+    const uint8_t* payload;     // Points into the received data, may be unaligned
+    size_t payloadSize;         // Number of payload bytes present, may be less than expected for a truncated header
+
+    /** \returns Number of complete 32-bit words in the payload. 64-bit channels take two */
+    inline size_t num_words() const { return payloadSize / BLD_CHANNEL_SIZE; }
+
+    /** \returns The raw value of word i. i must be less than num_words() */
+    inline uint32_t word(size_t i) const { return load_unaligned<uint32_t>(payload + i * BLD_CHANNEL_SIZE); }
+
+    /** \returns True if a value of width bytes at offset is in the payload */
+    inline bool contains(size_t offset, size_t width) const { return offset + width <= payloadSize; }
+
+    /** \returns The raw value at a byte offset, see PayloadSchema::offset. The value must be in the payload */
+    template<class T>
+    inline T load(size_t offset) const { return load_unaligned<T>(payload + offset); }
+};
+
+/**
+ * Read-only, bounds checked view over a received BLD packet.
+ * Nothing is copied; the view must not outlive the data it was constructed from.
+ */
+class BldPacketView {
+public:
+    /**
+     * \param data Received datagram
+     * \param len Length of the datagram
+     * \param payloadSize Size of the signal payload of each event, in bytes
+     */
+    BldPacketView(const void* data, size_t len, size_t payloadSize) :
+        m_data(static_cast<const uint8_t*>(data)),
+        m_len(len),
+        m_payloadSize(payloadSize)
+    {
+    }
+
+    class iterator {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef BldEvent value_type;
+        typedef ptrdiff_t difference_type;
+        typedef const BldEvent* pointer;
+        typedef BldEvent reference;
+
+        iterator(const BldPacketView* view, size_t index) : m_view(view), m_index(index) {}
+
+        inline BldEvent operator*() const { return m_view->event(m_index); }
+        inline iterator& operator++() { ++m_index; return *this; }
+        inline iterator operator++(int) { auto r = *this; ++m_index; return r; }
+        inline bool operator==(const iterator& rhs) const { return m_index == rhs.m_index; }
+        inline bool operator!=(const iterator& rhs) const { return m_index != rhs.m_index; }
+
+    private:
+        const BldPacketView* m_view;
+        size_t m_index;
+    };
+
+    /** \returns True if the datagram is large enough to hold a packet header */
+    inline bool has_header() const { return m_len >= size_t(bldMulticastPacketHeaderSize); }
+
+    // Header fields. These return 0 if the datagram is too short to contain a header
+    inline uint64_t time_stamp() const { return header_field<uint64_t>(offsetof(bldMulticastPacket_t, timeStamp)); }
+    inline uint64_t pulse_id() const { return header_field<uint64_t>(offsetof(bldMulticastPacket_t, pulseID)); }
+    inline uint32_t version() const { return header_field<uint32_t>(offsetof(bldMulticastPacket_t, version)); }
+    inline uint64_t severity_mask() const { return header_field<uint64_t>(offsetof(bldMulticastPacket_t, severityMask)); }
+
+    inline const uint8_t* data() const { return m_data; }
+    inline size_t size() const { return m_len; }
+    inline size_t payload_size() const { return m_payloadSize; }
+
+    /** \returns Size of the header and its payload */
+    inline size_t header_size() const { return bldMulticastPacketHeaderSize + m_payloadSize; }
+
+    /** \returns Size of a single complementary event and its payload */
+    inline size_t event_size() const { return bldMulticastComplementaryPacketHeaderSize + m_payloadSize; }
+
+    /** \returns Number of complete complementary events in the packet */
+    inline size_t num_events() const {
+        return m_len > header_size() ? (m_len - header_size()) / event_size() : 0;
+    }
+
+    /** \returns Number of bytes following the last complete complementary event. Non-zero means the packet is truncated or malformed */
+    inline size_t trailing_bytes() const {
+        return m_len > header_size() ? (m_len - header_size()) % event_size() : 0;
+    }
+
+    /**
+     * \brief Decode a single event
+     * \param index 0 for the header, 1..num_events() for complementary events
+     */
+    BldEvent event(size_t index) const;
+
+    /** Iterate over the header and all complete complementary events */
+    inline iterator begin() const { return iterator(this, 0); }
+    inline iterator end() const { return iterator(this, has_header() ? num_events() + 1 : 0); }
+
+private:
+    template<class T>
+    inline T header_field(size_t offset) const {
+        return has_header() ? load_unaligned<T>(m_data + offset) : T(0);
+    }
+
+    const uint8_t* m_data;
+    size_t m_len;
+    size_t m_payloadSize;
+};
@@ -0,0 +1,310 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'bldDecode'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'bldDecode', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+#include "pcap.h"
+
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// File magics
+#define PCAP_MAGIC_USEC     0xA1B2C3D4
+#define PCAP_MAGIC_NSEC     0xA1B23C4D
+#define PCAPNG_SHB_TYPE     0x0A0D0D0A
+#define PCAPNG_BYTE_ORDER   0x1A2B3C4D
+
+// pcapng block types
+#define PCAPNG_IDB_TYPE     0x00000001
+#define PCAPNG_SPB_TYPE     0x00000003
+#define PCAPNG_EPB_TYPE     0x00000006
+
+// Link types, see https://www.tcpdump.org/linktypes.html
+#define LINKTYPE_NULL       0
+#define LINKTYPE_ETHERNET   1
+#define LINKTYPE_RAW        101
+#define LINKTYPE_LINUX_SLL  113
+#define LINKTYPE_IPV4       228
+#define LINKTYPE_LINUX_SLL2 276
+
+#define ETHERTYPE_IPV4      0x0800
+#define ETHERTYPE_VLAN      0x8100
+#define ETHERTYPE_QINQ      0x88A8
+
+#define PCAP_FILE_HEADER_SIZE   24
+#define PCAP_RECORD_HEADER_SIZE 16
+
+CaptureReader::~CaptureReader() {
+    if (m_data)
+        munmap(const_cast<uint8_t*>(m_data), m_size);
+}
+
+inline uint16_t CaptureReader::rd16(const uint8_t* p) const {
+    uint16_t v;
+    memcpy(&v, p, sizeof(v));
+    return m_swapped ? __builtin_bswap16(v) : v;
+}
+
+inline uint32_t CaptureReader::rd32(const uint8_t* p) const {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return m_swapped ? __builtin_bswap32(v) : v;
+}
+
+// Network byte order reads, for protocol headers
+static inline uint16_t be16(const uint8_t* p) { return uint16_t(p[0] << 8 | p[1]); }
+
+bool CaptureReader::open(const char* file) {
+    int fd = ::open(file, O_RDONLY);
+    if (fd < 0) {
+        perror("Unable to open capture file");
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < PCAP_FILE_HEADER_SIZE) {
+        printf("Capture file %s is too short\n", file);
+        ::close(fd);
+        return false;
+    }
+
+    void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        perror("Unable to map capture file");
+        return false;
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    m_data = static_cast<const uint8_t*>(map);
+    m_size = st.st_size;
+
+    uint32_t magic;
+    memcpy(&magic, m_data, sizeof(magic));
+
+    if (magic == PCAPNG_SHB_TYPE) {
+        m_pcapng = true;
+        uint32_t bom;
+        memcpy(&bom, m_data + 8, sizeof(bom));
+        m_swapped = bom != PCAPNG_BYTE_ORDER;
+        m_offset = 0; // Section header is walked like any other block
+        return true;
+    }
+
+    m_nsec = magic == PCAP_MAGIC_NSEC || magic == __builtin_bswap32(PCAP_MAGIC_NSEC);
+    if (magic == PCAP_MAGIC_USEC || magic == PCAP_MAGIC_NSEC)
+        m_swapped = false;
+    else if (magic == __builtin_bswap32(PCAP_MAGIC_USEC) || magic == __builtin_bswap32(PCAP_MAGIC_NSEC))
+        m_swapped = true;
+    else {
+        printf("%s is not a pcap or pcapng capture\n", file);
+        return false;
+    }
+
+    m_linkType = rd32(m_data + 20) & 0xFFFF;
+    m_offset = PCAP_FILE_HEADER_SIZE;
+    return true;
+}
+
+void CaptureReader::set_filter(int port, in_addr_t group) {
+    m_port = port;
+    m_group = group;
+}
+
+bool CaptureReader::next(PacketSlot& slot) {
+    return m_pcapng ? next_pcapng(slot) : next_pcap(slot);
+}
+
+bool CaptureReader::next_pcap(PacketSlot& slot) {
+    while (m_offset + PCAP_RECORD_HEADER_SIZE <= m_size) {
+        const uint8_t* rec = m_data + m_offset;
+        const uint32_t caplen = rd32(rec + 8);
+        if (m_offset + PCAP_RECORD_HEADER_SIZE + caplen > m_size)
+            break; // Truncated file
+
+        m_offset += PCAP_RECORD_HEADER_SIZE + caplen;
+        ++m_stats.records;
+        if (extract(m_linkType, rec + PCAP_RECORD_HEADER_SIZE, caplen, slot)) {
+            slot.recvTime = uint64_t(rd32(rec)) * 1000000000ULL + uint64_t(rd32(rec + 4)) * (m_nsec ? 1 : 1000);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool CaptureReader::next_pcapng(PacketSlot& slot) {
+    while (m_offset + 12 <= m_size) {
+        const uint8_t* blk = m_data + m_offset;
+        uint32_t type;
+        memcpy(&type, blk, sizeof(type));
+
+        // A new section may switch byte order
+        if (type == PCAPNG_SHB_TYPE) {
+            uint32_t bom;
+            memcpy(&bom, blk + 8, sizeof(bom));
+            m_swapped = bom != PCAPNG_BYTE_ORDER;
+            m_ifLinkTypes.clear();
+        }
+        else
+            type = rd32(blk);
+
+        const uint32_t len = rd32(blk + 4);
+        if (len < 12 || (len & 3) || m_offset + len > m_size)
+            break; // Corrupt or truncated file
+        m_offset += len;
+
+        switch (type) {
+        case PCAPNG_IDB_TYPE:
+            m_ifLinkTypes.push_back(rd16(blk + 8));
+            break;
+        case PCAPNG_EPB_TYPE: {
+            if (len < 32)
+                break;
+            ++m_stats.records;
+            const uint32_t iface = rd32(blk + 8);
+            const uint32_t caplen = rd32(blk + 20);
+            // Compared against what's left of the block, a corrupt caplen near UINT32_MAX would wrap 28 + caplen
+            if (iface >= m_ifLinkTypes.size() || caplen > len - 28)
+                break;
+            if (extract(m_ifLinkTypes[iface], blk + 28, caplen, slot)) {
+                // Assumes the default microsecond resolution, if_tsresol is not parsed
+                slot.recvTime = (uint64_t(rd32(blk + 12)) << 32 | rd32(blk + 16)) * 1000;
+                return true;
+            }
+            break;
+        }
+        case PCAPNG_SPB_TYPE: {
+            if (len < 16 || m_ifLinkTypes.empty())
+                break;
+            ++m_stats.records;
+            const uint32_t origlen = rd32(blk + 8);
+            const uint32_t avail = len - 16;
+            if (extract(m_ifLinkTypes[0], blk + 12, origlen < avail ? origlen : avail, slot)) {
+                slot.recvTime = 0; // Simple packet blocks carry no timestamp
+                return true;
+            }
+            break;
+        }
+        default:
+            break; // Statistics, name resolution and custom blocks are of no interest
+        }
+    }
+    return false;
+}
+
+bool CaptureReader::extract(uint32_t linkType, const uint8_t* data, size_t len, PacketSlot& slot) {
+    size_t off;
+    uint16_t ethertype;
+
+    // Find the IPv4 header
+    switch (linkType) {
+    case LINKTYPE_NULL:
+        // Address family in the capturing host's byte order. AF_INET is 2 everywhere
+        if (len < 4 || (data[0] != 2 && data[3] != 2)) {
+            ++m_stats.notUdp;
+            return false;
+        }
+        off = 4;
+        break;
+    case LINKTYPE_ETHERNET:
+        if (len < 14) {
+            ++m_stats.notUdp;
+            return false;
+        }
+        off = 14;
+        ethertype = be16(data + 12);
+        while ((ethertype == ETHERTYPE_VLAN || ethertype == ETHERTYPE_QINQ) && off + 4 <= len) {
+            ethertype = be16(data + off + 2);
+            off += 4;
+        }
+        if (ethertype != ETHERTYPE_IPV4) {
+            ++m_stats.notUdp;
+            return false;
+        }
+        break;
+    case LINKTYPE_RAW:
+    case LINKTYPE_IPV4:
+        off = 0;
+        break;
+    case LINKTYPE_LINUX_SLL:
+        if (len < 16 || be16(data + 14) != ETHERTYPE_IPV4) {
+            ++m_stats.notUdp;
+            return false;
+        }
+        off = 16;
+        break;
+    case LINKTYPE_LINUX_SLL2:
+        if (len < 20 || be16(data) != ETHERTYPE_IPV4) {
+            ++m_stats.notUdp;
+            return false;
+        }
+        off = 20;
+        break;
+    default:
+        ++m_stats.notUdp;
+        return false;
+    }
+
+    // IPv4 header
+    const uint8_t* ip = data + off;
+    if (off + 20 > len || (ip[0] >> 4) != 4 || ip[9] != IPPROTO_UDP) {
+        ++m_stats.notUdp;
+        return false;
+    }
+    const size_t ihl = (ip[0] & 0xF) * 4;
+    if (ihl < 20 || off + ihl + 8 > len) {
+        ++m_stats.truncated;
+        return false;
+    }
+
+    // More fragments flag or a non-zero fragment offset
+    if (be16(ip + 6) & 0x3FFF) {
+        ++m_stats.fragmented;
+        return false;
+    }
+
+    in_addr_t src, dst;
+    memcpy(&src, ip + 12, sizeof(src));
+    memcpy(&dst, ip + 16, sizeof(dst));
+
+    // UDP header
+    const uint8_t* udp = ip + ihl;
+    const uint16_t srcPort = be16(udp);
+    const uint16_t dstPort = be16(udp + 2);
+    const uint16_t udpLen = be16(udp + 4);
+
+    if ((m_port && dstPort != m_port) || (m_group != INADDR_ANY && dst != m_group)) {
+        ++m_stats.filtered;
+        return false;
+    }
+
+    if (udpLen < 8 || off + ihl + udpLen > len || udpLen - 8 > MAXLINE) {
+        ++m_stats.truncated;
+        return false;
+    }
+
+    const size_t payloadLen = udpLen - 8;
+    memcpy(slot.data, udp + 8, payloadLen);
+    slot.len = payloadLen;
+    memset(&slot.from, 0, sizeof(slot.from));
+    slot.from.sin_family = AF_INET;
+    slot.from.sin_addr.s_addr = src;
+    slot.from.sin_port = htons(srcPort);
+
+    ++m_stats.matched;
+    m_stats.bytes += payloadLen;
+    return true;
+}
+
+void CaptureReader::print_stats(FILE* fp) const {
+    fprintf(fp, "Capture: %lu records, %lu matched (%lu bytes), %lu filtered, %lu not UDP, %lu fragmented, %lu truncated\n",
+        m_stats.records, m_stats.matched, m_stats.bytes, m_stats.filtered, m_stats.notUdp, m_stats.fragmented, m_stats.truncated);
+}
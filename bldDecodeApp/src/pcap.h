@@ -0,0 +1,86 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'bldDecode'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'bldDecode', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#include <netinet/in.h>
+
+#include "recv.h"
+
+/**
+ * Reads BLD datagrams from pcap or pcapng capture files, so captures can be decoded offline exactly like live traffic.
+ * The file is memory mapped and walked sequentially, nothing is buffered beyond the packet being returned.
+ * Only unfragmented UDP over IPv4 is extracted; Ethernet (with VLAN tags), raw IP, Linux cooked (v1 and v2)
+ * and BSD loopback link types are supported.
+ */
+class CaptureReader {
+public:
+    struct Stats {
+        uint64_t records = 0;           // Total packet records in the file
+        uint64_t matched = 0;           // UDP datagrams passing the port and group filter
+        uint64_t filtered = 0;          // UDP datagrams for another port or group
+        uint64_t notUdp = 0;            // Records that aren't IPv4 UDP, or use an unsupported link type
+        uint64_t fragmented = 0;        // IP fragments, which are not reassembled
+        uint64_t truncated = 0;         // Datagrams cut short by the capture's snap length, or larger than MAXLINE
+        uint64_t bytes = 0;             // UDP payload bytes of matched datagrams
+    };
+
+    CaptureReader() = default;
+    ~CaptureReader();
+
+    CaptureReader(const CaptureReader&) = delete;
+    CaptureReader& operator=(const CaptureReader&) = delete;
+
+    /**
+     * \brief Open and map a capture file
+     * \returns false if the file can't be read or isn't a pcap/pcapng capture. The reason has already been printed
+     */
+    bool open(const char* file);
+
+    /**
+     * \brief Only return datagrams sent to this port and group
+     * \param port Destination UDP port
+     * \param group Destination address in network byte order, or INADDR_ANY to accept any destination
+     */
+    void set_filter(int port, in_addr_t group);
+
+    /**
+     * \brief Copy the next matching datagram into a packet slot. The capture timestamp is used as the receive time
+     * \returns false once the end of the file (or a corrupt record) is reached
+     */
+    bool next(PacketSlot& slot);
+
+    inline const Stats& stats() const { return m_stats; }
+
+    void print_stats(FILE* fp) const;
+
+private:
+    bool next_pcap(PacketSlot& slot);
+    bool next_pcapng(PacketSlot& slot);
+    bool extract(uint32_t linkType, const uint8_t* data, size_t len, PacketSlot& slot);
+
+    inline uint16_t rd16(const uint8_t* p) const;
+    inline uint32_t rd32(const uint8_t* p) const;
+
+    const uint8_t* m_data = nullptr;
+    size_t m_size = 0;
+    size_t m_offset = 0;
+    bool m_swapped = false;                 // File was written with the opposite byte order
+    bool m_pcapng = false;
+    bool m_nsec = false;                    // pcap only, timestamps are in nanoseconds rather than microseconds
+    uint32_t m_linkType = 0;                // pcap only
+    std::vector<uint32_t> m_ifLinkTypes;    // pcapng, one per interface description block
+    int m_port = 0;
+    in_addr_t m_group = INADDR_ANY;
+    Stats m_stats;
+};
@@ -0,0 +1,198 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'bldDecode'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'bldDecode', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+#include "pipeline.h"
+#include "net.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <signal.h>
+#include <pthread.h>
+
+// Back off while a stage has nothing to do. Spin briefly to keep latency low, then sleep to avoid burning a core
+static void backoff(unsigned& idle) {
+    if (++idle < 64)
+        std::this_thread::yield();
+    else
+        std::this_thread::sleep_for(std::chrono::microseconds(50));
+}
+
+static void update_max(std::atomic<uint64_t>& max, uint64_t value) {
+    if (value > max.load(std::memory_order_relaxed))
+        max.store(value, std::memory_order_relaxed);
+}
+
+// Signals are handled by the main thread only
+static void block_signals() {
+    sigset_t set;
+    sigfillset(&set);
+    pthread_sigmask(SIG_BLOCK, &set, nullptr);
+}
+
+Pipeline::Pipeline(const BldStream& stream, int sockfd, unsigned numDecoders, size_t ringSize, unsigned batchSize, DecodeFn decode, OutputFn output, Report* report) :
+    m_stream(stream),
+    m_sockfd(sockfd),
+    m_receiver(batchSize),
+    m_decode(decode),
+    m_output(output),
+    m_report(report)
+{
+    for (unsigned i = 0; i < numDecoders; ++i)
+        m_lanes.emplace_back(new Lane(ringSize));
+}
+
+void Pipeline::run(int64_t numPackets, bool periodicStats) {
+    std::vector<std::thread> threads;
+    threads.emplace_back([this, numPackets]() { block_signals(); receive_loop(numPackets); });
+    for (auto& lane : m_lanes) {
+        Lane* l = lane.get();
+        threads.emplace_back([this, l]() { block_signals(); decode_loop(*l); });
+    }
+    std::thread output([this]() { block_signals(); output_loop(); });
+
+    if (periodicStats) {
+        auto next = std::chrono::steady_clock::now();
+        while (!m_receiveDone) {
+            next += std::chrono::seconds(1);
+            std::this_thread::sleep_until(next);
+            print_stats(stdout);
+        }
+    }
+
+    for (auto& t : threads)
+        t.join();
+    output.join();
+}
+
+void Pipeline::receive_loop(int64_t numPackets) {
+    std::vector<PacketSlot*> batch(m_receiver.batch_size());
+    std::vector<PacketSlot*> scratch(m_receiver.batch_size());
+    for (unsigned i = 0; i < scratch.size(); ++i)
+        scratch[i] = &m_receiver[i];
+
+    size_t laneIndex = 0;
+    uint32_t kernelDrops = 0;   // Kernel drops seen on dropped packets, handed on with the next queued one
+    while (numPackets > 0 && !stop_requested()) {
+        Lane& lane = *m_lanes[laneIndex];
+        const size_t limit = numPackets < int64_t(batch.size()) ? numPackets : batch.size();
+
+        size_t count = lane.ring.available(StageReceive);
+        if (count > limit)
+            count = limit;
+
+        // Ring is full. Keep draining the socket so the kernel buffer doesn't back up, and stay on this lane to preserve ordering
+        if (count == 0) {
+            const int n = m_receiver.receive(m_sockfd, scratch.data(), limit);
+            if (n < 0) {
+                perror("recvmmsg failed");
+                exit(EXIT_FAILURE);
+            }
+            lane.dropped.fetch_add(n, std::memory_order_relaxed);
+            for (int i = 0; i < n; ++i)
+                kernelDrops += scratch[i]->kernelDrops;
+            numPackets -= n;
+            continue;
+        }
+
+        for (size_t i = 0; i < count; ++i)
+            batch[i] = &lane.ring.at(StageReceive, i).packet;
+
+        const int n = m_receiver.receive(m_sockfd, batch.data(), count);
+        if (n < 0) {
+            perror("recvmmsg failed");
+            exit(EXIT_FAILURE);
+        }
+
+        if (n > 0) {
+            batch[0]->kernelDrops += kernelDrops;
+            kernelDrops = 0;
+        }
+        for (int i = 0; i < n; ++i)
+            lane.ring.at(StageReceive, i).endOfBatch = (i == n - 1);
+        lane.ring.advance(StageReceive, n);
+        lane.received.fetch_add(n, std::memory_order_relaxed);
+
+        numPackets -= n;
+        laneIndex = (laneIndex + 1) % m_lanes.size();
+    }
+    m_receiveDone = true;
+}
+
+void Pipeline::decode_loop(Lane& lane) {
+    unsigned idle = 0;
+    while (true) {
+        const size_t n = lane.ring.available(StageDecode);
+        if (n == 0) {
+            // Receiver publishes its last batch before setting the flag, so re-check after seeing it
+            if (m_receiveDone && lane.ring.available(StageDecode) == 0)
+                break;
+            backoff(idle);
+            continue;
+        }
+        idle = 0;
+        update_max(lane.maxDecodeDepth, n);
+
+        for (size_t i = 0; i < n; ++i) {
+            auto& slot = lane.ring.at(StageDecode, i);
+            slot.result = m_decode(m_stream, lane.validator, slot.packet);
+        }
+        lane.ring.advance(StageDecode, n);
+        lane.decoded.fetch_add(n, std::memory_order_relaxed);
+    }
+    lane.decodeDone = true;
+}
+
+void Pipeline::output_loop() {
+    size_t laneIndex = 0;
+    unsigned idle = 0;
+    while (true) {
+        Lane& lane = *m_lanes[laneIndex];
+        const size_t n = lane.ring.available(StageOutput);
+        if (n == 0) {
+            // The next batch in receive order would have gone to this lane, so once it is drained we're done
+            if (lane.decodeDone && lane.ring.available(StageOutput) == 0)
+                break;
+            backoff(idle);
+            continue;
+        }
+        idle = 0;
+        update_max(lane.maxOutputDepth, n);
+
+        // Consume up to the end of the current batch, then move on to the lane holding the next one
+        size_t consumed = 0;
+        bool endOfBatch = false;
+        while (consumed < n && !endOfBatch) {
+            auto& slot = lane.ring.at(StageOutput, consumed++);
+            m_output(m_stream, m_report, slot.packet, slot.result);
+            endOfBatch = slot.endOfBatch;
+        }
+        lane.ring.advance(StageOutput, consumed);
+        lane.output.fetch_add(consumed, std::memory_order_relaxed);
+
+        if (endOfBatch)
+            laneIndex = (laneIndex + 1) % m_lanes.size();
+    }
+}
+
+uint64_t Pipeline::dropped() const {
+    uint64_t total = 0;
+    for (auto& lane : m_lanes)
+        total += lane->dropped.load();
+    return total;
+}
+
+void Pipeline::print_stats(FILE* fp) const {
+    for (size_t i = 0; i < m_lanes.size(); ++i) {
+        const Lane& lane = *m_lanes[i];
+        fprintf(fp, "Lane %zu: recv %lu, dropped %lu (ring full) | decode %lu, depth %zu (max %lu) | output %lu, depth %zu (max %lu)\n",
+            i, lane.received.load(), lane.dropped.load(),
+            lane.decoded.load(), lane.ring.depth(StageDecode), lane.maxDecodeDepth.load(),
+            lane.output.load(), lane.ring.depth(StageOutput), lane.maxOutputDepth.load());
+    }
+}
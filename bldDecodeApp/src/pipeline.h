@@ -0,0 +1,112 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'bldDecode'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'bldDecode', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "recv.h"
+#include "ring.h"
+#include "report.h"
+#include "stream.h"
+
+/** Default number of packet slots per decode lane */
+#define DEFAULT_RING_SIZE 4096
+
+/**
+ * Multi-threaded receive/decode/output pipeline.
+ *
+ * A receiver thread pulls datagrams off the socket straight into the slots of one or more lanes, each
+ * lane being a ring served by its own decode thread. A single output thread formats the decoded packets.
+ * Batches are handed to the lanes round-robin and the output thread consumes them in the same order,
+ * so output is in receive order regardless of the number of decode threads.
+ */
+class Pipeline {
+public:
+    /**
+     * \param stream Stream received on the socket
+     * \param sockfd Socket to receive from
+     * \param numDecoders Number of decode threads (and lanes)
+     * \param ringSize Number of packet slots per lane, must be a power of two
+     * \param batchSize Maximum number of packets received per syscall
+     * \param decode Decode stage callback. Called from the decode threads, must only touch the validator it is given
+     * \param output Output stage callback. Called from the output thread
+     * \param report Report handed to the output stage, may be nullptr
+     */
+    Pipeline(const BldStream& stream, int sockfd, unsigned numDecoders, size_t ringSize, unsigned batchSize, DecodeFn decode, OutputFn output, Report* report);
+
+    Pipeline(const Pipeline&) = delete;
+    Pipeline& operator=(const Pipeline&) = delete;
+
+    /**
+     * \brief Run the pipeline until numPackets have been received and fully processed
+     * \param numPackets Number of packets to receive
+     * \param periodicStats Print stage counters every second while running
+     */
+    void run(int64_t numPackets, bool periodicStats);
+
+    /** Print the per-stage counters */
+    void print_stats(FILE* fp) const;
+
+    inline const BatchStats& batch_stats() const { return m_receiver.stats(); }
+
+    /** \returns Packets dropped across all lanes because their ring was full */
+    uint64_t dropped() const;
+    inline unsigned batch_size() const { return m_receiver.batch_size(); }
+
+private:
+    enum Stage {
+        StageReceive = 0,
+        StageDecode,
+        StageOutput,
+        NumStages
+    };
+
+    /** A received datagram as it moves through the pipeline */
+    struct Slot {
+        PacketSlot packet;
+        DecodeResult result;
+        bool endOfBatch;
+    };
+
+    struct Lane {
+        explicit Lane(size_t ringSize) : ring(ringSize) {}
+
+        SpscRing<Slot, NumStages> ring;
+        PacketValidator validator;
+        std::atomic<bool> decodeDone {false};
+
+        // Receive stage
+        std::atomic<uint64_t> received {0};
+        std::atomic<uint64_t> dropped {0};      // Dropped because the ring was full
+        // Decode stage
+        std::atomic<uint64_t> decoded {0};
+        std::atomic<uint64_t> maxDecodeDepth {0};
+        // Output stage
+        std::atomic<uint64_t> output {0};
+        std::atomic<uint64_t> maxOutputDepth {0};
+    };
+
+    void receive_loop(int64_t numPackets);
+    void decode_loop(Lane& lane);
+    void output_loop();
+
+    const BldStream& m_stream;
+    int m_sockfd;
+    BatchReceiver m_receiver;
+    DecodeFn m_decode;
+    OutputFn m_output;
+    Report* m_report;
+    std::vector<std::unique_ptr<Lane>> m_lanes;
+    std::atomic<bool> m_receiveDone {false};
+};
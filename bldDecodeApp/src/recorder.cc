@@ -0,0 +1,369 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'bldDecode'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'bldDecode', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+#include "recorder.h"
+
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "packet.h"
+
+static inline size_t record_size(size_t len) {
+    return sizeof(RecordHeader) + ((len + 7) & ~size_t(7));
+}
+
+// Index that goes with a segment file
+static std::string index_file(const std::string& segment) {
+    const size_t dot = segment.rfind(".bldrec");
+    if (dot == std::string::npos || dot + 7 != segment.size())
+        return segment + ".bldidx";
+    return segment.substr(0, dot) + ".bldidx";
+}
+
+std::string recording_file(const std::string& prefix, uint64_t segment, const char* ext) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), ".%06lu.%s", segment, ext);
+    return prefix + buf;
+}
+
+PacketRecorder::PacketRecorder(const std::string& prefix, size_t segmentSize, unsigned indexInterval) :
+    m_prefix(prefix),
+    m_segmentSize(std::max<size_t>(segmentSize, MIN_SEGMENT_SIZE)),
+    m_indexInterval(std::max(indexInterval, 1u))
+{
+}
+
+PacketRecorder::~PacketRecorder() {
+    close();
+}
+
+bool PacketRecorder::open() {
+    std::lock_guard<std::mutex> lock(m_lock);
+    return open_segment();
+}
+
+void PacketRecorder::close() {
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (m_map)
+        close_segment();
+}
+
+bool PacketRecorder::open_segment() {
+    const std::string file = recording_file(m_prefix, m_segment, "bldrec");
+
+    if ((m_fd = ::open(file.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0) {
+        printf("Unable to create recording segment %s: %s\n", file.c_str(), strerror(errno));
+        return false;
+    }
+
+    // Allocate the blocks up front so appending never waits on the filesystem to extend the file
+    int err = posix_fallocate(m_fd, 0, m_segmentSize);
+    if (err != 0) {
+        printf("Unable to allocate %zu bytes for recording segment %s: %s\n", m_segmentSize, file.c_str(), strerror(err));
+        ::close(m_fd);
+        m_fd = -1;
+        return false;
+    }
+
+    void* map = mmap(nullptr, m_segmentSize, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+    if (map == MAP_FAILED) {
+        printf("Unable to map recording segment %s: %s\n", file.c_str(), strerror(errno));
+        ::close(m_fd);
+        m_fd = -1;
+        return false;
+    }
+
+    const std::string indexFile = recording_file(m_prefix, m_segment, "bldidx");
+    if (!(m_index = fopen(indexFile.c_str(), "wb"))) {
+        printf("Unable to create recording index %s: %s\n", indexFile.c_str(), strerror(errno));
+        munmap(map, m_segmentSize);
+        ::close(m_fd);
+        m_fd = -1;
+        return false;
+    }
+
+    m_map = static_cast<uint8_t*>(map);
+    m_offset = sizeof(RecordingSegmentHeader);
+    m_sinceIndex = m_indexInterval; // Index the first record
+
+    auto* hdr = reinterpret_cast<RecordingSegmentHeader*>(m_map);
+    memcpy(hdr->magic, RECORDING_MAGIC, sizeof(hdr->magic));
+    hdr->version = RECORDING_VERSION;
+    hdr->headerSize = sizeof(RecordingSegmentHeader);
+    hdr->segment = m_segment;
+    hdr->dataEnd = m_offset;
+    hdr->numRecords = 0;
+    hdr->minPulseID = UINT64_MAX;
+    hdr->maxPulseID = 0;
+
+    ++m_segment;
+    ++m_stats.segments;
+    return true;
+}
+
+void PacketRecorder::close_segment() {
+    munmap(m_map, m_segmentSize);
+    m_map = nullptr;
+
+    // Give back the preallocated space we didn't use
+    if (ftruncate(m_fd, m_offset) < 0)
+        perror("Unable to trim recording segment");
+    ::close(m_fd);
+    m_fd = -1;
+
+    fclose(m_index);
+    m_index = nullptr;
+}
+
+bool PacketRecorder::record(const PacketSlot& slot) {
+    const size_t size = record_size(slot.len);
+    const BldPacketView packet(slot.data, slot.len, 0);
+
+    std::lock_guard<std::mutex> lock(m_lock);
+
+    if (m_failed) {
+        ++m_stats.dropped;
+        return false;
+    }
+
+    if (!m_map || m_offset + size > m_segmentSize) {
+        if (m_map)
+            close_segment();
+        if (!open_segment()) {
+            m_failed = true;
+            ++m_stats.dropped;
+            return false;
+        }
+    }
+
+    RecordHeader rec;
+    rec.size = slot.len;
+    rec.srcAddr = slot.from.sin_addr.s_addr;
+    rec.srcPort = slot.from.sin_port;
+    rec.flags = 0;
+    rec.reserved = 0;
+    rec.recvTime = slot.recvTime;
+    rec.pulseID = packet.pulse_id();
+
+    memcpy(m_map + m_offset, &rec, sizeof(rec));
+    memcpy(m_map + m_offset + sizeof(rec), slot.data, slot.len);
+
+    auto* hdr = reinterpret_cast<RecordingSegmentHeader*>(m_map);
+    if (packet.has_header()) {
+        hdr->minPulseID = std::min(hdr->minPulseID, rec.pulseID);
+        hdr->maxPulseID = std::max(hdr->maxPulseID, rec.pulseID);
+
+        // Only records with a pulse ID can be seeked to
+        if (++m_sinceIndex >= m_indexInterval) {
+            RecordingIndexEntry entry;
+            entry.pulseID = rec.pulseID;
+            entry.timeStamp = packet.time_stamp();
+            entry.offset = m_offset;
+            fwrite(&entry, sizeof(entry), 1, m_index);
+            m_sinceIndex = 0;
+        }
+    }
+
+    m_offset += size;
+    ++hdr->numRecords;
+    hdr->dataEnd = m_offset; // Published last, so a crash never leaves a partial record inside dataEnd
+
+    ++m_stats.records;
+    m_stats.bytes += slot.len;
+    return true;
+}
+
+PacketRecorder::Stats PacketRecorder::stats() {
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_stats;
+}
+
+void PacketRecorder::print_stats(FILE* fp) {
+    const Stats st = stats();
+    fprintf(fp, "Recorder: %lu records (%lu bytes) in %lu segments, %lu dropped\n",
+        st.records, st.bytes, st.segments, st.dropped);
+}
+
+RecordingReader::~RecordingReader() {
+    unmap_segment();
+}
+
+bool RecordingReader::is_recording(const char* file) {
+    char magic[sizeof(RecordingSegmentHeader::magic)] = {};
+    FILE* fp = fopen(file, "rb");
+    if (!fp)
+        return false;
+    const bool ok = fread(magic, sizeof(magic), 1, fp) == 1 && memcmp(magic, RECORDING_MAGIC, sizeof(magic)) == 0;
+    fclose(fp);
+    return ok;
+}
+
+bool RecordingReader::open(const char* file) {
+    if (!map_segment(file))
+        return false;
+
+    // Follow on to the next segments if the file is named like one of ours
+    const std::string name(file);
+    const size_t suffix = recording_file("", header().segment, "bldrec").size();
+    if (name.size() > suffix) {
+        const std::string prefix = name.substr(0, name.size() - suffix);
+        if (recording_file(prefix, header().segment, "bldrec") == name)
+            m_prefix = prefix;
+    }
+    return true;
+}
+
+void RecordingReader::set_pulse_range(uint64_t first, uint64_t last) {
+    m_firstPulse = first;
+    m_lastPulse = last;
+}
+
+bool RecordingReader::map_segment(const std::string& file) {
+    int fd = ::open(file.c_str(), O_RDONLY);
+    if (fd < 0) {
+        printf("Unable to open recording segment %s: %s\n", file.c_str(), strerror(errno));
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || size_t(st.st_size) < sizeof(RecordingSegmentHeader)) {
+        printf("Recording segment %s is too short\n", file.c_str());
+        ::close(fd);
+        return false;
+    }
+
+    void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        printf("Unable to map recording segment %s: %s\n", file.c_str(), strerror(errno));
+        return false;
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    m_map = static_cast<const uint8_t*>(map);
+    m_size = st.st_size;
+
+    const auto& hdr = header();
+    if (memcmp(hdr.magic, RECORDING_MAGIC, sizeof(hdr.magic)) != 0 || hdr.version != RECORDING_VERSION ||
+        hdr.headerSize < sizeof(RecordingSegmentHeader) || hdr.dataEnd > m_size || hdr.headerSize > hdr.dataEnd) {
+        printf("%s is not a version %d recording segment\n", file.c_str(), RECORDING_VERSION);
+        unmap_segment();
+        return false;
+    }
+
+    m_segment = hdr.segment;
+    m_offset = hdr.headerSize;
+    m_end = hdr.dataEnd;
+    m_positioned = false;
+    m_indexFile = index_file(file);
+    ++m_stats.segments;
+    return true;
+}
+
+void RecordingReader::unmap_segment() {
+    if (m_map)
+        munmap(const_cast<uint8_t*>(m_map), m_size);
+    m_map = nullptr;
+}
+
+void RecordingReader::next_segment() {
+    unmap_segment();
+    if (m_prefix.empty())
+        return;
+
+    const std::string file = recording_file(m_prefix, m_segment + 1, "bldrec");
+    if (access(file.c_str(), R_OK) == 0)
+        map_segment(file);
+}
+
+void RecordingReader::seek_index() {
+    if (m_firstPulse == 0)
+        return;
+
+    FILE* fp = fopen(m_indexFile.c_str(), "rb");
+    if (!fp)
+        return; // No index, scan from the start of the segment
+
+    std::vector<RecordingIndexEntry> entries;
+    RecordingIndexEntry entry;
+    while (fread(&entry, sizeof(entry), 1, fp) == 1)
+        entries.push_back(entry);
+    fclose(fp);
+
+    // Start from the last indexed record before the range, the records between it and the next entry are scanned
+    auto it = std::lower_bound(entries.begin(), entries.end(), m_firstPulse,
+        [](const RecordingIndexEntry& e, uint64_t pulse) { return e.pulseID < pulse; });
+    if (it == entries.begin())
+        return;
+    --it;
+    if (it->offset >= m_offset && it->offset < m_end)
+        m_offset = it->offset;
+}
+
+bool RecordingReader::next(PacketSlot& slot) {
+    while (m_map) {
+        if (!m_positioned) {
+            m_positioned = true;
+            const auto& hdr = header();
+            if (hdr.numRecords && hdr.minPulseID != UINT64_MAX && hdr.minPulseID > m_lastPulse) {
+                unmap_segment(); // Past the end of the range
+                break;
+            }
+            if (!hdr.numRecords || hdr.maxPulseID < m_firstPulse) {
+                next_segment();
+                continue;
+            }
+            seek_index();
+        }
+
+        while (m_offset + sizeof(RecordHeader) <= m_end) {
+            RecordHeader rec;
+            memcpy(&rec, m_map + m_offset, sizeof(rec));
+            const size_t size = record_size(rec.size);
+            if (rec.size > MAXLINE || m_offset + size > m_end) {
+                printf("Corrupt record at offset %zu of segment %lu\n", m_offset, m_segment);
+                unmap_segment();
+                return false;
+            }
+
+            const size_t offset = m_offset;
+            m_offset += size;
+
+            if (rec.pulseID < m_firstPulse || rec.pulseID > m_lastPulse) {
+                ++m_stats.skipped;
+                continue;
+            }
+
+            memcpy(slot.data, m_map + offset + sizeof(rec), rec.size);
+            slot.len = rec.size;
+            memset(&slot.from, 0, sizeof(slot.from));
+            slot.from.sin_family = AF_INET;
+            slot.from.sin_addr.s_addr = rec.srcAddr;
+            slot.from.sin_port = rec.srcPort;
+            slot.recvTime = rec.recvTime;
+
+            ++m_stats.records;
+            m_stats.bytes += rec.size;
+            return true;
+        }
+
+        next_segment();
+    }
+    return false;
+}
+
+void RecordingReader::print_stats(FILE* fp) const {
+    fprintf(fp, "Recording: %lu records (%lu bytes) from %lu segments, %lu outside the pulse range skipped\n",
+        m_stats.records, m_stats.bytes, m_stats.segments, m_stats.skipped);
+}
@@ -0,0 +1,210 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'bldDecode'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'bldDecode', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <mutex>
+
+#include "recv.h"
+
+/** Default size of a recording segment, in bytes */
+#define DEFAULT_SEGMENT_SIZE (256UL << 20)
+
+/** Smallest segment size accepted, must hold at least one maximum size datagram */
+#define MIN_SEGMENT_SIZE (1UL << 20)
+
+/** Default number of records between sparse index entries */
+#define DEFAULT_INDEX_INTERVAL 64
+
+/*
+ * On-disk recording format. All fields are in host byte order.
+ *
+ * A recording is a sequence of segment files named <prefix>.NNNNNN.bldrec. Each segment starts with a
+ * RecordingSegmentHeader, followed by records: a RecordHeader and the raw datagram, padded to 8 bytes.
+ * Next to each segment, <prefix>.NNNNNN.bldidx holds a RecordingIndexEntry for the first record and every
+ * index interval records after it, so a reader can jump close to a pulse ID without scanning the segment.
+ */
+
+#define RECORDING_MAGIC "BLDREC1"
+#define RECORDING_VERSION 1
+
+struct RecordingSegmentHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+    uint64_t segment;           // Index of this segment in the recording
+    uint64_t dataEnd;           // Offset just past the last complete record, kept current while recording
+    uint64_t numRecords;
+    uint64_t minPulseID;        // Pulse ID range of the records with a BLD header
+    uint64_t maxPulseID;
+    uint64_t reserved;
+};
+
+struct RecordHeader {
+    uint32_t size;              // Size of the datagram, not including padding
+    uint32_t srcAddr;           // Sender address and port, in network byte order
+    uint16_t srcPort;
+    uint16_t flags;
+    uint32_t reserved;
+    uint64_t recvTime;          // Receive time in ns since the Unix epoch
+    uint64_t pulseID;           // Copied from the BLD header, 0 if the datagram is too short to have one
+};
+
+struct RecordingIndexEntry {
+    uint64_t pulseID;
+    uint64_t timeStamp;         // BLD timestamp of the record
+    uint64_t offset;            // Offset of the record in the segment
+};
+
+static_assert(sizeof(RecordingSegmentHeader) == 64, "segment header layout changed");
+static_assert(sizeof(RecordHeader) == 32, "record header layout changed");
+static_assert(sizeof(RecordingIndexEntry) == 24, "index entry layout changed");
+
+/**
+ * Appends raw datagrams to preallocated, memory mapped segment files, rotating to a new segment when one fills up.
+ * Appending is a memcpy into the mapping, so recording keeps up with the receive path; the kernel writes the pages
+ * back in the background. Safe to call from several output threads at once.
+ */
+class PacketRecorder {
+public:
+    struct Stats {
+        uint64_t records = 0;
+        uint64_t bytes = 0;         // Datagram bytes recorded
+        uint64_t segments = 0;      // Segments opened
+        uint64_t dropped = 0;       // Datagrams not recorded because a segment couldn't be created
+    };
+
+    /**
+     * \param prefix Path prefix for the segment and index files
+     * \param segmentSize Size each segment is preallocated to, in bytes
+     * \param indexInterval Number of records between index entries
+     */
+    PacketRecorder(const std::string& prefix, size_t segmentSize = DEFAULT_SEGMENT_SIZE, unsigned indexInterval = DEFAULT_INDEX_INTERVAL);
+    ~PacketRecorder();
+
+    PacketRecorder(const PacketRecorder&) = delete;
+    PacketRecorder& operator=(const PacketRecorder&) = delete;
+
+    /**
+     * \brief Create the first segment
+     * \returns false on failure, the reason has already been printed
+     */
+    bool open();
+
+    /**
+     * \brief Append a datagram to the current segment, rotating first if it doesn't fit
+     * \returns false if the datagram couldn't be recorded
+     */
+    bool record(const PacketSlot& slot);
+
+    /**
+     * \brief Finish the current segment, trimming it to the recorded size
+     */
+    void close();
+
+    Stats stats();
+
+    void print_stats(FILE* fp);
+
+private:
+    bool open_segment();
+    void close_segment();
+
+    std::string m_prefix;
+    size_t m_segmentSize;
+    unsigned m_indexInterval;
+
+    std::mutex m_lock;
+    uint64_t m_segment = 0;         // Index of the next segment to open
+    int m_fd = -1;
+    uint8_t* m_map = nullptr;
+    size_t m_offset = 0;            // Write offset in the current segment
+    FILE* m_index = nullptr;
+    unsigned m_sinceIndex = 0;      // Records appended since the last index entry
+    bool m_failed = false;          // Stop retrying once a segment couldn't be created
+    Stats m_stats;
+};
+
+/**
+ * Reads datagrams back from a recording, optionally limited to a pulse ID range.
+ * Segments whose pulse ID range doesn't overlap are skipped, and the first segment in range is entered through
+ * its index, so only the records close to the start of the range are scanned.
+ * Pulse IDs are assumed to be non-decreasing within a recording, which holds for one BLD sender.
+ */
+class RecordingReader {
+public:
+    struct Stats {
+        uint64_t segments = 0;      // Segments read
+        uint64_t records = 0;       // Records returned
+        uint64_t skipped = 0;       // Records outside the pulse ID range that had to be scanned
+        uint64_t bytes = 0;
+    };
+
+    RecordingReader() = default;
+    ~RecordingReader();
+
+    RecordingReader(const RecordingReader&) = delete;
+    RecordingReader& operator=(const RecordingReader&) = delete;
+
+    /**
+     * \returns True if the file is a recording segment
+     */
+    static bool is_recording(const char* file);
+
+    /**
+     * \brief Open a recording, starting at the given segment file. Following segments are read in order
+     * \returns false on failure, the reason has already been printed
+     */
+    bool open(const char* file);
+
+    /**
+     * \brief Only return records with a pulse ID in [first, last]. Must be called before the first next()
+     */
+    void set_pulse_range(uint64_t first, uint64_t last);
+
+    /**
+     * \brief Copy the next record into a packet slot
+     * \returns false once the end of the recording or the pulse range is reached
+     */
+    bool next(PacketSlot& slot);
+
+    inline const Stats& stats() const { return m_stats; }
+
+    void print_stats(FILE* fp) const;
+
+private:
+    bool map_segment(const std::string& file);
+    void unmap_segment();
+    void next_segment();
+    void seek_index();
+
+    inline const RecordingSegmentHeader& header() const { return *reinterpret_cast<const RecordingSegmentHeader*>(m_map); }
+
+    std::string m_prefix;           // Empty if the file isn't part of a numbered recording, only that file is read
+    std::string m_indexFile;
+    uint64_t m_segment = 0;         // Index of the mapped segment
+    const uint8_t* m_map = nullptr;
+    size_t m_size = 0;
+    size_t m_offset = 0;
+    size_t m_end = 0;
+    bool m_positioned = false;      // The pulse range has been applied to the mapped segment
+    uint64_t m_firstPulse = 0;
+    uint64_t m_lastPulse = UINT64_MAX;
+    Stats m_stats;
+};
+
+/**
+ * \brief Build the file name of a segment or its index
+ * \param ext "bldrec" or "bldidx"
+ */
+std::string recording_file(const std::string& prefix, uint64_t segment, const char* ext);
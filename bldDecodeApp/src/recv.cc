@@ -0,0 +1,119 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'bldDecode'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'bldDecode', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+#include "recv.h"
+
+#include <cerrno>
+#include <cstring>
+#include <cassert>
+#include <ctime>
+
+BatchReceiver::BatchReceiver(unsigned batchSize) :
+    m_slots(batchSize),
+    m_slotPtrs(batchSize),
+    m_msgs(batchSize),
+    m_iovs(batchSize),
+    m_control(size_t(batchSize) * CONTROL_SIZE)
+{
+    assert(batchSize > 0);
+    m_stats.fillCounts.resize(batchSize + 1);
+    for (size_t i = 0; i < m_slots.size(); ++i)
+        m_slotPtrs[i] = &m_slots[i];
+
+    memset(m_msgs.data(), 0, sizeof(mmsghdr) * m_msgs.size());
+    for (size_t i = 0; i < m_msgs.size(); ++i) {
+        m_iovs[i].iov_len = MAXLINE;
+        m_msgs[i].msg_hdr.msg_iov = &m_iovs[i];
+        m_msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+}
+
+int BatchReceiver::receive(int sockfd) {
+    return receive(sockfd, m_slotPtrs.data(), m_slotPtrs.size());
+}
+
+int BatchReceiver::receive(int sockfd, PacketSlot* const* slots, unsigned count) {
+    assert(count > 0 && count <= m_msgs.size());
+
+    // Point the message headers at this batch's slots. recvmmsg also overwrites the name length, so this is reset every call
+    for (unsigned i = 0; i < count; ++i) {
+        m_iovs[i].iov_base = slots[i]->data;
+        m_msgs[i].msg_hdr.msg_name = &slots[i]->from;
+        m_msgs[i].msg_hdr.msg_namelen = sizeof(slots[i]->from);
+        m_msgs[i].msg_hdr.msg_control = &m_control[i * CONTROL_SIZE];
+        m_msgs[i].msg_hdr.msg_controllen = CONTROL_SIZE;
+    }
+
+    int n;
+    do {
+        n = recvmmsg(sockfd, m_msgs.data(), count, MSG_WAITFORONE, nullptr);
+    } while (n < 0 && errno == EINTR);
+
+    if (n < 0)
+        return n;
+
+    // A socket shut down for reading returns an empty message with no sender, that isn't a datagram
+    while (n > 0 && m_msgs[n - 1].msg_len == 0 && m_msgs[n - 1].msg_hdr.msg_namelen == 0)
+        --n;
+    if (n == 0)
+        return 0;
+
+    // Fallback for sockets without kernel timestamps, taken once for the whole batch
+    timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    const uint64_t batchTime = uint64_t(now.tv_sec) * 1000000000ULL + now.tv_nsec;
+
+    // The kernel reports a cumulative drop count per socket, turn it into the drops in front of each datagram
+    if (size_t(sockfd) >= m_socketDrops.size())
+        m_socketDrops.resize(sockfd + 1);
+    uint32_t& socketDrops = m_socketDrops[sockfd];
+
+    for (int i = 0; i < n; ++i) {
+        slots[i]->len = m_msgs[i].msg_len;
+        slots[i]->recvTime = batchTime;
+        slots[i]->kernelDrops = 0;
+
+        msghdr& hdr = m_msgs[i].msg_hdr;
+        for (cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr); cmsg; cmsg = CMSG_NXTHDR(&hdr, cmsg)) {
+            if (cmsg->cmsg_level != SOL_SOCKET)
+                continue;
+            if (cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+                timespec ts;
+                memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+                slots[i]->recvTime = uint64_t(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+            }
+            // Only attached once the socket has dropped something
+            else if (cmsg->cmsg_type == SO_RXQ_OVFL) {
+                uint32_t drops;
+                memcpy(&drops, CMSG_DATA(cmsg), sizeof(drops));
+                slots[i]->kernelDrops = drops - socketDrops;
+                socketDrops = drops;
+            }
+        }
+        m_stats.kernelDrops += slots[i]->kernelDrops;
+    }
+
+    ++m_stats.batches;
+    m_stats.packets += n;
+    ++m_stats.fillCounts[n];
+    if (unsigned(n) == count)
+        ++m_stats.fullBatches;
+    if (unsigned(n) > m_stats.maxFill)
+        m_stats.maxFill = n;
+    return n;
+}
+
+void BatchStats::print(FILE* fp, unsigned batchSize) const {
+    fprintf(fp, "Batch receive: %lu batches, %lu packets, avg fill %.2f/%u, max fill %u, %lu full batches, %lu kernel drops\n",
+        batches, packets, batches ? double(packets) / batches : 0.0, batchSize, maxFill, fullBatches, kernelDrops);
+    for (size_t i = 1; i < fillCounts.size(); ++i) {
+        if (fillCounts[i])
+            fprintf(fp, "  fill %4zu: %lu\n", i, fillCounts[i]);
+    }
+}
@@ -0,0 +1,96 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'bldDecode'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'bldDecode', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include <cstdio>
+#include <cstdint>
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+/** Largest datagram we will receive */
+#define MAXLINE 9000
+
+/** Default number of datagrams pulled per recvmmsg call */
+#define DEFAULT_BATCH_SIZE 1
+
+/** Upper bound on the batch size, matches the kernel's UIO_MAXIOV limit on recvmmsg */
+#define MAX_BATCH_SIZE 1024
+
+/** Space reserved for ancillary data (receive timestamp and kernel drop count) per datagram */
+#define CONTROL_SIZE 64
+
+/**
+ * A single received datagram
+ */
+struct PacketSlot {
+    char data[MAXLINE];
+    ssize_t len;
+    sockaddr_in from;
+    uint64_t recvTime;  // Receive time in ns since the Unix epoch. Taken by the kernel if the socket has SO_TIMESTAMPNS set
+    uint32_t kernelDrops = 0;   // Datagrams the kernel dropped on this socket since the previous one, if it has SO_RXQ_OVFL set
+};
+
+/**
+ * Fill statistics for batched receives, used to tune the batch size
+ */
+struct BatchStats {
+    uint64_t batches = 0;
+    uint64_t packets = 0;
+    uint64_t fullBatches = 0;       // Batches that filled every slot, the socket likely had more pending
+    unsigned maxFill = 0;
+    uint64_t kernelDrops = 0;       // Datagrams dropped by the kernel because the socket's receive buffer was full
+    std::vector<uint64_t> fillCounts; // Histogram of batch fill, indexed by number of datagrams received
+
+    void print(FILE* fp, unsigned batchSize) const;
+};
+
+/**
+ * Receives datagrams in batches using recvmmsg into a preallocated array of packet slots
+ */
+class BatchReceiver {
+public:
+    /**
+     * \param batchSize Maximum number of datagrams to receive per call
+     */
+    explicit BatchReceiver(unsigned batchSize);
+
+    BatchReceiver(const BatchReceiver&) = delete;
+    BatchReceiver& operator=(const BatchReceiver&) = delete;
+
+    /**
+     * \brief Block until at least one datagram is available, then receive as many as are pending (up to the batch size)
+     * \param sockfd Socket to receive from
+     * \returns Number of datagrams received, 0 once the socket has been shut down, or -1 on error (errno is set)
+     */
+    int receive(int sockfd);
+
+    /**
+     * \brief Same as receive(), but fills caller provided slots instead of the internal ones
+     * \param slots Slots to receive into
+     * \param count Number of slots, must not exceed the batch size
+     */
+    int receive(int sockfd, PacketSlot* const* slots, unsigned count);
+
+    inline PacketSlot& operator[](unsigned i) { return m_slots[i]; }
+    inline unsigned batch_size() const { return m_slots.size(); }
+    inline const BatchStats& stats() const { return m_stats; }
+
+private:
+    std::vector<PacketSlot> m_slots;
+    std::vector<PacketSlot*> m_slotPtrs;
+    std::vector<mmsghdr> m_msgs;
+    std::vector<iovec> m_iovs;
+    std::vector<char> m_control;    // CONTROL_SIZE bytes per message
+    std::vector<uint32_t> m_socketDrops; // Last cumulative SO_RXQ_OVFL count seen, indexed by socket
+    BatchStats m_stats;
+};
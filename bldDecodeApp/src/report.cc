@@ -9,34 +9,27 @@
 //////////////////////////////////////////////////////////////////////////////
 #include "report.h"
 #include "util.h"
+#include "loss.h"
+#include "latency.h"
+#include "recv.h"
 
-#include <cassert>
-
-constexpr const char BASE64_TABLE[] =
-    "ABCDEFGHIJKLMNOPQRSTUVXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <sstream>
+#include <fcntl.h>
+#include <unistd.h>
 
 // Encode packet data in base64
 std::string ReportEntry::to_string() const {
-    auto *data = static_cast<char *>(m_data);
-
-    std::string str;
-    str.resize(m_dataLen * 4 + 1);
-    for (size_t i = 0; i < m_dataLen;) {
-        auto a = i < m_dataLen ? (unsigned char)data[i++] : 0;
-        auto b = i < m_dataLen ? (unsigned char)data[i++] : 0;
-        auto c = i < m_dataLen ? (unsigned char)data[i++] : 0;
-
-        uint32_t triple = (a << 0x10) + (b << 0x08) + c;
-
-        str.push_back(BASE64_TABLE[(triple >> 3 * 6) & 0x3F]);
-        str.push_back(BASE64_TABLE[(triple >> 2 * 6) & 0x3F]);
-        str.push_back(BASE64_TABLE[(triple >> 1 * 6) & 0x3F]);
-        str.push_back(BASE64_TABLE[triple & 0x3F]);
-    }
+    std::string str(base64_length(m_capturedLen), '\0');
+    base64_encode(m_data, m_capturedLen, &str[0]);
     return str;
 }
 
-std::string to_string(PacketError reason) {
+static const char* reason_name(PacketError reason) {
     switch(reason) {
     case PacketError::BadEvent:
         return "Invalid event";
@@ -44,72 +37,500 @@ std::string to_string(PacketError reason) {
         return "Invalid header";
     case PacketError::BadTimestamp:
         return "Invalid timestamp";
+    case PacketError::BadLength:
+        return "Invalid length";
+    case PacketError::TimeOrder:
+        return "Timestamps out of order";
+    case PacketError::PulseOrder:
+        return "Pulse IDs out of order";
+    case PacketError::BadSeverity:
+        return "Invalid severity";
     case PacketError::Unknown:
     default:
         return "Unknown";
     }
 }
 
-static std::string to_string(const epicsTimeStamp& ts) {
-    char time[256];
-    epicsTimeToStrftime(time, sizeof(time), "%a %b %d %Y %H:%M:%S.%09f", &ts);
-    return time;
+// Short names of the reasons, as used by --retention and the summaries
+static const struct { const char* name; PacketError reason; } REASON_KEYS[] = {
+    {"header", PacketError::BadHeader},
+    {"timestamp", PacketError::BadTimestamp},
+    {"event", PacketError::BadEvent},
+    {"length", PacketError::BadLength},
+    {"time-order", PacketError::TimeOrder},
+    {"pulse-order", PacketError::PulseOrder},
+    {"severity", PacketError::BadSeverity},
+    {"unknown", PacketError::Unknown},
+};
+
+/* BLD timestamps (seconds << 32 | nanoseconds) in plain nanoseconds, for differences */
+static inline uint64_t bld_ts_to_ns(uint64_t ts) {
+    return (ts >> 32) * 1000000000ull + (ts & 0xFFFFFFFF);
+}
+
+static inline uint32_t check(PacketError reason, bool failed) {
+    return uint32_t(failed) << unsigned(reason);
+}
+
+/* The lowest code in a mask of failed checks */
+static inline PacketError first_failure(uint32_t failed) {
+    return failed ? PacketError(__builtin_ctz(failed)) : PacketError::None;
+}
+
+std::string to_string(PacketError reason) {
+    return reason_name(reason);
 }
 
-void Report::serialize(std::ofstream& stream) {
-    stream << "{\n";
-    stream << "\t\"recv\": " << m_totalPackets << ",\n";
-    stream << "\t\"errors\": " << m_errorPackets << ",\n";
-    stream << "\t\"errorPackets\": [\n";
+static bool parse_reason(const char* str, size_t len, unsigned& first, unsigned& last) {
+    if (len == 3 && !strncmp(str, "all", len)) {
+        first = unsigned(PacketError::Unknown);
+        last = NUM_PACKET_ERRORS - 1;
+        return true;
+    }
+    for (auto& r : REASON_KEYS) {
+        if (strlen(r.name) == len && !strncmp(str, r.name, len)) {
+            first = last = unsigned(r.reason);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool parse_retention(const char* str, ReportConfig& config) {
+    const char* p = str;
+    while (*p) {
+        const char* colon = strchr(p, ':');
+        unsigned first, last;
+        if (!colon || !parse_reason(p, colon - p, first, last))
+            goto invalid;
+
+        RetentionPolicy policy;
+        p = colon + 1;
+        if (!strncmp(p, "first:", 6))
+            policy.mode = RetentionPolicy::KeepFirst;
+        else if (!strncmp(p, "last:", 5))
+            policy.mode = RetentionPolicy::KeepLast;
+        else
+            goto invalid;
+        p = strchr(p, ':') + 1;
 
-    bool first = true;
-    for (auto& packet : m_entries) {
-        if (!first)
-            stream << ",\n";
-        stream << "\t\t{\n";
-        stream << "\t\t\t\"index\": " << packet.index() << ",\n";
-        stream << "\t\t\t\"size\": " << packet.data_length() << ",\n";
-        stream << "\t\t\t\"reason\": " << to_string(packet.reason()) << ",\n";
-        stream << "\t\t\t\"time\": " << to_string(packet.recv_time()) << ",\n";
-        stream << "\t\t\t\"time_raw\": " << double(packet.recv_time().secPastEpoch) + (packet.recv_time().nsec / 1e9) << ",\n";
-        stream << "\t\t\t\"data\": " << packet.to_string() << "\n";
+        char* end;
+        policy.limit = strtoul(p, &end, 10);
+        if (end == p || (*end != 0 && *end != ','))
+            goto invalid;
+        p = *end ? end + 1 : end;
 
-        if (first)
-            first = false;
-        stream << "\t\t}\n";
+        for (unsigned i = first; i <= last; ++i)
+            config.retention[i] = policy;
     }
-    stream << "\t]\n}" << std::endl;
+    return true;
+
+invalid:
+    printf("Invalid retention policy '%s', expected "
+        "'<header|timestamp|event|length|time-order|pulse-order|severity|unknown|all>:<first|last>:<count>[,...]'\n", str);
+    return false;
 }
 
+Report::Report(const ReportConfig& config) :
+    m_config(config)
+{
+    // Valid packets are never stored
+    m_config.retention[unsigned(PacketError::None)].limit = 0;
+
+    size_t numEntries = 0;
+    for (auto& policy : m_config.retention)
+        numEntries += policy.limit;
+
+    // No point in reserving more than the largest datagram per entry
+    m_slotSize = numEntries ? std::min<size_t>(m_config.maxBytes / numEntries, MAXLINE) : 0;
+    m_arena.resize(m_slotSize * numEntries);
+    m_entries.resize(numEntries);
+    for (size_t i = 0; i < numEntries; ++i)
+        m_entries[i].m_data = m_arena.data() + i * m_slotSize;
+
+    ReportEntry* next = m_entries.data();
+    for (unsigned i = 0; i < NUM_PACKET_ERRORS; ++i) {
+        m_rings[i].policy = m_config.retention[i];
+        m_rings[i].entries = next;
+        next += m_rings[i].policy.limit;
+    }
+}
+
+ReportEntry* Report::claim_entry(PacketError reason) {
+    Ring& ring = m_rings[unsigned(reason)];
+    if (ring.count < ring.policy.limit)
+        return &ring.entries[ring.count++];
+
+    ++ring.dropped;
+    if (ring.policy.mode != RetentionPolicy::KeepLast || ring.policy.limit == 0)
+        return nullptr;
+
+    // Overwrite the oldest entry
+    ReportEntry* entry = &ring.entries[ring.next];
+    ring.next = (ring.next + 1) % ring.policy.limit;
+    return entry;
+}
+
+void Report::store_entry(ReportEntry& entry, PacketError reason, const void* data, size_t dataLen, size_t capturedLen,
+    uint64_t index, uint64_t recvTime, uint64_t source) {
+    entry.m_dataLen = dataLen;
+    entry.m_capturedLen = std::min(capturedLen, m_slotSize);
+    entry.m_index = index;
+    entry.m_recvTime = recvTime;
+    entry.m_source = source;
+    entry.m_reason = reason;
+    entry.m_streamed = false;
+    memcpy(entry.m_data, data, entry.m_capturedLen);
+}
+
+void Report::report_packet_error(PacketError reason, const void* data, size_t dataLen, uint64_t recvTime, uint64_t source) {
+    const uint64_t index = m_totalPackets++;
+    ++m_errorPackets;
+    if (SourceCounters* c = m_sources.find_or_add(source)) {
+        ++c->packets;
+        ++c->errors[unsigned(reason)];
+    }
+
+    ReportEntry* entry = claim_entry(reason);
+    if (!entry)
+        return;
+    store_entry(*entry, reason, data, dataLen, dataLen, index, recvTime, source);
+
+    // Entries kept last may still be overwritten, they are written with the summary
+    if (m_writer && m_rings[unsigned(reason)].policy.mode == RetentionPolicy::KeepFirst) {
+        m_writer->write_entry(*entry);
+        entry->m_streamed = true;
+    }
+}
+
+std::vector<const ReportEntry*> Report::sorted_entries() const {
+    std::vector<const ReportEntry*> entries;
+    for (auto& ring : m_rings) {
+        for (unsigned i = 0; i < ring.count; ++i)
+            entries.push_back(&ring.entries[i]);
+    }
+    std::sort(entries.begin(), entries.end(), [](const ReportEntry* a, const ReportEntry* b) {
+        return a->recv_time_ns() != b->recv_time_ns() ? a->recv_time_ns() < b->recv_time_ns() : a->index() < b->index();
+    });
+    return entries;
+}
+
+void Report::clear_entries() {
+    for (auto& ring : m_rings)
+        ring.count = ring.next = 0;
+}
+
+void Report::serialize(ReportWriter& writer) {
+    for (auto* entry : sorted_entries()) {
+        if (!entry->m_streamed)
+            writer.write_entry(*entry);
+    }
+
+    std::ostringstream stream;
+    stream << "{\"type\": \"summary\", \"recv\": " << m_totalPackets << ", \"errors\": " << m_errorPackets;
+    stream << ", \"kernelDrops\": " << m_kernelDrops << ", \"pipelineDrops\": " << m_pipelineDrops;
+    stream << ", \"kernelFiltered\": " << m_kernelFiltered << ", \"userFiltered\": " << m_userFiltered << ", \"dropped\": {";
+    for (unsigned i = unsigned(PacketError::Unknown); i < NUM_PACKET_ERRORS; ++i)
+        stream << (i == unsigned(PacketError::Unknown) ? "" : ", ") << "\"" << reason_name(PacketError(i)) << "\": " << m_rings[i].dropped;
+    stream << "}, \"checks\": {";
+    for (unsigned i = unsigned(PacketError::BadHeader); i < NUM_PACKET_ERRORS; ++i)
+        stream << (i == unsigned(PacketError::BadHeader) ? "" : ", ") << "\"" << reason_name(PacketError(i)) << "\": " << m_failedChecks[i];
+    stream << "}}\n";
+    for (size_t s = 0; s < m_sources.size(); ++s) {
+        const SourceCounters& c = m_sources.value(s);
+        stream << "{\"type\": \"source\", \"source\": \"" << source_name(m_sources.key(s)) << "\", \"recv\": " << c.packets;
+        stream << ", \"errors\": {";
+        for (unsigned i = unsigned(PacketError::Unknown); i < NUM_PACKET_ERRORS; ++i)
+            stream << (i == unsigned(PacketError::Unknown) ? "" : ", ") << "\"" << reason_name(PacketError(i)) << "\": " << c.errors[i];
+        stream << "}}\n";
+    }
+    if (m_loss)
+        m_loss->serialize(stream);
+    if (m_latency)
+        m_latency->serialize(stream);
+    writer.write_lines(stream.str());
+}
+
+void Report::print_stats(FILE* fp) const {
+    fprintf(fp, "Report: %lu packets, %lu errors, %lu dropped by the kernel, %lu dropped by the pipeline, "
+        "%lu filtered in the kernel, %lu filtered in userspace\n",
+        m_totalPackets, m_errorPackets, m_kernelDrops, m_pipelineDrops, m_kernelFiltered, m_userFiltered);
+
+    // Only the checks that failed, a packet may fail several
+    std::string checks;
+    for (auto& r : REASON_KEYS) {
+        if (m_failedChecks[unsigned(r.reason)])
+            checks += std::string(checks.empty() ? "" : ", ") + r.name + " " + std::to_string(m_failedChecks[unsigned(r.reason)]);
+    }
+    if (!checks.empty())
+        fprintf(fp, "  Failed checks: %s\n", checks.c_str());
 
-PacketError PacketValidator::validate(bldMulticastPacket_t* packet, size_t datalen) {
-    if (datalen < bldMulticastPacketHeaderSize)
+    for (size_t s = 0; s < m_sources.size(); ++s) {
+        const SourceCounters& c = m_sources.value(s);
+        uint64_t errors = 0;
+        std::string reasons;
+        for (auto& r : REASON_KEYS) {
+            const uint64_t n = c.errors[unsigned(r.reason)];
+            errors += n;
+            if (n)
+                reasons += std::string(reasons.empty() ? " (" : ", ") + std::to_string(n) + " " + r.name;
+        }
+        fprintf(fp, "  Source %s: %lu packets, %lu errors%s%s\n", source_name(m_sources.key(s)).c_str(), c.packets,
+            errors, reasons.c_str(), reasons.empty() ? "" : ")");
+    }
+    if (m_sources.overflowed())
+        fprintf(fp, "  %lu packets from sources beyond the first %d were not counted per source\n",
+            m_sources.overflowed(), MAX_SOURCES);
+}
+
+void Report::merge(Report& other) {
+    // Merging happens once on exit, so it may allocate. Copy the stored entries out of both arenas
+    // and store them again in time order, letting the retention policies pick what is kept.
+    // Entries already streamed stay in the report file, even if the combined entries no longer keep them
+    struct Stored {
+        PacketError reason;
+        uint32_t dataLen;
+        uint64_t index;
+        uint64_t recvTime;
+        uint64_t source;
+        bool streamed;
+        std::vector<uint8_t> data;
+    };
+    std::vector<Stored> stored;
+    for (Report* r : {this, &other}) {
+        for (auto* e : r->sorted_entries())
+            stored.push_back({e->reason(), e->m_dataLen, e->index(), e->recv_time_ns(), e->source(), e->m_streamed,
+                std::vector<uint8_t>(e->data(), e->data() + e->captured_length())});
+    }
+    std::stable_sort(stored.begin(), stored.end(), [](const Stored& a, const Stored& b) {
+        return a.recvTime < b.recvTime;
+    });
+
+    clear_entries();
+    other.clear_entries();
+    for (unsigned i = 0; i < NUM_PACKET_ERRORS; ++i) {
+        m_rings[i].dropped += other.m_rings[i].dropped;
+        other.m_rings[i].dropped = 0;
+    }
+
+    for (auto& s : stored) {
+        if (ReportEntry* entry = claim_entry(s.reason)) {
+            store_entry(*entry, s.reason, s.data.data(), s.dataLen, s.data.size(), s.index, s.recvTime, s.source);
+            entry->m_streamed = s.streamed;
+        }
+    }
+
+    m_totalPackets += other.m_totalPackets;
+    m_errorPackets += other.m_errorPackets;
+    m_kernelDrops += other.m_kernelDrops;
+    m_pipelineDrops += other.m_pipelineDrops;
+    m_kernelFiltered += other.m_kernelFiltered;
+    m_userFiltered += other.m_userFiltered;
+    other.m_totalPackets = other.m_errorPackets = other.m_kernelDrops = other.m_pipelineDrops = 0;
+    other.m_kernelFiltered = other.m_userFiltered = 0;
+    for (unsigned i = 0; i < NUM_PACKET_ERRORS; ++i) {
+        m_failedChecks[i] += other.m_failedChecks[i];
+        other.m_failedChecks[i] = 0;
+    }
+
+    // Shards see disjoint senders unless several sockets share one, so the merged table fits unless a shard's did not
+    for (size_t s = 0; s < other.m_sources.size(); ++s) {
+        const SourceCounters& from = other.m_sources.value(s);
+        if (SourceCounters* c = m_sources.find_or_add(other.m_sources.key(s))) {
+            c->packets += from.packets;
+            for (unsigned i = 0; i < NUM_PACKET_ERRORS; ++i)
+                c->errors[i] += from.errors[i];
+        }
+    }
+    other.m_sources = SourceTable<SourceCounters>();
+}
+
+PacketError PacketValidator::validate(const BldPacketView& packet, uint64_t source, uint32_t& failed) {
+    if (!packet.has_header()) {
+        failed |= failed_check(PacketError::BadHeader);
         return PacketError::BadHeader;
+    }
+
+    SourceState* state = m_sources.find_or_add(source);
+    if (!state)
+        state = &m_otherSources;
+
+    // The first valid timestamp of the sender is the reference for the later ones
+    const uint64_t ts = packet.time_stamp();
+    const uint64_t t = bld_ts_to_ns(ts);
+    const bool badNsec = (ts & 0xFFFFFFFF) >= 1000000000u;
+    if (!state->hasFirstTime && !badNsec) {
+        state->firstTime = t;
+        state->hasFirstTime = true;
+    }
+    const bool early = t + uint64_t(TIMESTAMP_EPSILON * 1e9) < state->firstTime;
+
+    const uint32_t checks = check(PacketError::BadTimestamp, badNsec || early);
+    failed |= checks;
+    return first_failure(checks);
+}
+
+PacketError PacketValidator::validate_events(const BldPacketView& packet, unsigned numChannels, uint32_t& failed) {
+    // Severity bits of the channels beyond the payload, two per channel
+    const uint64_t unused = numChannels >= 32 ? 0 : ~uint64_t(0) << (2 * numChannels);
+    uint64_t sevr = packet.severity_mask() & unused;
+
+    // Deltas are relative to the header, which is event 0 with both deltas 0. Pulse IDs must strictly increase,
+    // timestamps may repeat. The checks are or'ed together rather than returning early, one pass counts them all
+    const size_t eventSize = packet.event_size();
+    const uint8_t* p = packet.data() + packet.header_size();
+    uint32_t lastTime = 0, lastPulse = 0;
+    bool timeOrder = false, pulseOrder = false;
+    for (size_t i = 0, n = packet.num_events(); i < n; ++i, p += eventSize) {
+        // deltaTimeStamp:20 and deltaPulseID:12 share the first 32-bit word
+        const uint32_t deltas = load_unaligned<uint32_t>(p);
+        const uint32_t dt = deltas & 0xFFFFF, dp = deltas >> 20;
+        timeOrder |= dt < lastTime;
+        pulseOrder |= dp <= lastPulse;
+        lastTime = dt;
+        lastPulse = dp;
+        sevr |= load_unaligned<uint64_t>(p + offsetof(bldMulticastComplementaryPacket_t, severityMask)) & unused;
+    }
+
+    const uint32_t checks =
+        check(PacketError::BadLength, packet.size() < packet.header_size()) |
+        check(PacketError::BadEvent, packet.trailing_bytes() != 0) |
+        check(PacketError::TimeOrder, timeOrder) |
+        check(PacketError::PulseOrder, pulseOrder) |
+        check(PacketError::BadSeverity, sevr != 0);
+    failed |= checks;
+    return first_failure(checks);
+}
 
-    if (!m_hasFirstTimestamp) {
-        uint32_t sec, nsec;
-        extract_ts(packet->timeStamp, sec, nsec);
-        m_firstTimestamp.nsec = nsec;
-        m_firstTimestamp.secPastEpoch = sec;
-        m_hasFirstTimestamp = true;
+// Write the whole buffer, retrying short writes
+static bool write_all(int fd, const void* data, size_t len) {
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    while (len > 0) {
+        const ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        p += n;
+        len -= n;
     }
-    // Validate timestamp...
-    else {
-        auto newts = m_firstTimestamp;
-        epicsTimeAddSeconds(&newts, -TIMESTAMP_EPSILON);
-        auto packetTs = epics_from_bld(packet->timeStamp);
-        if (epicsTimeLessThan(&packetTs, &newts))
-            return PacketError::BadTimestamp;
+    return true;
+}
+
+ReportWriter::ReportWriter(const std::string& path, double flushInterval) :
+    m_path(path),
+    m_flushInterval(flushInterval),
+    m_buffer(REPORT_BUFFER_SIZE),
+    m_spare(REPORT_BUFFER_SIZE)
+{
+}
+
+ReportWriter::~ReportWriter() {
+    close();
+}
+
+bool ReportWriter::open() {
+    if ((m_fd = ::open(m_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+        printf("Unable to create report file %s: %s\n", m_path.c_str(), strerror(errno));
+        return false;
     }
+    m_thread = std::thread([this]() { flush_thread(); });
+    return true;
+}
 
-    return PacketError::None;
+char* ReportWriter::reserve(std::unique_lock<std::mutex>& lock, size_t len) {
+    while (m_used + len > m_buffer.size()) {
+        lock.unlock();
+        flush();
+        lock.lock();
+    }
+    char* p = m_buffer.data() + m_used;
+    m_used += len;
+    return p;
 }
 
-PacketError PacketValidator::validate(bldMulticastComplementaryPacket_t* packet, size_t datalen) {
-    assert(m_hasFirstTimestamp);
+void ReportWriter::write_entry(const ReportEntry& entry) {
+    char time[64];
+    const epicsTimeStamp ts = entry.recv_time();
+    epicsTimeToStrftime(time, sizeof(time), "%a %b %d %Y %H:%M:%S.%09f", &ts);
+    char source[SOURCE_NAME_LENGTH];
+    format_source(entry.source(), source, sizeof(source));
+
+    // Everything but the data fits in this, even with the longest reason and counters
+    constexpr size_t maxFields = 384;
+    const size_t dataLen = base64_length(entry.captured_length());
+
+    std::unique_lock<std::mutex> lock(m_lock);
+    char* line = reserve(lock, maxFields + dataLen);
+    int n = snprintf(line, maxFields,
+        "{\"type\": \"error\", \"index\": %lu, \"size\": %zu, \"captured\": %zu, \"reason\": \"%s\", "
+        "\"source\": \"%s\", \"time\": \"%s\", \"time_raw\": %u.%09u, \"data\": \"",
+        entry.index(), entry.data_length(), entry.captured_length(), reason_name(entry.reason()), source, time,
+        ts.secPastEpoch, ts.nsec);
+    n += base64_encode(entry.data(), entry.captured_length(), line + n);
+    line[n++] = '"';
+    line[n++] = '}';
+    line[n++] = '\n';
+
+    // Give back what the line didn't use
+    m_used -= maxFields + dataLen - n;
+}
 
-    if (datalen < bldMulticastComplementaryPacketHeaderSize)
-        return PacketError::BadEvent;
+void ReportWriter::write_lines(const std::string& lines) {
+    std::unique_lock<std::mutex> lock(m_lock);
+    if (lines.size() <= m_buffer.size()) {
+        memcpy(reserve(lock, lines.size()), lines.data(), lines.size());
+        return;
+    }
+
+    // Too large to buffer, write it out directly after what is already buffered
+    lock.unlock();
+    flush();
+    std::lock_guard<std::mutex> writeLock(m_writeLock);
+    if (!write_all(m_fd, lines.data(), lines.size()))
+        m_failed = true;
+}
+
+void ReportWriter::flush() {
+    std::lock_guard<std::mutex> writeLock(m_writeLock);
+    size_t len;
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        std::swap(m_buffer, m_spare);
+        len = m_used;
+        m_used = 0;
+    }
+    if (len > 0 && m_fd >= 0 && !write_all(m_fd, m_spare.data(), len))
+        m_failed = true;
+}
+
+void ReportWriter::flush_thread() {
+    const auto interval = std::chrono::duration<double>(m_flushInterval);
+    std::unique_lock<std::mutex> lock(m_lock);
+    while (!m_stop) {
+        m_wake.wait_for(lock, interval);
+        lock.unlock();
+        flush();
+        lock.lock();
+    }
+}
+
+void ReportWriter::close() {
+    if (m_fd < 0)
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_stop = true;
+    }
+    m_wake.notify_all();
+    if (m_thread.joinable())
+        m_thread.join();
 
-    return PacketError::None;
+    flush();
+    if (m_failed)
+        printf("Error while writing report file %s, the report is incomplete!\n", m_path.c_str());
+    ::close(m_fd);
+    m_fd = -1;
 }
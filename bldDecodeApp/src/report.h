@@ -9,8 +9,12 @@
 //////////////////////////////////////////////////////////////////////////////
 #pragma once
 
-#include <fstream>
-#include <list>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <string>
 #include <cstdlib>
 #include <cstring>
 #include <cstdint>
@@ -18,111 +22,352 @@
 #include <epicsTime.h>
 
 #include "bld-proto.h"
+#include "packet.h"
+#include "source.h"
 
 class Report;
+class ReportWriter;
+class LossTracker;
+class LatencyTracker;
 
+/**
+ * Reason a packet is invalid. Every code but None and Unknown is also a check of the validator, see failed_check
+ */
 enum class PacketError {
     None,
     Unknown,
     BadHeader,        // Invalid header
-    BadTimestamp,     // Timestamp is located TIMESTAMP_EPSILON seconds before the first received packet's timestamp, and is likely garbage
-    BadEvent,         // Event is invalid in some way. Too short, missing channels, etc.
+    BadTimestamp,     // Timestamp is located TIMESTAMP_EPSILON seconds before the first received packet's timestamp, or its nanoseconds are out of range, and is likely garbage
+    BadEvent,         // Partial complementary event after the last complete one: not a whole number of events
+    BadLength,        // Datagram ends inside the header's payload, too short for the channels of the layout
+    TimeOrder,        // Timestamp of a complementary event earlier than the one before it
+    PulseOrder,       // Pulse ID of a complementary event not after the one before it
+    BadSeverity,      // Severity bits set for channels beyond the payload, in the header or an event
 };
 
 std::string to_string(PacketError reason);
 
 /** Epsilon (in seconds) for timestamp validation */
-/** If the packet timestamp is this many seconds behind the first recv'ed packets timestamp, it is considered invalid */
+/** If the packet timestamp is this many seconds behind the first packet recv'ed from its sender, it is considered invalid */
 constexpr double TIMESTAMP_EPSILON = 60.0;
 
+/** \returns The bit of a check in a mask of failed checks */
+inline uint32_t failed_check(PacketError reason) { return 1u << unsigned(reason); }
+
 /**
  * Validator for BLD packets
- * can be used independently of the rest of the reporting infrastructure
+ * can be used independently of the rest of the reporting infrastructure.
+ * Every sender is validated against its own first timestamp, so a sender with a broken clock can't make the packets
+ * of the others look invalid. Senders beyond MAX_SOURCES share one state.
+ *
+ * Every check is run on every packet, in a single pass over the raw bytes that folds the results into a mask rather
+ * than stopping at the first failure, so each check can be counted on its own. Timestamps are compared as integers in
+ * their wire encoding.
  */
 class PacketValidator {
 public:
     /**
-     * \brief Validate a BLD packet header
-     * \param packet Pointer to the packet header
-     * \param datalen Length of the header (NOTE: this is NOT the total size of the recv'ed data, only of the header + its signals)
+     * \brief Validate a BLD packet header: its length and timestamp
+     * \param packet View over the received packet
+     * \param source Sender of the packet, see source_key
+     * \param failed The failed checks are added to this mask, see failed_check
+     * \returns The first check that failed
      */
-    PacketError validate(bldMulticastPacket_t* packet, size_t datalen);
+    PacketError validate(const BldPacketView& packet, uint64_t source, uint32_t& failed);
 
     /**
-     * \brief Validate a complementary (aka event) packet
-     * \param packet Pointer to the complementary packet header
-     * \param datalen Size of the complementary packet (This is NOT the total size of the packet, only of this single event)
+     * \brief Validate the payload length and the complementary (aka event) packets following the header: a whole
+     * number of events, timestamps and pulse IDs in order, and no severity for channels beyond the payload
+     * \param packet View over the received packet. The header must have already been validated.
+     * \param numChannels Number of channels in the payload
+     * \param failed The failed checks are added to this mask, see failed_check
+     * \returns The first check that failed
      */
-    PacketError validate(bldMulticastComplementaryPacket_t* packet, size_t datalen);
+    PacketError validate_events(const BldPacketView& packet, unsigned numChannels, uint32_t& failed);
 
 private:
-    epicsTimeStamp m_firstTimestamp;
-    bool m_hasFirstTimestamp = false;
+    struct SourceState {
+        uint64_t firstTime;             // BLD timestamp of the first packet, in ns
+        bool hasFirstTime = false;
+    };
+
+    SourceTable<SourceState> m_sources;
+    SourceState m_otherSources;         // Shared by the senders that don't fit in m_sources
 };
 
+/** Number of PacketError values */
+#define NUM_PACKET_ERRORS 9
+
+/** Default memory budget for stored error packets, in bytes */
+#define DEFAULT_REPORT_BYTES (16UL << 20)
+
+/** Default number of error packets stored per reason */
+#define DEFAULT_REPORT_ENTRIES 1000
+
+/** Default interval between flushes of the report file, in seconds */
+#define DEFAULT_REPORT_FLUSH 1.0
+
+/** Size of each of the report writer's two line buffers, in bytes */
+#define REPORT_BUFFER_SIZE (1UL << 20)
+
 /**
- * A single entry in the report, detailing an error and its data
+ * Which error packets of a reason are kept once its limit is reached. Packets beyond the limit are only counted
  */
-class ReportEntry {
-public:
-    ReportEntry(PacketError error, const void* data, size_t datalen, uint64_t index, const epicsTimeStamp& recvAt) :
-        m_dataLen(datalen),
-        m_index(index),
-        m_recvTime(recvAt),
-        m_reason(error)
-    {
-        m_data = malloc(datalen);
-        memcpy(m_data, data, datalen);
-    }
+struct RetentionPolicy {
+    enum Mode {
+        KeepFirst,      // Keep the first packets, drop later ones
+        KeepLast,       // Keep the latest packets, overwriting the oldest
+    };
+    Mode mode = KeepFirst;
+    unsigned limit = DEFAULT_REPORT_ENTRIES;
+};
 
-    ReportEntry(const ReportEntry& rhs) = delete;
-    ReportEntry() = delete;
+/**
+ * Report settings
+ */
+struct ReportConfig {
+    size_t maxBytes = DEFAULT_REPORT_BYTES;         // Arena size for error packet data, split evenly between entries
+    RetentionPolicy retention[NUM_PACKET_ERRORS];   // Indexed by PacketError
+};
 
-    ~ReportEntry() { free(m_data); }
+/**
+ * \brief Parse retention policies, '<reason>:<first|last>:<count>[,...]' where reason is one of
+ * header, timestamp, event, length, time-order, pulse-order, severity, unknown or all, and update the config
+ * \returns false if the policy is invalid. The reason has already been printed
+ */
+bool parse_retention(const char* str, ReportConfig& config);
 
+/**
+ * A single entry in the report, detailing an error and its data.
+ * The data lives in the report's arena, packets larger than an arena slot are truncated.
+ */
+class ReportEntry {
+public:
     std::string to_string() const;
 
     inline uint64_t index() const { return m_index; }
     inline size_t data_length() const { return m_dataLen; }
-    inline epicsTimeStamp recv_time() const { return m_recvTime; }
+    inline size_t captured_length() const { return m_capturedLen; }
+    inline epicsTimeStamp recv_time() const { return epics_from_ns(m_recvTime); }
+    inline uint64_t recv_time_ns() const { return m_recvTime; }
+    inline uint64_t source() const { return m_source; }
     inline PacketError reason() const { return m_reason; }
+    inline const uint8_t* data() const { return m_data; }
 
 private:
-    void* m_data;
-    size_t m_dataLen;
-    uint64_t m_index;
-    epicsTimeStamp m_recvTime;
-    PacketError m_reason;
+    friend class Report;
+
+    static inline epicsTimeStamp epics_from_ns(uint64_t ns) {
+        epicsTimeStamp ts;
+        ts.secPastEpoch = uint32_t(ns / 1000000000ull - POSIX_TIME_AT_EPICS_EPOCH);
+        ts.nsec = uint32_t(ns % 1000000000ull);
+        return ts;
+    }
+
+    uint8_t* m_data = nullptr;
+    uint32_t m_dataLen = 0;
+    uint32_t m_capturedLen = 0;
+    uint64_t m_index = 0;
+    uint64_t m_recvTime = 0;        // ns since the Unix epoch
+    uint64_t m_source = 0;          // Sender, see source_key
+    PacketError m_reason = PacketError::None;
+    bool m_streamed = false;        // Already written to the report file
 };
 
 /**
  * Report container class
- * Maintains a memory bounded list of errors
+ * Maintains a memory bounded store of errors: every entry and its data are preallocated from a fixed arena when
+ * the report is created, with a ring of entries per reason, so reporting an error never allocates.
+ * Packets and errors are also counted per sender, in a preallocated SourceTable.
  */
 class Report {
 public:
+    explicit Report(const ReportConfig& config = ReportConfig());
+
+    Report(const Report&) = delete;
+    Report& operator=(const Report&) = delete;
+
     /**
      * Report that a valid BLD packet has been recv'ed
+     * \param source Sender of the packet, see source_key
      */
-    void report_packet_recv() {
+    void report_packet_recv(uint64_t source) {
         ++m_totalPackets;
+        if (SourceCounters* c = m_sources.find_or_add(source))
+            ++c->packets;
     }
 
     /**
-     * Report an invalid packet with a reason
+     * Report datagrams the kernel dropped on a socket because its receive buffer was full
      */
-    void report_packet_error(PacketError reason, const void* data, size_t dataLen) {
-        epicsTimeStamp s;
-        epicsTimeGetCurrent(&s);
-        m_entries.emplace_back(reason, data, dataLen, m_totalPackets, s);
-        ++m_errorPackets;
-        ++m_totalPackets;
+    void report_kernel_drops(uint64_t count) {
+        m_kernelDrops += count;
+    }
+
+    /**
+     * Report datagrams received but dropped by our own pipeline because it fell behind
+     */
+    void report_pipeline_drops(uint64_t count) {
+        m_pipelineDrops += count;
+    }
+
+    /**
+     * Report datagrams rejected by the socket filter in the kernel, and packets rejected by the filters in the decode
+     * stage. The kernel counts datagrams it dropped for a full receive buffer as filtered too
+     */
+    void report_filtered(uint64_t kernel, uint64_t user) {
+        m_kernelFiltered += kernel;
+        m_userFiltered += user;
     }
 
-    void serialize(std::ofstream& stream);
+    /**
+     * Report the checks a packet failed, a mask of failed_check bits. A packet may fail several
+     */
+    void report_failed_checks(uint32_t failed) {
+        for (unsigned i = 0; i < NUM_PACKET_ERRORS; ++i)
+            m_failedChecks[i] += (failed >> i) & 1;
+    }
+
+    /**
+     * Report an invalid packet with a reason
+     * \param recvTime Receive time of the packet in ns since the Unix epoch
+     * \param source Sender of the packet, see source_key
+     */
+    void report_packet_error(PacketError reason, const void* data, size_t dataLen, uint64_t recvTime, uint64_t source);
+
+    /**
+     * \brief Write the entries that were not streamed as they were stored (kept last, or merged from another report),
+     * followed by the summary
+     */
+    void serialize(ReportWriter& writer);
+
+    /** Print the packet, error and drop totals, the failures of each check, then the packets and errors of each sender */
+    void print_stats(FILE* fp) const;
+
+    /**
+     * \brief Move all entries and counters from another report into this one.
+     * Entries are kept in the order they were received in, then this report's retention policies are applied
+     * to the combined entries. Used to combine per-thread report shards.
+     */
+    void merge(Report& other);
+
+    /**
+     * \brief Include the per-sender loss counters of a tracker in the serialized report
+     */
+    inline void set_loss_tracker(LossTracker* tracker) { m_loss = tracker; }
+
+    /**
+     * \brief Include the latency percentiles of a tracker in the serialized report
+     */
+    inline void set_latency_tracker(LatencyTracker* tracker) { m_latency = tracker; }
+
+    /**
+     * \brief Stream the entries of reasons that keep their first errors to a writer as they are stored.
+     * Those entries can't be replaced later, so the report file holds them even if the process dies
+     */
+    inline void set_writer(ReportWriter* writer) { m_writer = writer; }
 
 private:
-    std::list<ReportEntry> m_entries;
+    struct SourceCounters {
+        uint64_t packets = 0;
+        uint64_t errors[NUM_PACKET_ERRORS] = {};    // Indexed by PacketError
+    };
+
+    struct Ring {
+        RetentionPolicy policy;
+        ReportEntry* entries;       // policy.limit entries
+        unsigned count = 0;         // Entries in use
+        unsigned next = 0;          // Entry written next in KeepLast mode
+        uint64_t dropped = 0;       // Errors counted but not stored
+    };
+
+    /** \returns The entry to store the next error of a reason in, or nullptr if its retention policy drops it */
+    ReportEntry* claim_entry(PacketError reason);
+    void store_entry(ReportEntry& entry, PacketError reason, const void* data, size_t dataLen, size_t capturedLen,
+        uint64_t index, uint64_t recvTime, uint64_t source);
+
+    /** \returns The entries of every reason, in the order they were received */
+    std::vector<const ReportEntry*> sorted_entries() const;
+    void clear_entries();
+
+    ReportConfig m_config;
+    size_t m_slotSize;              // Arena bytes per entry
+    std::vector<uint8_t> m_arena;
+    std::vector<ReportEntry> m_entries;
+    Ring m_rings[NUM_PACKET_ERRORS];
     uint64_t m_totalPackets = 0;
     uint64_t m_errorPackets = 0;
+    uint64_t m_kernelDrops = 0;
+    uint64_t m_pipelineDrops = 0;
+    uint64_t m_kernelFiltered = 0;
+    uint64_t m_userFiltered = 0;
+    uint64_t m_failedChecks[NUM_PACKET_ERRORS] = {};    // Packets that failed each check, indexed by PacketError
+    SourceTable<SourceCounters> m_sources;
+    LossTracker* m_loss = nullptr;
+    LatencyTracker* m_latency = nullptr;
+    ReportWriter* m_writer = nullptr;
+};
+
+/**
+ * Writes a report incrementally as JSON Lines: one {"type": "error", ...} object per stored error packet, then a
+ * {"type": "summary", ...} object with the counters, one {"type": "source", ...} object with the packet and error
+ * counts of each sender and one {"type": "sender", ...} object per sender with its loss counters when the
+ * report is complete. Lines are formatted straight into one of two fixed buffers; a background thread swaps them
+ * and writes the full one out every flush interval, or sooner if it fills up. Safe to call from several threads.
+ */
+class ReportWriter {
+public:
+    /**
+     * \param path Report file, truncated when opened
+     * \param flushInterval Seconds between flushes of the buffered lines to the file
+     */
+    explicit ReportWriter(const std::string& path, double flushInterval = DEFAULT_REPORT_FLUSH);
+    ~ReportWriter();
+
+    ReportWriter(const ReportWriter&) = delete;
+    ReportWriter& operator=(const ReportWriter&) = delete;
+
+    /**
+     * \brief Create the report file and start the flush thread
+     * \returns false on failure, the reason has already been printed
+     */
+    bool open();
+
+    /**
+     * \brief Append one error line. Does not allocate
+     */
+    void write_entry(const ReportEntry& entry);
+
+    /**
+     * \brief Append preformatted lines, each terminated by a newline
+     */
+    void write_lines(const std::string& lines);
+
+    /**
+     * \brief Stop the flush thread and write out everything buffered
+     */
+    void close();
+
+    inline const std::string& path() const { return m_path; }
+
+private:
+    /** \returns Buffer space for len bytes. Flushes if the buffer is full, must be called with m_lock held */
+    char* reserve(std::unique_lock<std::mutex>& lock, size_t len);
+    void flush();
+    void flush_thread();
+
+    std::string m_path;
+    double m_flushInterval;
+    int m_fd = -1;
+    bool m_failed = false;          // A write failed, the report is incomplete
+
+    std::mutex m_lock;              // Protects m_buffer, m_used and m_stop
+    std::condition_variable m_wake;
+    std::vector<char> m_buffer;     // Lines being appended
+    size_t m_used = 0;
+    bool m_stop = false;
+
+    std::mutex m_writeLock;         // Held while m_spare is written to the file
+    std::vector<char> m_spare;      // Lines being written
+    std::thread m_thread;
 };
@@ -0,0 +1,92 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'bldDecode'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'bldDecode', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <vector>
+
+/** Assumed cache line size, used to keep cursors owned by different threads on separate lines */
+#define CACHE_LINE_SIZE 64
+
+/**
+ * Lock-free ring of preallocated elements passed through a fixed chain of stages.
+ * Each stage is run by exactly one thread and owns exactly one cursor, so every hop between two
+ * stages is a single-producer/single-consumer queue over the same storage and no element is ever copied.
+ *
+ * Stage 0 produces elements, stage N consumes the elements released by stage N-1, and the last stage
+ * hands the slots back to stage 0. With two stages this is a plain SPSC ring.
+ */
+template<class T, unsigned NStages>
+class SpscRing {
+    static_assert(NStages >= 2, "A ring needs at least a producer and a consumer");
+public:
+    /**
+     * \param capacity Number of elements, must be a power of two
+     */
+    explicit SpscRing(size_t capacity) :
+        m_elements(capacity),
+        m_mask(capacity - 1)
+    {
+        assert(capacity && (capacity & (capacity - 1)) == 0);
+        for (auto& c : m_cursors)
+            c.value.store(0, std::memory_order_relaxed);
+    }
+
+    SpscRing(const SpscRing&) = delete;
+    SpscRing& operator=(const SpscRing&) = delete;
+
+    inline size_t capacity() const { return m_elements.size(); }
+
+    /**
+     * \brief Number of elements ready for a stage. For stage 0 this is the number of free slots.
+     * Must only be called from the thread running that stage.
+     */
+    inline size_t available(unsigned stage) const {
+        const uint64_t own = m_cursors[stage].value.load(std::memory_order_relaxed);
+        if (stage == 0)
+            return capacity() - (own - m_cursors[NStages-1].value.load(std::memory_order_acquire));
+        return m_cursors[stage-1].value.load(std::memory_order_acquire) - own;
+    }
+
+    /**
+     * \brief Returns the i'th element ready for a stage. i must be less than available(stage)
+     */
+    inline T& at(unsigned stage, size_t i) {
+        return m_elements[(m_cursors[stage].value.load(std::memory_order_relaxed) + i) & m_mask];
+    }
+
+    /**
+     * \brief Hand the next n elements from a stage to the following one
+     */
+    inline void advance(unsigned stage, size_t n) {
+        m_cursors[stage].value.store(m_cursors[stage].value.load(std::memory_order_relaxed) + n, std::memory_order_release);
+    }
+
+    /**
+     * \brief Number of elements queued between the previous stage and this one. Safe to call from any thread.
+     */
+    inline size_t depth(unsigned stage) const {
+        assert(stage > 0);
+        return m_cursors[stage-1].value.load(std::memory_order_relaxed) - m_cursors[stage].value.load(std::memory_order_relaxed);
+    }
+
+private:
+    // Padded rather than aligned, over-aligned new is not available before C++17
+    struct Cursor {
+        std::atomic<uint64_t> value;
+        char pad[CACHE_LINE_SIZE - sizeof(std::atomic<uint64_t>)];
+    };
+
+    Cursor m_cursors[NStages];
+    std::vector<T> m_elements;
+    size_t m_mask;
+};
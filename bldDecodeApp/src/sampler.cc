@@ -0,0 +1,239 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'bldDecode'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'bldDecode', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+#include "sampler.h"
+#include "stream.h"
+#include "util.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+/* BLD timestamps (seconds << 32 | nanoseconds) in plain nanoseconds, for differences */
+static inline uint64_t bld_ts_to_ns(uint64_t ts) {
+    return (ts >> 32) * 1000000000ull + (ts & 0xFFFFFFFF);
+}
+
+static bool parse_count(const char* str, const char* what, uint64_t& value) {
+    char* end;
+    value = strtoull(str, &end, num_str_base(str));
+    if (end == str || *end || value == 0) {
+        printf("Invalid %s '%s', must be a positive integer\n", what, str);
+        return false;
+    }
+    return true;
+}
+
+bool parse_sampling(const char* str, SamplingConfig& config) {
+    char buf[512];
+    strcpy_safe(buf, str);
+
+    config.selectors.clear();
+    char* save;
+    for (char* s = strtok_r(buf, ", ", &save); s; s = strtok_r(nullptr, ", ", &save)) {
+        if (!config.selectors.empty() && config.selectors.back().kind == SampleSelector::Kind::Reservoir) {
+            printf("Invalid sampling '%s', a reservoir must be the last stage\n", str);
+            return false;
+        }
+
+        char* args[3] = {};
+        int nargs = 0;
+        for (char* p = s; p && nargs < 3; ++nargs) {
+            args[nargs] = p;
+            if ((p = strchr(p, ':')))
+                *p++ = 0;
+        }
+
+        SampleSelector sel;
+        if (!strcmp(args[0], "every") && nargs == 2) {
+            sel.kind = SampleSelector::Kind::Every;
+            if (!parse_count(args[1], "sampling interval", sel.n))
+                return false;
+        }
+        else if (!strcmp(args[0], "pulse") && nargs == 3) {
+            sel.kind = SampleSelector::Kind::PulseModulo;
+            if (!parse_count(args[1], "pulse ID modulus", sel.n))
+                return false;
+            sel.k = strtoull(args[2], NULL, num_str_base(args[2]));
+            if (sel.k >= sel.n) {
+                printf("Invalid pulse ID remainder %s, must be less than %lu\n", args[2], sel.n);
+                return false;
+            }
+        }
+        else if (!strcmp(args[0], "rate") && nargs == 2) {
+            sel.kind = SampleSelector::Kind::Rate;
+            sel.rate = strtod(args[1], NULL);
+            if (!(sel.rate > 0)) {
+                printf("Invalid sampling rate %s\n", args[1]);
+                return false;
+            }
+        }
+        else if (!strcmp(args[0], "reservoir") && nargs == 3) {
+            sel.kind = SampleSelector::Kind::Reservoir;
+            if (!parse_count(args[1], "reservoir size", sel.n))
+                return false;
+            sel.window = strtod(args[2], NULL);
+            if (!(sel.window > 0)) {
+                printf("Invalid reservoir window %s\n", args[2]);
+                return false;
+            }
+        }
+        else {
+            printf("Invalid sampling stage '%s', expected every:<n>, pulse:<n>:<k>, rate:<events/s> or reservoir:<n>:<seconds>\n", args[0]);
+            return false;
+        }
+        config.selectors.push_back(sel);
+    }
+    if (config.selectors.empty()) {
+        printf("Invalid sampling '%s', no stages given\n", str);
+        return false;
+    }
+    return true;
+}
+
+EventSampler::EventSampler(const BldStream& stream, const SamplingConfig& config) :
+    m_stream(stream)
+{
+    for (const auto& sel : config.selectors) {
+        Stage stage;
+        stage.selector = sel;
+        if (sel.kind == SampleSelector::Kind::Rate)
+            stage.interval = uint64_t(1e9 / sel.rate);
+        if (sel.kind == SampleSelector::Kind::Reservoir) {
+            m_held[0].resize(sel.n);
+            m_held[1].resize(sel.n);
+        }
+        m_stages.push_back(stage);
+    }
+}
+
+bool EventSampler::select(const StreamLayout& layout, const BldPacketView& packet, const BldEvent& event, EmitFn emit) {
+    std::lock_guard<std::mutex> lock(m_lock);
+    for (auto& stage : m_stages) {
+        if (!select_stage(stage, layout, packet, event, emit))
+            return false;
+    }
+    return true;
+}
+
+bool EventSampler::select_stage(Stage& stage, const StreamLayout& layout, const BldPacketView& packet,
+    const BldEvent& event, EmitFn emit) {
+    const SampleSelector& sel = stage.selector;
+    bool selected = false;
+
+    switch (sel.kind) {
+    case SampleSelector::Kind::Every:
+        selected = stage.count++ % sel.n == 0;
+        break;
+    case SampleSelector::Kind::PulseModulo:
+        selected = event.pulseID % sel.n == sel.k;
+        break;
+    case SampleSelector::Kind::Rate: {
+        // A timestamp more than an interval in the past means the sender restarted or the clock stepped back
+        const uint64_t t = bld_ts_to_ns(event.timeStamp);
+        selected = t >= stage.next || stage.next - t > stage.interval;
+        if (selected)
+            stage.next = t + stage.interval;
+        break;
+    }
+    case SampleSelector::Kind::Reservoir: {
+        const uint64_t window = uint64_t(sel.window * 1e9);
+        const uint64_t t = bld_ts_to_ns(event.timeStamp);
+        if (stage.windowEnd && (t >= stage.windowEnd || stage.windowEnd - t > window))
+            emit_held(stage, emit);
+        if (!stage.windowEnd)
+            stage.windowEnd = (t / window + 1) * window;
+
+        // Algorithm R: the first n events fill the reservoir, then event i replaces a random one with probability n/i
+        const uint64_t i = stage.seen++;
+        if (i < sel.n)
+            hold(m_held[m_open][i], layout, packet, event);
+        else {
+            const uint64_t j = random() % (i + 1);
+            if (j < sel.n)
+                hold(m_held[m_open][j], layout, packet, event);
+        }
+        // Selected or skipped once the window closes
+        return false;
+    }
+    }
+
+    if (selected)
+        ++stage.selected;
+    else
+        ++stage.skipped;
+    return selected;
+}
+
+void EventSampler::hold(HeldEvent& slot, const StreamLayout& layout, const BldPacketView& packet, const BldEvent& event) {
+    slot.event = event;
+    slot.layout = &layout;
+    slot.event.payloadSize = std::min(event.payloadSize, sizeof(slot.payload));
+    memcpy(slot.header, packet.data(), sizeof(slot.header));
+    memcpy(slot.payload, event.payload, slot.event.payloadSize);
+}
+
+void EventSampler::emit_held(Stage& stage, EmitFn emit) {
+    std::vector<HeldEvent>& held = m_held[m_open];
+    const size_t count = std::min(stage.seen, stage.selector.n);
+    std::sort(held.begin(), held.begin() + count, [](const HeldEvent& a, const HeldEvent& b) {
+        return a.event.pulseID < b.event.pulseID;
+    });
+
+    // The next window fills the other reservoir, so these stay valid until the caller has committed them
+    m_open ^= 1;
+    stage.selected += count;
+    stage.skipped += stage.seen - count;
+    stage.seen = 0;
+    stage.windowEnd = 0;
+
+    for (size_t i = 0; i < count; ++i) {
+        BldEvent event = held[i].event;
+        event.payload = held[i].payload;
+        emit(m_stream, *held[i].layout, BldPacketView(held[i].header, sizeof(held[i].header), 0), event);
+    }
+}
+
+void EventSampler::flush(EmitFn emit) {
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (!m_stages.empty() && m_stages.back().seen > 0)
+        emit_held(m_stages.back(), emit);
+}
+
+inline uint64_t EventSampler::random() {
+    // xorshift64*
+    m_rng ^= m_rng >> 12;
+    m_rng ^= m_rng << 25;
+    m_rng ^= m_rng >> 27;
+    return m_rng * 0x2545F4914F6CDD1Dull;
+}
+
+void EventSampler::print_stats(FILE* fp) {
+    std::lock_guard<std::mutex> lock(m_lock);
+    for (const auto& stage : m_stages) {
+        const SampleSelector& sel = stage.selector;
+        char desc[64];
+        switch (sel.kind) {
+        case SampleSelector::Kind::Every:
+            snprintf(desc, sizeof(desc), "every %lu", sel.n);
+            break;
+        case SampleSelector::Kind::PulseModulo:
+            snprintf(desc, sizeof(desc), "pulse ID %% %lu == %lu", sel.n, sel.k);
+            break;
+        case SampleSelector::Kind::Rate:
+            snprintf(desc, sizeof(desc), "at most %g/s", sel.rate);
+            break;
+        case SampleSelector::Kind::Reservoir:
+            snprintf(desc, sizeof(desc), "reservoir of %lu per %g s", sel.n, sel.window);
+            break;
+        }
+        fprintf(fp, "Sampling%s%s, %s: %lu selected, %lu skipped\n", m_stream.name.empty() ? "" : " ",
+            m_stream.name.c_str(), desc, stage.selected, stage.skipped);
+    }
+}
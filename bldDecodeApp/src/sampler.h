@@ -0,0 +1,123 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'bldDecode'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'bldDecode', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+#include <mutex>
+
+#include "bld-proto.h"
+#include "packet.h"
+
+struct BldStream;
+struct StreamLayout;
+
+/**
+ * One stage of event sampling. Stages are applied in order, each only sees the events the previous ones selected
+ */
+struct SampleSelector {
+    enum class Kind {
+        Every,          // Every nth event
+        PulseModulo,    // Events whose pulse ID modulo n is k
+        Rate,           // At most rate events per second of BLD time
+        Reservoir,      // A uniform random sample of n events per window seconds of BLD time
+    };
+
+    Kind kind;
+    uint64_t n = 1;
+    uint64_t k = 0;
+    double rate = 0;
+    double window = 0;
+};
+
+/**
+ * Event sampling settings
+ */
+struct SamplingConfig {
+    std::vector<SampleSelector> selectors;
+};
+
+/**
+ * \brief Parse a list of sampling stages, '<stage>[,<stage>...]' with each stage one of 'every:<n>',
+ * 'pulse:<n>:<k>', 'rate:<events per second>' or 'reservoir:<n>:<seconds>'. A reservoir must be the last stage
+ * \returns false if the list is invalid. The reason has already been printed
+ */
+bool parse_sampling(const char* str, SamplingConfig& config);
+
+/**
+ * Selects the events of one stream that are output, in O(1) per event and without allocating. Events are only
+ * formatted once selected, so a sparse sample of a high-rate stream costs little more than receiving it.
+ *
+ * A reservoir stage holds its sample until the window closes, then hands it to the emit callback ordered by pulse ID.
+ * The events are copied, and stay valid until the window after that closes, so they can be queued for export and
+ * statistics just like events of the packet being output. The windows are timed by the BLD timestamps of the events.
+ * Safe to call from several output threads at once.
+ */
+class EventSampler {
+public:
+    typedef void (*EmitFn)(const BldStream& stream, const StreamLayout& layout, const BldPacketView& packet,
+        const BldEvent& event);
+
+    EventSampler(const BldStream& stream, const SamplingConfig& config);
+
+    EventSampler(const EventSampler&) = delete;
+    EventSampler& operator=(const EventSampler&) = delete;
+
+    /**
+     * \brief Run an event through the sampling stages
+     * \param layout Layout the packet is decoded against, held events are emitted with theirs
+     * \param emit Called with the sample of a reservoir window that just closed
+     * \returns True if the event is selected for output now
+     */
+    bool select(const StreamLayout& layout, const BldPacketView& packet, const BldEvent& event, EmitFn emit);
+
+    /**
+     * \brief Emit the sample of the reservoir window still open, i.e. on exit
+     */
+    void flush(EmitFn emit);
+
+    void print_stats(FILE* fp);
+
+private:
+    /**
+     * An event held by a reservoir, with its payload and enough of the packet header to print it
+     */
+    struct HeldEvent {
+        BldEvent event;
+        const StreamLayout* layout;
+        uint8_t header[bldMulticastPacketHeaderSize];
+        uint8_t payload[BLD_MAX_PAYLOAD_SIZE];
+    };
+
+    struct Stage {
+        SampleSelector selector;
+        uint64_t selected = 0;
+        uint64_t skipped = 0;
+        uint64_t count = 0;                 // Events seen by an Every stage
+        uint64_t interval = 0;              // Rate stage: ns between selected events
+        uint64_t next = 0;                  // Rate stage: BLD time the next event may be selected at, in ns
+        uint64_t windowEnd = 0;             // Reservoir stage: BLD time the window closes at, in ns
+        uint64_t seen = 0;                  // Reservoir stage: events seen in the window
+    };
+
+    bool select_stage(Stage& stage, const StreamLayout& layout, const BldPacketView& packet, const BldEvent& event,
+        EmitFn emit);
+    void hold(HeldEvent& slot, const StreamLayout& layout, const BldPacketView& packet, const BldEvent& event);
+    void emit_held(Stage& stage, EmitFn emit);
+    inline uint64_t random();
+
+    const BldStream& m_stream;
+    std::mutex m_lock;
+    std::vector<Stage> m_stages;
+    std::vector<HeldEvent> m_held[2];       // Reservoir of the open window, and the sample emitted last
+    unsigned m_open = 0;                    // Index of the open window's reservoir
+    uint64_t m_rng = 0x9E3779B97F4A7C15ull;
+};
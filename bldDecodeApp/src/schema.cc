@@ -0,0 +1,226 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'bldDecode'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'bldDecode', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+#include "schema.h"
+#include "decode.h"
+#include "util.h"
+
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/stat.h>
+
+size_t channel_width(ChannelType type) {
+    switch (type) {
+    case ChannelType::Int64:
+    case ChannelType::UInt64:
+    case ChannelType::Float64:
+        return sizeof(uint64_t);
+    default:
+        return BLD_CHANNEL_SIZE;
+    }
+}
+
+/* Default labels for the channels without one, every channel that can be selected has a label */
+static void pad_labels(std::vector<std::string>& labels) {
+    for (int i = labels.size(); i < NUM_BLD_CHANNELS; ++i) {
+        char ch[128];
+        snprintf(ch, sizeof(ch), "ch%02d", i);
+        labels.push_back(ch);
+    }
+}
+
+PayloadSchema::PayloadSchema() {
+    for (size_t i = 0; i < arrayLength(remap); ++i)
+        remap[i] = i;
+
+    pad_labels(labels);
+    compute_offsets();
+}
+
+void PayloadSchema::compute_offsets() {
+    offsets[0] = 0;
+    for (int i = 0; i < NUM_BLD_CHANNELS; ++i)
+        offsets[i + 1] = offsets[i] + (size_t(i) < formats.size() ? channel_width(formats[i]) : BLD_CHANNEL_SIZE);
+}
+
+bool parse_channel_formats(const char* str, PayloadSchema& schema) {
+    char buf[512];
+    strcpy_safe(buf, str);
+
+    std::vector<ChannelType> fmt;
+    for (char* s = strtok(buf, ", "); s; s = strtok(nullptr, ", ")) {
+        switch(*s) {
+        case 'f':
+            fmt.push_back(ChannelType::Float32);
+            break;
+        case 'i':
+            fmt.push_back(ChannelType::Int32);
+            break;
+        case 'u':
+            fmt.push_back(ChannelType::UInt32);
+            break;
+        case 'd':
+            fmt.push_back(ChannelType::Float64);
+            break;
+        case 'l':
+            fmt.push_back(ChannelType::Int64);
+            break;
+        case 'U':
+            fmt.push_back(ChannelType::UInt64);
+            break;
+        default:
+            printf("Unknown format '%c'! Valid types are 'f', 'i', 'u', 'd', 'l' and 'U'", *s);
+            return false;
+        }
+    }
+    if (fmt.size() > NUM_BLD_CHANNELS) {
+        printf("Too many channels in format, at most %d are supported", NUM_BLD_CHANNELS);
+        return false;
+    }
+    schema.numChannels = fmt.size();
+    schema.formats = fmt;
+    schema.compute_offsets();
+    return true;
+}
+
+bool schema_from_value(const pvxs::Value& result, const char* pvName, PayloadSchema& schema) {
+    using namespace pvxs;
+
+    if (result.type() != TypeCode::Struct) {
+        printf("Payload PV '%s' is not of the expected type 'Struct'\n", pvName);
+        return false;
+    }
+
+    auto structure = result["BldPayload"];
+    if (!structure.valid()) {
+        printf("Payload PV '%s' contains no 'BldPayload' field\n", pvName);
+        return false;
+    }
+
+    schema.labels.clear();
+
+    std::vector<ChannelType> format;
+    int i = 0, chi = 0;
+    for (auto ch : structure.ichildren()) {
+        if (i == NUM_BLD_CHANNELS) {
+            printf("Payload PV '%s' has more than %d channels\n", pvName, NUM_BLD_CHANNELS);
+            return false;
+        }
+        format.push_back(ch.type().code);
+
+        // Store label for display
+        schema.labels.push_back(structure.nameOf(ch));
+
+        // Store off remap
+        schema.remap[i] = chi++;
+        ++i;
+    }
+    pad_labels(schema.labels);
+    schema.numChannels = i;
+    schema.formats = format;
+    schema.compute_offsets();
+    return true;
+}
+
+bool same_payload(const PayloadSchema& a, const PayloadSchema& b) {
+    return a.numChannels == b.numChannels && a.formats == b.formats && a.labels == b.labels &&
+        std::equal(a.remap, a.remap + a.numChannels, b.remap);
+}
+
+std::string default_schema_cache_dir() {
+    const char* xdg = getenv("XDG_CACHE_HOME");
+    if (xdg && *xdg)
+        return std::string(xdg) + "/bldDecode";
+    const char* home = getenv("HOME");
+    return std::string(home ? home : ".") + "/.cache/bldDecode";
+}
+
+/* One file per PV, named after it. PV names don't contain '/', but don't let one escape the directory */
+static std::string cache_file(const std::string& dir, const std::string& pvName) {
+    std::string name = pvName;
+    std::replace(name.begin(), name.end(), '/', '_');
+    return dir + "/" + name + ".schema";
+}
+
+bool load_cached_schema(const std::string& dir, const std::string& pvName, PayloadSchema& schema) {
+    FILE* fp = fopen(cache_file(dir, pvName).c_str(), "r");
+    if (!fp)
+        return false;
+
+    // '<channels>' then '<format> <remap> <label>' per channel, formats as pvxs type codes
+    PayloadSchema cached;
+    cached.labels.clear();
+    int num = -1;
+    bool ok = fscanf(fp, "%d", &num) == 1 && num >= 0 && num <= NUM_BLD_CHANNELS;
+    for (int i = 0; ok && i < num; ++i) {
+        unsigned format;
+        char label[128];
+        // A corrupt entry is ignored and the PV read instead, rather than decoded with a type that can't be
+        ok = fscanf(fp, "%x %d %127s", &format, &cached.remap[i], label) == 3 &&
+            cached.remap[i] >= 0 && cached.remap[i] < NUM_BLD_CHANNELS &&
+            format <= 0xFF && value_kind(ChannelType(format)) != ValueKind::Unsupported;
+        cached.formats.push_back(ChannelType(format));
+        cached.labels.push_back(label);
+    }
+    fclose(fp);
+    if (!ok)
+        return false;
+
+    pad_labels(cached.labels);
+    cached.numChannels = num;
+    cached.compute_offsets();
+    schema = cached;
+    return true;
+}
+
+bool save_cached_schema(const std::string& dir, const std::string& pvName, const PayloadSchema& schema) {
+    // Create every missing directory on the way, like mkdir -p
+    for (size_t pos = dir.find('/', 1); ; pos = dir.find('/', pos + 1)) {
+        if (mkdir(dir.substr(0, pos).c_str(), 0755) < 0 && errno != EEXIST) {
+            printf("Unable to create schema cache directory %s: %s\n", dir.substr(0, pos).c_str(), strerror(errno));
+            return false;
+        }
+        if (pos == std::string::npos)
+            break;
+    }
+
+    // Write a temporary file and rename it over the entry, so a concurrent reader never sees half of one
+    const std::string path = cache_file(dir, pvName);
+    const std::string tmp = path + "." + std::to_string(getpid());
+    FILE* fp = fopen(tmp.c_str(), "w");
+    if (!fp) {
+        printf("Unable to write schema cache %s: %s\n", tmp.c_str(), strerror(errno));
+        return false;
+    }
+    fprintf(fp, "%d\n", schema.numChannels);
+    for (int i = 0; i < schema.numChannels; ++i)
+        fprintf(fp, "%x %d %s\n", unsigned(schema.formats[i]), schema.remap[i], schema.labels[i].c_str());
+    const bool ok = fclose(fp) == 0 && rename(tmp.c_str(), path.c_str()) == 0;
+    if (!ok) {
+        printf("Unable to write schema cache %s: %s\n", path.c_str(), strerror(errno));
+        unlink(tmp.c_str());
+    }
+    return ok;
+}
+
+void build_channel_list(PayloadSchema& schema, const std::vector<int>& channels) {
+    std::vector<int> chanList;
+
+    // Remap user-provided enabled channels to the ones specified by BLD_PAYLOAD
+    for (auto c : channels) {
+        assert(c >= 0 && c < NUM_BLD_CHANNELS);
+        chanList.push_back(schema.remap[c]);
+    }
+    schema.enabledChannels = chanList;
+}
@@ -0,0 +1,96 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'bldDecode'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'bldDecode', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "pvxs/client.h"
+#include "pvxs/data.h"
+
+#include "bld-proto.h"
+
+using ChannelType = pvxs::TypeCode::code_t;
+
+/**
+ * \returns Size of a channel on the wire, in bytes. 64-bit types take 8, everything else a 32-bit slot
+ */
+size_t channel_width(ChannelType type);
+
+/**
+ * Layout of a BLD payload and how to display it. Channels are packed back to back, so the byte offset of each one
+ * depends on the widths of those before it. The offsets are computed once, by compute_offsets()
+ */
+struct PayloadSchema {
+    PayloadSchema();
+
+    std::vector<ChannelType> formats;
+    std::vector<std::string> labels;   // NUM_BLD_CHANNELS labels, the channels beyond the payload keep their default
+    int remap[NUM_BLD_CHANNELS];        // Maps payload channels to their actual channel number
+    int numChannels = 0;
+    std::vector<int> enabledChannels;   // Channels to display, already remapped. Empty to display all
+    size_t offsets[NUM_BLD_CHANNELS + 1];   // Byte offset of each channel in the payload, the last entry is the end
+
+    /**
+     * \brief Compute the channel offsets from the formats. Must be called after changing formats or numChannels.
+     * Channels beyond the formats are 32 bits wide
+     */
+    void compute_offsets();
+
+    /** \returns Offset of a channel in the payload, in bytes */
+    inline size_t offset(int chan) const { return offsets[chan]; }
+
+    /** \returns Size of a channel in the payload, in bytes */
+    inline size_t width(int chan) const { return offsets[chan + 1] - offsets[chan]; }
+
+    /** \returns Size of the signal payload of each event, in bytes */
+    inline size_t payload_size() const { return offsets[numChannels]; }
+};
+
+/**
+ * \brief Parse a channel format string, such as 'f,u,i,d' for float, uint32, int32, double.
+ * 'l' and 'U' are int64 and uint64
+ * \returns false if the string contains an unknown format. The reason has already been printed
+ */
+bool parse_channel_formats(const char* str, PayloadSchema& schema);
+
+/**
+ * \brief Fill a schema from the value of a BLD_PAYLOAD PV
+ * \param pvName Name of the PV, used for error messages
+ * \returns false if the value is not a valid payload description. The reason has already been printed
+ */
+bool schema_from_value(const pvxs::Value& value, const char* pvName, PayloadSchema& schema);
+
+/**
+ * \returns True if two schemas describe the same payload: formats, labels and remap. The channel selection is ignored
+ */
+bool same_payload(const PayloadSchema& a, const PayloadSchema& b);
+
+/**
+ * \returns Directory the payload PV layouts are cached in: $XDG_CACHE_HOME/bldDecode, or ~/.cache/bldDecode
+ */
+std::string default_schema_cache_dir();
+
+/**
+ * \brief Fill a schema from the layout of a payload PV cached by a previous run
+ * \returns false if there's no cache entry for the PV, it can't be read or it holds a channel type that can't be decoded
+ */
+bool load_cached_schema(const std::string& dir, const std::string& pvName, PayloadSchema& schema);
+
+/**
+ * \brief Cache the layout of a payload PV, replacing the previous entry. The directory is created if needed
+ * \returns false if it can't be written. The reason has already been printed
+ */
+bool save_cached_schema(const std::string& dir, const std::string& pvName, const PayloadSchema& schema);
+
+/**
+ * \brief Resolve the user provided list of channels to display against the schema's remap table
+ */
+void build_channel_list(PayloadSchema& schema, const std::vector<int>& channels);
@@ -0,0 +1,131 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'bldDecode'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'bldDecode', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+#include "shard.h"
+
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+#include <signal.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+static std::mutex s_outputLock;
+
+ShardedReceiver::ShardedReceiver(const BldStream& stream, const SocketOptions& opts, unsigned numShards, unsigned batchSize, DecodeFn decode, OutputFn output,
+    const ReportConfig* reportConfig, bool serializeOutput) :
+    m_stream(stream),
+    m_decode(decode),
+    m_output(output),
+    m_serializeOutput(serializeOutput)
+{
+    SocketOptions shardOpts = opts;
+    shardOpts.reusePort = true;
+
+    const long numCpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    for (unsigned i = 0; i < numShards; ++i) {
+        std::unique_ptr<Shard> shard(new Shard(batchSize));
+        if (reportConfig)
+            shard->report.reset(new Report(*reportConfig));
+        shardOpts.shard = i;
+        shardOpts.numShards = numShards;
+        if ((shard->sockfd = open_bld_socket(shardOpts)) < 0)
+            exit(EXIT_FAILURE);
+
+        shard->cpu = numCpus > 0 ? i % numCpus : -1;
+        m_shards.push_back(std::move(shard));
+    }
+}
+
+void ShardedReceiver::run(int64_t numPackets) {
+    m_remaining = numPackets;
+
+    std::vector<std::thread> threads;
+    for (auto& shard : m_shards) {
+        Shard* s = shard.get();
+        threads.emplace_back([this, s]() { worker(*s); });
+
+        if (s->cpu >= 0) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(s->cpu, &set);
+            if (pthread_setaffinity_np(threads.back().native_handle(), sizeof(set), &set) != 0)
+                printf("Unable to pin shard to CPU %d\n", s->cpu);
+        }
+    }
+
+    for (auto& t : threads)
+        t.join();
+}
+
+void ShardedReceiver::worker(Shard& shard) {
+    // Signals are handled by the main thread only
+    sigset_t set;
+    sigfillset(&set);
+    pthread_sigmask(SIG_BLOCK, &set, nullptr);
+
+    Report* report = shard.report.get();
+
+    while (m_remaining > 0 && !stop_requested()) {
+        const int count = shard.receiver.receive(shard.sockfd);
+        if (count < 0) {
+            perror("recvmmsg failed");
+            exit(EXIT_FAILURE);
+        }
+        // Socket was shut down by the shard that received the last packet, or by request_stop()
+        if (count == 0)
+            break;
+
+        for (int i = 0; i < count; ++i) {
+            if (m_remaining.fetch_sub(1) <= 0)
+                break;
+
+            auto& slot = shard.receiver[i];
+            const DecodeResult result = m_decode(m_stream, shard.validator, slot);
+            if (m_serializeOutput) {
+                std::lock_guard<std::mutex> lock(s_outputLock);
+                m_output(m_stream, report, slot, result);
+            }
+            else {
+                m_output(m_stream, report, slot, result);
+            }
+            ++shard.packets;
+        }
+    }
+
+    // Wake up any shards still blocked in recvmmsg
+    for (auto& other : m_shards)
+        shutdown(other->sockfd, SHUT_RD);
+}
+
+void ShardedReceiver::set_report_writer(ReportWriter* writer) {
+    for (auto& shard : m_shards) {
+        if (shard->report)
+            shard->report->set_writer(writer);
+    }
+}
+
+void ShardedReceiver::merge_reports(Report& into) {
+    for (auto& shard : m_shards) {
+        if (shard->report)
+            into.merge(*shard->report);
+    }
+}
+
+void ShardedReceiver::print_stats(FILE* fp) const {
+    for (size_t i = 0; i < m_shards.size(); ++i) {
+        const Shard& shard = *m_shards[i];
+        fprintf(fp, "Shard %zu (cpu %d): %lu packets\n", i, shard.cpu, shard.packets.load());
+        if (shard.receiver.batch_size() > 1)
+            shard.receiver.stats().print(fp, shard.receiver.batch_size());
+    }
+}
@@ -0,0 +1,83 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'bldDecode'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'bldDecode', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+#include "net.h"
+#include "recv.h"
+#include "report.h"
+#include "stream.h"
+
+/**
+ * Receives on several sockets bound to the same port and group with SO_REUSEPORT, each served by its
+ * own worker thread pinned to a core. Every worker has its own validator and report shard, so workers
+ * share nothing on the hot path.
+ */
+class ShardedReceiver {
+public:
+    /**
+     * \param stream Stream received by every shard
+     * \param opts Socket settings shared by every shard. reusePort is forced on
+     * \param numShards Number of sockets and worker threads
+     * \param batchSize Maximum number of packets received per syscall, per shard
+     * \param decode Decode callback, called from the worker threads
+     * \param output Output callback, called from the worker threads
+     * \param reportConfig Settings of the report shard handed to the output callback by each worker, nullptr to not generate reports
+     * \param serializeOutput Serialize output callbacks across workers so packets are not interleaved on stdout
+     */
+    ShardedReceiver(const BldStream& stream, const SocketOptions& opts, unsigned numShards, unsigned batchSize, DecodeFn decode, OutputFn output,
+        const ReportConfig* reportConfig, bool serializeOutput);
+
+    ShardedReceiver(const ShardedReceiver&) = delete;
+    ShardedReceiver& operator=(const ShardedReceiver&) = delete;
+
+    /**
+     * \brief Run the workers until numPackets have been received across all shards
+     */
+    void run(int64_t numPackets);
+
+    /**
+     * \brief Stream the entries of every shard's report to a writer, see Report::set_writer()
+     */
+    void set_report_writer(ReportWriter* writer);
+
+    /**
+     * \brief Move every shard's report into a single report
+     */
+    void merge_reports(Report& into);
+
+    /** Print per-shard packet counts and batch statistics */
+    void print_stats(FILE* fp) const;
+
+private:
+    struct Shard {
+        explicit Shard(unsigned batchSize) : receiver(batchSize) {}
+
+        int sockfd = -1;
+        int cpu = -1;
+        BatchReceiver receiver;
+        PacketValidator validator;
+        std::unique_ptr<Report> report;     // Only in report mode
+        std::atomic<uint64_t> packets {0};
+    };
+
+    void worker(Shard& shard);
+
+    const BldStream& m_stream;
+    std::vector<std::unique_ptr<Shard>> m_shards;
+    DecodeFn m_decode;
+    OutputFn m_output;
+    bool m_serializeOutput;
+    std::atomic<int64_t> m_remaining {0};
+};
@@ -0,0 +1,28 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'bldDecode'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'bldDecode', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+#include "source.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <arpa/inet.h>
+
+size_t format_source(uint64_t key, char* buf, size_t len) {
+    in_addr addr;
+    addr.s_addr = uint32_t(key >> 16);
+    char ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &addr, ip, sizeof(ip));
+    const int n = snprintf(buf, len, "%s:%u", ip, ntohs(uint16_t(key)));
+    return n < 0 ? 0 : std::min(size_t(n), len - 1);
+}
+
+std::string source_name(uint64_t key) {
+    char buf[SOURCE_NAME_LENGTH];
+    return std::string(buf, format_source(key, buf, sizeof(buf)));
+}
@@ -0,0 +1,111 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'bldDecode'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'bldDecode', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <netinet/in.h>
+
+/** Senders tracked individually by a SourceTable, per table */
+#define MAX_SOURCES 256
+
+/** Length of the longest name format_source() produces, including the terminator */
+#define SOURCE_NAME_LENGTH (INET_ADDRSTRLEN + 6)
+
+/** \returns Key identifying the sender of a datagram: address << 16 | port, both in network byte order */
+inline uint64_t source_key(const sockaddr_in& addr) {
+    return (uint64_t(addr.sin_addr.s_addr) << 16) | addr.sin_port;
+}
+
+/**
+ * \brief Format a source key as '<address>:<port>'. Does not allocate
+ * \returns Length of the name
+ */
+size_t format_source(uint64_t key, char* buf, size_t len);
+
+/** \returns A source key as '<address>:<port>' */
+std::string source_name(uint64_t key);
+
+/**
+ * Per-sender state, in an open addressing hash table with linear probing. All entries are allocated up front, so
+ * looking up a sender never allocates, even the first time it is seen. Entries are stored densely in the order the
+ * senders were first seen, which is also the order they are iterated in. Senders beyond the capacity aren't added,
+ * the caller decides what to do with them. Not thread safe.
+ */
+template<class T>
+class SourceTable {
+public:
+    /**
+     * \param capacity Maximum number of senders. The hash table is kept at most half full
+     */
+    explicit SourceTable(unsigned capacity = MAX_SOURCES) :
+        m_keys(capacity),
+        m_values(capacity)
+    {
+        while ((1u << m_bits) < 2 * capacity)
+            ++m_bits;
+        m_slots.resize(size_t(1) << m_bits);
+    }
+
+    /**
+     * \returns The entry of a sender, default constructed the first time it is seen. nullptr if the table is full
+     */
+    T* find_or_add(uint64_t key) {
+        // Most sockets only ever hear from one sender
+        if (m_size && m_keys[m_last] == key)
+            return &m_values[m_last];
+
+        const size_t mask = m_slots.size() - 1;
+        for (size_t slot = hash(key); ; slot = (slot + 1) & mask) {
+            const uint32_t index = m_slots[slot];
+            if (index == 0) {
+                if (m_size == m_keys.size()) {
+                    ++m_overflowed;
+                    return nullptr;
+                }
+                m_keys[m_size] = key;
+                m_slots[slot] = uint32_t(++m_size);
+                m_last = m_size - 1;
+                return &m_values[m_last];
+            }
+            if (m_keys[index - 1] == key) {
+                m_last = index - 1;
+                return &m_values[m_last];
+            }
+        }
+    }
+
+    /** \returns Number of senders in the table */
+    inline size_t size() const { return m_size; }
+
+    // Entry i in the order the senders were first seen, i must be less than size()
+    inline uint64_t key(size_t i) const { return m_keys[i]; }
+    inline T& value(size_t i) { return m_values[i]; }
+    inline const T& value(size_t i) const { return m_values[i]; }
+
+    /** \returns Lookups of senders that didn't fit in the table */
+    inline uint64_t overflowed() const { return m_overflowed; }
+
+private:
+    inline size_t hash(uint64_t key) const {
+        // Fibonacci hashing, the top bits of the product mix every bit of the key
+        return size_t((key * 0x9E3779B97F4A7C15ull) >> (64 - m_bits));
+    }
+
+    unsigned m_bits = 1;
+    std::vector<uint32_t> m_slots;          // Index + 1 of the entry in each slot, 0 if the slot is free
+    std::vector<uint64_t> m_keys;
+    std::vector<T> m_values;
+    size_t m_size = 0;
+    size_t m_last = 0;                      // Entry found by the last lookup
+    uint64_t m_overflowed = 0;
+};
@@ -0,0 +1,273 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'bldDecode'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'bldDecode', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+#include "stats.h"
+#include "stream.h"
+#include "util.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+
+bool parse_stats_interval(const char* str, StatsConfig& config) {
+    char* end;
+    config.interval = strtod(str, &end);
+    config.pulses = *end == 'p';
+    if (config.pulses)
+        ++end;
+    else if (*end == 's')
+        ++end;
+
+    if (*end != 0 || !(config.interval > 0)) {
+        printf("Invalid statistics interval '%s', expected seconds (i.e. '5') or pulses (i.e. '1000p')\n", str);
+        return false;
+    }
+    return true;
+}
+
+bool parse_histogram_range(const char* str, StatsConfig& config) {
+    char* end;
+    config.histMin = strtod(str, &end);
+    if (*end == ':')
+        config.histMax = strtod(end + 1, &end);
+    if (*end == ':')
+        config.bins = strtoul(end + 1, &end, 10);
+
+    if (*end != 0 || !(config.histMax > config.histMin) || config.bins < 1 || config.bins > MAX_HISTOGRAM_BINS) {
+        printf("Invalid histogram range '%s', expected '<min>:<max>[:<bins>]' with up to %d bins\n", str, MAX_HISTOGRAM_BINS);
+        return false;
+    }
+    config.fixedRange = true;
+    return true;
+}
+
+ChannelStatistics::ChannelStatistics(const BldStream& stream, const StatsConfig& config) :
+    m_stream(stream),
+    m_config(config),
+    m_batch(new EventBatch(0, 0, STATS_BATCH_SIZE)),
+    m_values(STATS_BATCH_SIZE)
+{
+    reset();
+}
+
+void ChannelStatistics::reset() {
+    for (auto& acc : m_acc) {
+        memset(&acc, 0, sizeof(acc));
+        acc.min = INFINITY;
+        acc.max = -INFINITY;
+    }
+    m_events = 0;
+}
+
+void ChannelStatistics::relayout(const StreamLayout& layout) {
+    print_locked(stdout);
+    m_layout = &layout;
+    m_batch.reset(new EventBatch(layout.schema.payload_size() / BLD_CHANNEL_SIZE, layout.schema.numChannels, STATS_BATCH_SIZE));
+    m_acc.resize(layout.plan.size());
+
+    // Channels may have moved or changed units, a range taken from the values is taken again
+    HistogramRange range;
+    range.set = m_config.fixedRange;
+    range.min = m_config.histMin;
+    range.scale = m_config.fixedRange ? m_config.bins / (m_config.histMax - m_config.histMin) : 0;
+    m_ranges.assign(layout.plan.size(), range);
+    reset();
+}
+
+void ChannelStatistics::add(const StreamLayout& layout, const BldEvent& event) {
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (&layout != m_layout)
+        relayout(layout);
+
+    // Pending events belong to packets still being output, so their payloads are valid until commit()
+    if (m_batch->full())
+        fold();
+    m_batch->add(event);
+}
+
+void ChannelStatistics::commit(FILE* fp) {
+    std::lock_guard<std::mutex> lock(m_lock);
+    fold();
+
+    if (m_events == 0)
+        return;
+
+    const double elapsed = m_config.pulses ? double(m_lastPulse - m_firstPulse) : double((m_lastTime >> 32) - (m_firstTime >> 32));
+    if (elapsed >= m_config.interval) {
+        m_lock.unlock();
+        print_summary(fp);
+        m_lock.lock();
+    }
+}
+
+void ChannelStatistics::fold() {
+    m_batch->commit();
+    const size_t n = m_batch->size();
+    if (n == 0)
+        return;
+
+    if (m_events == 0) {
+        m_firstPulse = m_batch->pulse_ids()[0];
+        m_firstTime = m_batch->time_stamps()[0];
+    }
+    m_lastPulse = m_batch->pulse_ids()[n - 1];
+    m_lastTime = m_batch->time_stamps()[n - 1];
+    m_events += n;
+
+    for (unsigned pos = 0; pos < m_acc.size(); ++pos)
+        fold_channel(pos, n);
+
+    m_batch->clear();
+}
+
+void ChannelStatistics::fold_channel(unsigned pos, size_t n) {
+    const unsigned chan = m_layout->plan.channel(pos);
+    if (chan >= m_batch->num_channels())
+        return; // Selected, but not in the payload
+    Accumulator& acc = m_acc[pos];
+    const unsigned word = m_layout->plan.offset(pos) / BLD_CHANNEL_SIZE;
+
+    const uint8_t* sevr = m_batch->severities(chan);
+    for (size_t i = 0; i < n; ++i)
+        ++acc.sevr[sevr[i]];
+
+    // Convert the whole column at once, the type is only looked at once per batch
+    double* v = m_values.data();
+    switch (m_layout->plan.kind(pos)) {
+    case ValueKind::Float32: {
+        const alias_float* src = m_batch->floats(word);
+        for (size_t i = 0; i < n; ++i)
+            v[i] = src[i];
+        break;
+    }
+    case ValueKind::Int32: {
+        const alias_int32* src = m_batch->ints(word);
+        for (size_t i = 0; i < n; ++i)
+            v[i] = src[i];
+        break;
+    }
+    case ValueKind::UInt32: {
+        const uint32_t* src = m_batch->uints(word);
+        for (size_t i = 0; i < n; ++i)
+            v[i] = src[i];
+        break;
+    }
+    // 64-bit channels span two word columns
+    case ValueKind::Float64:
+        for (size_t i = 0; i < n; ++i) {
+            const uint64_t raw = m_batch->wide(word, i);
+            memcpy(&v[i], &raw, sizeof(raw));
+        }
+        break;
+    case ValueKind::Int64:
+        for (size_t i = 0; i < n; ++i)
+            v[i] = double(int64_t(m_batch->wide(word, i)));
+        break;
+    case ValueKind::UInt64:
+        for (size_t i = 0; i < n; ++i)
+            v[i] = double(m_batch->wide(word, i));
+        break;
+    default:
+        return;
+    }
+
+    // Moments of this batch
+    size_t count = 0;
+    double sum = 0, min = INFINITY, max = -INFINITY;
+    for (size_t i = 0; i < n; ++i) {
+        if (!std::isfinite(v[i])) {
+            ++acc.nonFinite;
+            continue;
+        }
+        v[count++] = v[i];
+        sum += v[i];
+        min = std::min(min, v[i]);
+        max = std::max(max, v[i]);
+    }
+    if (count == 0)
+        return;
+
+    const double mean = sum / count;
+    double m2 = 0;
+    for (size_t i = 0; i < count; ++i)
+        m2 += (v[i] - mean) * (v[i] - mean);
+
+    // Merge into the running moments (Chan et al.)
+    const double total = double(acc.count + count);
+    const double delta = mean - acc.mean;
+    acc.mean += delta * count / total;
+    acc.m2 += m2 + delta * delta * acc.count * count / total;
+    acc.count += count;
+    acc.min = std::min(acc.min, min);
+    acc.max = std::max(acc.max, max);
+
+    // Without a fixed range, the histogram covers the range of the first values seen on this channel
+    HistogramRange& range = m_ranges[pos];
+    if (!range.set) {
+        range.min = min;
+        range.scale = m_config.bins / (max > min ? max - min : 1.0);
+        range.set = true;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        const double b = (v[i] - range.min) * range.scale;
+        const size_t bin = b < 0 ? 0 : b >= m_config.bins ? m_config.bins + 1 : size_t(b) + 1;
+        ++acc.hist[bin];
+    }
+}
+
+void ChannelStatistics::print_summary(FILE* fp) {
+    std::lock_guard<std::mutex> lock(m_lock);
+    print_locked(fp);
+}
+
+void ChannelStatistics::print_locked(FILE* fp) {
+    fold();
+    if (m_events == 0)
+        return;
+
+    uint32_t sec, nsec;
+    extract_ts(m_lastTime, sec, nsec);
+
+    fprintf(fp, "====== Statistics%s%s: %lu events, pulse ID 0x%lX-0x%lX (%s) ======\n",
+        m_stream.name.empty() ? "" : " for ", m_stream.name.c_str(), m_events, m_firstPulse, m_lastPulse, format_ts(sec, nsec).c_str());
+    fprintf(fp, "%-16s %10s %14s %14s %14s %14s %8s %8s %8s %8s\n",
+        "channel", "count", "mean", "std", "min", "max", "None", "Minor", "Major", "Invalid");
+
+    for (unsigned pos = 0; pos < m_acc.size(); ++pos) {
+        const unsigned chan = m_layout->plan.channel(pos);
+        if (chan >= m_batch->num_channels())
+            continue; // Selected, but not in the payload
+        const Accumulator& acc = m_acc[pos];
+        const HistogramRange& range = m_ranges[pos];
+        const char* label = m_layout->schema.labels[chan].c_str();
+        if (acc.count == 0) {
+            fprintf(fp, "%-16s %10s %14s %14s %14s %14s %8lu %8lu %8lu %8lu\n", label, "0", "-", "-", "-", "-",
+                acc.sevr[0], acc.sevr[1], acc.sevr[2], acc.sevr[3]);
+            continue;
+        }
+        fprintf(fp, "%-16s %10lu %14.6g %14.6g %14.6g %14.6g %8lu %8lu %8lu %8lu\n", label, acc.count, acc.mean,
+            acc.count > 1 ? sqrt(acc.m2 / (acc.count - 1)) : 0.0, acc.min, acc.max,
+            acc.sevr[0], acc.sevr[1], acc.sevr[2], acc.sevr[3]);
+
+        fprintf(fp, "  [%g, %g):", range.min, range.min + (range.scale > 0 ? m_config.bins / range.scale : 0));
+        if (acc.hist[0])
+            fprintf(fp, " <%lu", acc.hist[0]);
+        for (unsigned b = 1; b <= m_config.bins; ++b)
+            fprintf(fp, " %lu", acc.hist[b]);
+        if (acc.hist[m_config.bins + 1])
+            fprintf(fp, " >%lu", acc.hist[m_config.bins + 1]);
+        if (acc.nonFinite)
+            fprintf(fp, " (%lu non-finite)", acc.nonFinite);
+        fputc('\n', fp);
+    }
+
+    reset();
+}
@@ -0,0 +1,131 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'bldDecode'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'bldDecode', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+#include <memory>
+#include <mutex>
+
+#include "packet.h"
+#include "transpose.h"
+
+struct BldStream;
+struct StreamLayout;
+
+/** Largest number of histogram bins per channel */
+#define MAX_HISTOGRAM_BINS 64
+
+#define DEFAULT_HISTOGRAM_BINS 16
+
+/** Number of events folded into the statistics at once */
+#define STATS_BATCH_SIZE 1024
+
+/**
+ * Statistics mode settings
+ */
+struct StatsConfig {
+    double interval = 1;            // Summary interval, in seconds of BLD time or in pulse IDs
+    bool pulses = false;            // The interval is in pulse IDs rather than seconds
+    bool fixedRange = false;        // Use histMin/histMax, otherwise the range is taken from the first events seen
+    double histMin = 0;
+    double histMax = 0;
+    unsigned bins = DEFAULT_HISTOGRAM_BINS;
+};
+
+/**
+ * \brief Parse a summary interval: seconds ('5', '0.5'), or pulse IDs with a 'p' suffix ('1000p')
+ * \returns false if the interval is invalid. The reason has already been printed
+ */
+bool parse_stats_interval(const char* str, StatsConfig& config);
+
+/**
+ * \brief Parse a histogram range, '<min>:<max>[:<bins>]'
+ * \returns false if the range is invalid. The reason has already been printed
+ */
+bool parse_histogram_range(const char* str, StatsConfig& config);
+
+/**
+ * Running per-channel statistics for one stream: count, mean, variance, min, max, a fixed-bin histogram and a count
+ * per severity. Events are queued and transposed into an EventBatch, then folded in a channel at a time, merging each
+ * batch's moments into the running ones. Nothing is allocated after construction.
+ * A summary is printed, and the statistics restarted, every interval, and whenever the payload layout changes.
+ * Safe to call from several output threads at once.
+ */
+class ChannelStatistics {
+public:
+    /**
+     * \param stream Stream whose decode plans select the channels. Must outlive the statistics
+     */
+    ChannelStatistics(const BldStream& stream, const StatsConfig& config);
+
+    ChannelStatistics(const ChannelStatistics&) = delete;
+    ChannelStatistics& operator=(const ChannelStatistics&) = delete;
+
+    /**
+     * \brief Queue an event. The packet holding it must stay valid until commit() is called
+     * \param layout Layout the packet is decoded against
+     */
+    void add(const StreamLayout& layout, const BldEvent& event);
+
+    /**
+     * \brief Fold in the queued events, call once the events of a packet have been added.
+     * Prints a summary if the interval has elapsed
+     */
+    void commit(FILE* fp);
+
+    /**
+     * \brief Print a summary of the events since the last one, if there were any, and restart
+     */
+    void print_summary(FILE* fp);
+
+private:
+    struct Accumulator {
+        uint64_t count;             // Finite values
+        uint64_t nonFinite;         // NaN and infinite float values, left out of the moments and histogram
+        double mean;
+        double m2;                  // Sum of squared differences from the mean
+        double min;
+        double max;
+        uint64_t sevr[4];
+        uint64_t hist[MAX_HISTOGRAM_BINS + 2];  // Underflow, bins, overflow
+    };
+
+    /** Histogram range of a channel, kept across summaries until the layout changes */
+    struct HistogramRange {
+        bool set;
+        double min;
+        double scale;               // Bins per unit
+    };
+
+    void fold();
+    void fold_channel(unsigned pos, size_t n);
+    void reset();
+    /** Print and restart, then size everything for another layout. Called with m_lock held */
+    void relayout(const StreamLayout& layout);
+    void print_locked(FILE* fp);
+
+    const BldStream& m_stream;
+    StatsConfig m_config;
+
+    std::mutex m_lock;
+    const StreamLayout* m_layout = nullptr; // Layout of the queued and folded events
+    std::unique_ptr<EventBatch> m_batch;
+    std::vector<Accumulator> m_acc;         // One per channel in the decode plan
+    std::vector<HistogramRange> m_ranges;   // One per channel in the decode plan
+    std::vector<double> m_values;           // One channel of the batch, converted to double
+
+    uint64_t m_events = 0;                  // Events since the last summary
+    uint64_t m_firstPulse = 0;
+    uint64_t m_lastPulse = 0;
+    uint64_t m_firstTime = 0;               // BLD timestamps
+    uint64_t m_lastTime = 0;
+};
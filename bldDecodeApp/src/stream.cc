@@ -0,0 +1,32 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'bldDecode'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'bldDecode', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+#include "stream.h"
+#include "filter.h"
+
+bool BldStream::set_layout(const PayloadSchema& schema) {
+    std::unique_ptr<StreamLayout> layout(new StreamLayout);
+    layout->schema = schema;
+    build_channel_list(layout->schema, channels);
+    layout->plan = DecodePlan(layout->schema);
+
+    bool ok = true;
+    if (!filterExpr.empty()) {
+        layout->filter = new Filter();
+        ok = layout->filter->compile(filterExpr.c_str(), layout->schema);
+        layout->filterFailed = !ok;
+    }
+
+    // Readers load the pointer once per packet and never look at m_layouts, retired layouts are only freed on exit
+    std::lock_guard<std::mutex> lock(m_layoutLock);
+    layout->generation = m_layouts.size() + 1;
+    m_layout.store(layout.get(), std::memory_order_release);
+    m_layouts.push_back(std::move(layout));
+    return ok;
+}
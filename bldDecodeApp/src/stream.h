@@ -0,0 +1,95 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'bldDecode'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'bldDecode', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+
+#include "bld-proto.h"
+#include "recv.h"
+#include "report.h"
+#include "schema.h"
+#include "decode.h"
+
+class ChannelStatistics;
+class Filter;
+class EventSampler;
+class GatewayStream;
+class PendingPackets;
+
+/**
+ * Payload layout of a stream, with everything compiled from it. Immutable once published: a change of the payload PV
+ * publishes a new layout, so a packet is decoded and output against one consistent set of formats, labels and remap
+ */
+struct StreamLayout {
+    PayloadSchema schema;
+    DecodePlan plan;                // Compiled from the schema with the channel selection applied
+    Filter* filter = nullptr;       // --filter expression compiled against the schema, if one was given
+    bool filterFailed = false;      // The expression doesn't fit the schema, no event matches
+    unsigned generation = 0;        // Counts the layouts published for the stream, from 1
+};
+
+/**
+ * A single BLD stream: one multicast group and port, with its own payload description
+ */
+struct BldStream {
+    std::string name;               // Shown in output to tell streams apart. Empty when a single stream is received
+    std::string mcastAddr = "224.0.0.0";
+    int port = DEFAULT_BLD_PORT;
+    std::string payloadPV;          // BLD_PAYLOAD PV describing the payload, empty if the format was given directly
+    PayloadSchema schema;           // Layout given with the format, or cached for the payload PV. Read at startup only
+    std::vector<int> channels;      // Channels to output, applied to every layout. Empty for all
+    std::string filterExpr;         // --filter expression, compiled into every layout
+    ChannelStatistics* statistics = nullptr; // Per-channel statistics, only in statistics mode
+    EventSampler* sampler = nullptr; // Event sampling stages, if any were given
+    GatewayStream* gateway = nullptr; // PVs the decoded channels are published to, only with --gateway
+    PendingPackets* pending = nullptr; // Packets held until the first layout arrives, only if the PV was not cached
+
+    BldStream() = default;
+    BldStream(const BldStream&) = delete;
+    BldStream& operator=(const BldStream&) = delete;
+
+    /**
+     * \returns The current layout, or nullptr while the payload PV hasn't been read yet.
+     * Every layout stays valid until exit, so it may be used for as long as needed
+     */
+    inline const StreamLayout* layout() const { return m_layout.load(std::memory_order_acquire); }
+
+    /**
+     * \brief Publish a new layout built from schema, replacing the current one for every packet decoded from now on.
+     * Thread safe
+     * \returns false if the filter expression doesn't fit the schema. The reason has already been printed, and the
+     *          layout is published anyway, matching no events
+     */
+    bool set_layout(const PayloadSchema& schema);
+
+private:
+    std::atomic<const StreamLayout*> m_layout{nullptr};
+    std::mutex m_layoutLock;
+    std::vector<std::unique_ptr<StreamLayout>> m_layouts;  // Every layout published, retired ones may still be in use
+};
+
+/**
+ * Result of the decode stage, consumed by the output stage
+ */
+struct DecodeResult {
+    bool accepted = false;                          // Packet passed the version, severity and header filters
+    bool held = false;                              // The stream has no layout yet, the output stage holds the packet
+    const StreamLayout* layout = nullptr;           // Layout the packet was decoded against
+    PacketError headerError = PacketError::None;
+    PacketError eventError = PacketError::None;
+    uint32_t failedChecks = 0;                      // Every check the packet failed, see failed_check
+};
+
+typedef DecodeResult (*DecodeFn)(const BldStream& stream, PacketValidator& validator, const PacketSlot& packet);
+typedef void (*OutputFn)(const BldStream& stream, Report* report, const PacketSlot& packet, const DecodeResult& result);
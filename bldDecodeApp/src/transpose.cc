@@ -0,0 +1,238 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'bldDecode'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'bldDecode', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+#include "transpose.h"
+
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#include <xmmintrin.h>
+#endif
+
+struct Kernels {
+    SimdLevel level;
+    TransposeRowsFn transpose;
+    UnpackSeverityFn unpack;
+};
+
+static Kernels make_kernels(SimdLevel level) {
+    switch (level) {
+    case SimdLevel::AVX2:
+        return Kernels{level, transpose_rows_avx2, unpack_severity_avx2};
+#ifdef __SSE2__
+    case SimdLevel::SSE2:
+        return Kernels{level, transpose_rows_sse2, unpack_severity_sse2};
+#endif
+    default:
+        return Kernels{SimdLevel::Scalar, transpose_rows_scalar, unpack_severity_scalar};
+    }
+}
+
+// Picked on first use
+static Kernels& kernels() {
+    static Kernels k = make_kernels(detect_simd_level());
+    return k;
+}
+
+SimdLevel detect_simd_level() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (avx2_kernels_available() && __builtin_cpu_supports("avx2"))
+        return SimdLevel::AVX2;
+#endif
+#ifdef __SSE2__
+    return SimdLevel::SSE2;
+#else
+    return SimdLevel::Scalar;
+#endif
+}
+
+bool set_simd_level(SimdLevel level) {
+    if (level == SimdLevel::AVX2 && detect_simd_level() != SimdLevel::AVX2)
+        return false;
+    const Kernels k = make_kernels(level);
+    if (k.level != level)
+        return false;
+    kernels() = k;
+    return true;
+}
+
+SimdLevel simd_level() {
+    return kernels().level;
+}
+
+const char* simd_level_name(SimdLevel level) {
+    switch (level) {
+    case SimdLevel::AVX2:
+        return "AVX2";
+    case SimdLevel::SSE2:
+        return "SSE2";
+    default:
+        return "scalar";
+    }
+}
+
+EventBatch::EventBatch(unsigned numWords, unsigned numChannels, size_t capacity, bool unpackSeverity) :
+    m_numWords(numWords),
+    m_numChannels(numChannels),
+    m_capacity(capacity),
+    m_unpackSeverity(unpackSeverity),
+    m_payloads(capacity),
+    m_payloadWords(capacity),
+    m_timeStamps(capacity),
+    m_pulseIDs(capacity),
+    m_severityMasks(capacity),
+    m_values(size_t(numWords) * capacity),
+    m_severities(unpackSeverity ? size_t(numChannels) * capacity : 0),
+    m_valueColumns(numWords),
+    m_severityColumns(numChannels)
+{
+    for (unsigned w = 0; w < numWords; ++w)
+        m_valueColumns[w] = &m_values[w * capacity];
+    for (unsigned c = 0; c < numChannels; ++c)
+        m_severityColumns[c] = unpackSeverity ? &m_severities[c * capacity] : nullptr;
+}
+
+bool EventBatch::add(const BldEvent& event) {
+    if (m_size == m_capacity)
+        return false;
+
+    m_payloads[m_size] = event.payload;
+    m_payloadWords[m_size] = event.num_words();
+    m_timeStamps[m_size] = event.timeStamp;
+    m_pulseIDs[m_size] = event.pulseID;
+    m_severityMasks[m_size] = event.severityMask;
+    ++m_size;
+    return true;
+}
+
+void EventBatch::commit() {
+    const Kernels& k = kernels();
+
+    size_t i = m_committed;
+    while (i < m_size) {
+        // Runs of complete payloads go through the kernel
+        size_t end = i;
+        while (end < m_size && m_payloadWords[end] >= m_numWords)
+            ++end;
+        if (end > i) {
+            k.transpose(&m_payloads[i], end - i, m_numWords, m_valueColumns.data(), i);
+            i = end;
+            continue;
+        }
+
+        // Short payload, such as a truncated header
+        for (unsigned w = 0; w < m_numWords; ++w)
+            m_valueColumns[w][i] = w < m_payloadWords[i] ? load_unaligned<uint32_t>(m_payloads[i] + w * BLD_CHANNEL_SIZE) : 0;
+        ++i;
+    }
+
+    if (m_unpackSeverity && m_size > m_committed)
+        k.unpack(&m_severityMasks[m_committed], m_size - m_committed, m_numChannels, m_severityColumns.data(), m_committed);
+
+    m_committed = m_size;
+}
+
+void EventBatch::clear() {
+    m_size = 0;
+    m_committed = 0;
+}
+
+void transpose_rows_scalar(const uint8_t* const* rows, size_t count, unsigned numChannels, uint32_t* const* columns, size_t offset) {
+    for (unsigned c = 0; c < numChannels; ++c) {
+        uint32_t* col = columns[c] + offset;
+        for (size_t r = 0; r < count; ++r)
+            col[r] = load_unaligned<uint32_t>(rows[r] + c * BLD_CHANNEL_SIZE);
+    }
+}
+
+void unpack_severity_scalar(const uint64_t* masks, size_t count, unsigned numChannels, uint8_t* const* columns, size_t offset) {
+    for (unsigned c = 0; c < numChannels; ++c) {
+        uint8_t* col = columns[c] + offset;
+        for (size_t i = 0; i < count; ++i)
+            col[i] = (masks[i] >> (2 * c)) & 0x3;
+    }
+}
+
+#ifdef __SSE2__
+
+void transpose_rows_sse2(const uint8_t* const* rows, size_t count, unsigned numChannels, uint32_t* const* columns, size_t offset) {
+    size_t r = 0;
+    for (; r + 4 <= count; r += 4) {
+        const uint8_t* p0 = rows[r];
+        const uint8_t* p1 = rows[r + 1];
+        const uint8_t* p2 = rows[r + 2];
+        const uint8_t* p3 = rows[r + 3];
+
+        // 4 channels of 4 events at a time
+        unsigned c = 0;
+        for (; c + 4 <= numChannels; c += 4) {
+            const size_t off = c * BLD_CHANNEL_SIZE;
+            __m128 a = _mm_castsi128_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p0 + off)));
+            __m128 b = _mm_castsi128_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p1 + off)));
+            __m128 d = _mm_castsi128_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p2 + off)));
+            __m128 e = _mm_castsi128_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p3 + off)));
+            _MM_TRANSPOSE4_PS(a, b, d, e);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(columns[c] + offset + r), _mm_castps_si128(a));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(columns[c + 1] + offset + r), _mm_castps_si128(b));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(columns[c + 2] + offset + r), _mm_castps_si128(d));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(columns[c + 3] + offset + r), _mm_castps_si128(e));
+        }
+
+        // Leftover channels. Reading a full vector past the last channel could run off the end of the datagram
+        for (; c < numChannels; ++c) {
+            const size_t off = c * BLD_CHANNEL_SIZE;
+            uint32_t* col = columns[c] + offset + r;
+            col[0] = load_unaligned<uint32_t>(p0 + off);
+            col[1] = load_unaligned<uint32_t>(p1 + off);
+            col[2] = load_unaligned<uint32_t>(p2 + off);
+            col[3] = load_unaligned<uint32_t>(p3 + off);
+        }
+    }
+
+    if (r < count)
+        transpose_rows_scalar(rows + r, count - r, numChannels, columns, offset + r);
+}
+
+void unpack_severity_sse2(const uint64_t* masks, size_t count, unsigned numChannels, uint8_t* const* columns, size_t offset) {
+    const __m128i three = _mm_set1_epi32(3);
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        // Split the masks of 4 events into the low (channels 0-15) and high (channels 16-30) words
+        const __m128 a = _mm_castsi128_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(masks + i)));
+        const __m128 b = _mm_castsi128_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(masks + i + 2)));
+        const __m128i lo = _mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+        const __m128i hi = _mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+
+        // 4 channels at a time. Channel groups never straddle the two words
+        for (unsigned c = 0; c < numChannels; c += 4) {
+            const __m128i src = c < 16 ? lo : hi;
+            const int shift = 2 * (c % 16);
+            const __m128i v0 = _mm_and_si128(_mm_srl_epi32(src, _mm_cvtsi32_si128(shift)), three);
+            const __m128i v1 = _mm_and_si128(_mm_srl_epi32(src, _mm_cvtsi32_si128(shift + 2)), three);
+            const __m128i v2 = _mm_and_si128(_mm_srl_epi32(src, _mm_cvtsi32_si128(shift + 4)), three);
+            const __m128i v3 = _mm_and_si128(_mm_srl_epi32(src, _mm_cvtsi32_si128(shift + 6)), three);
+
+            // Narrow to bytes: 4 events of channel c, then c+1, c+2 and c+3
+            const __m128i bytes = _mm_packus_epi16(_mm_packs_epi32(v0, v1), _mm_packs_epi32(v2, v3));
+
+            uint32_t out[4];
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out), bytes);
+            for (unsigned k = 0; k < 4 && c + k < numChannels; ++k)
+                memcpy(columns[c + k] + offset + i, &out[k], sizeof(out[k]));
+        }
+    }
+
+    if (i < count)
+        unpack_severity_scalar(masks + i, count - i, numChannels, columns, offset + i);
+}
+
+#endif
@@ -0,0 +1,144 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'bldDecode'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'bldDecode', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+#include "packet.h"
+
+// Column accessors for the other channel types. The columns are filled with vector stores, so tell the compiler
+// reads through these may alias the uint32_t storage
+typedef float __attribute__((__may_alias__)) alias_float;
+typedef int32_t __attribute__((__may_alias__)) alias_int32;
+
+/**
+ * Instruction set used for the transpose kernels, picked at startup from what the CPU supports
+ */
+enum class SimdLevel {
+    Scalar,
+    SSE2,
+    AVX2,
+};
+
+/** \returns The most capable instruction set supported by both this build and the CPU */
+SimdLevel detect_simd_level();
+
+/**
+ * \brief Override the kernels used by every EventBatch, e.g. to compare against the scalar ones
+ * \returns false if the level isn't supported here, the previous kernels are kept
+ */
+bool set_simd_level(SimdLevel level);
+
+SimdLevel simd_level();
+const char* simd_level_name(SimdLevel level);
+
+/**
+ * A batch of events transposed from the wire's per-event layout into per-word arrays (structure of arrays).
+ * The payload is transposed as 32-bit words, whatever the channel widths: a 32-bit channel is the column of the word
+ * at its offset, a 64-bit channel the two columns from its offset on, low word first.
+ * Events can come from any number of packets. add() only records where an event's payload is, commit() does the
+ * transpose, and must be called before the packet holding a pending event is released.
+ */
+class EventBatch {
+public:
+    /**
+     * \param numWords Number of 32-bit words in each event's payload, see PayloadSchema::payload_size
+     * \param numChannels Number of channels in each event's payload
+     * \param capacity Maximum number of events in the batch
+     * \param unpackSeverity Also unpack the 2-bit severity of every channel into per-channel byte arrays
+     */
+    EventBatch(unsigned numWords, unsigned numChannels, size_t capacity, bool unpackSeverity = true);
+
+    EventBatch(const EventBatch&) = delete;
+    EventBatch& operator=(const EventBatch&) = delete;
+
+    /**
+     * \brief Queue an event. Channels missing from a short payload are transposed as 0
+     * \returns false if the batch is full
+     */
+    bool add(const BldEvent& event);
+
+    /**
+     * \brief Transpose all pending events into the channel arrays
+     */
+    void commit();
+
+    /** \brief Drop all events. Pending events must have been committed */
+    void clear();
+
+    /** \returns Number of events, committed or not */
+    inline size_t size() const { return m_size; }
+    inline size_t capacity() const { return m_capacity; }
+    inline bool full() const { return m_size == m_capacity; }
+    inline unsigned num_words() const { return m_numWords; }
+    inline unsigned num_channels() const { return m_numChannels; }
+
+    // Header fields, one entry per event
+    inline const uint64_t* time_stamps() const { return m_timeStamps.data(); }
+    inline const uint64_t* pulse_ids() const { return m_pulseIDs.data(); }
+    inline const uint64_t* severity_masks() const { return m_severityMasks.data(); }
+
+    // Payload words, one entry per committed event. Only valid for words below num_words()
+    inline const uint32_t* uints(unsigned word) const { return &m_values[word * m_capacity]; }
+    inline const alias_float* floats(unsigned word) const { return reinterpret_cast<const alias_float*>(uints(word)); }
+    inline const alias_int32* ints(unsigned word) const { return reinterpret_cast<const alias_int32*>(uints(word)); }
+
+    /** \returns The 64-bit value of a committed event, from the columns of word and word + 1 */
+    inline uint64_t wide(unsigned word, size_t i) const { return uints(word)[i] | uint64_t(uints(word + 1)[i]) << 32; }
+
+    /** \returns Severity of each committed event for a channel, see get_sevr. Empty unless severities are unpacked */
+    inline const uint8_t* severities(unsigned chan) const { return &m_severities[chan * m_capacity]; }
+
+private:
+    unsigned m_numWords;
+    unsigned m_numChannels;
+    size_t m_capacity;
+    bool m_unpackSeverity;
+    size_t m_size = 0;
+    size_t m_committed = 0;                 // Events before this one have been transposed
+
+    std::vector<const uint8_t*> m_payloads; // Payload of each pending event
+    std::vector<uint8_t> m_payloadWords;    // Number of words in each pending event's payload
+    std::vector<uint64_t> m_timeStamps;
+    std::vector<uint64_t> m_pulseIDs;
+    std::vector<uint64_t> m_severityMasks;
+    std::vector<uint32_t> m_values;         // numWords arrays of capacity entries
+    std::vector<uint8_t> m_severities;      // numChannels arrays of capacity entries
+    std::vector<uint32_t*> m_valueColumns;
+    std::vector<uint8_t*> m_severityColumns;
+};
+
+/*
+ * Transpose kernels, one set per SimdLevel. EventBatch picks between them, they are declared here so the AVX2 set
+ * can live in its own translation unit, built with -mavx2.
+ */
+
+/**
+ * \brief Transpose count complete rows of numChannels 32-bit values into columns[chan][offset + row].
+ * The kernels only see 32-bit words, EventBatch passes the number of payload words as numChannels
+ */
+typedef void (*TransposeRowsFn)(const uint8_t* const* rows, size_t count, unsigned numChannels, uint32_t* const* columns, size_t offset);
+
+/**
+ * \brief Unpack the severity of each channel from count masks into columns[chan][offset + i]
+ */
+typedef void (*UnpackSeverityFn)(const uint64_t* masks, size_t count, unsigned numChannels, uint8_t* const* columns, size_t offset);
+
+void transpose_rows_scalar(const uint8_t* const* rows, size_t count, unsigned numChannels, uint32_t* const* columns, size_t offset);
+void unpack_severity_scalar(const uint64_t* masks, size_t count, unsigned numChannels, uint8_t* const* columns, size_t offset);
+void transpose_rows_sse2(const uint8_t* const* rows, size_t count, unsigned numChannels, uint32_t* const* columns, size_t offset);
+void unpack_severity_sse2(const uint64_t* masks, size_t count, unsigned numChannels, uint8_t* const* columns, size_t offset);
+void transpose_rows_avx2(const uint8_t* const* rows, size_t count, unsigned numChannels, uint32_t* const* columns, size_t offset);
+void unpack_severity_avx2(const uint64_t* masks, size_t count, unsigned numChannels, uint8_t* const* columns, size_t offset);
+
+/** \returns True if the AVX2 kernels were compiled in, which needs the translation unit to be built with -mavx2 */
+bool avx2_kernels_available();
@@ -0,0 +1,136 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'bldDecode'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'bldDecode', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+/*
+ * AVX2 transpose kernels. This file is built with -mavx2 on x86_64, everything here is only called after
+ * detect_simd_level() has checked that the CPU supports AVX2.
+ */
+#include "transpose.h"
+
+#include <cstring>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+
+bool avx2_kernels_available() {
+    return true;
+}
+
+void transpose_rows_avx2(const uint8_t* const* rows, size_t count, unsigned numChannels, uint32_t* const* columns, size_t offset) {
+    size_t r = 0;
+    for (; r + 8 <= count; r += 8) {
+        const uint8_t* const* p = rows + r;
+
+        // 8 channels of 8 events at a time
+        unsigned c = 0;
+        for (; c + 8 <= numChannels; c += 8) {
+            const size_t off = c * BLD_CHANNEL_SIZE;
+            __m256 in[8];
+            for (int k = 0; k < 8; ++k)
+                in[k] = _mm256_castsi256_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p[k] + off)));
+
+            const __m256 t0 = _mm256_unpacklo_ps(in[0], in[1]);
+            const __m256 t1 = _mm256_unpackhi_ps(in[0], in[1]);
+            const __m256 t2 = _mm256_unpacklo_ps(in[2], in[3]);
+            const __m256 t3 = _mm256_unpackhi_ps(in[2], in[3]);
+            const __m256 t4 = _mm256_unpacklo_ps(in[4], in[5]);
+            const __m256 t5 = _mm256_unpackhi_ps(in[4], in[5]);
+            const __m256 t6 = _mm256_unpacklo_ps(in[6], in[7]);
+            const __m256 t7 = _mm256_unpackhi_ps(in[6], in[7]);
+
+            const __m256 s0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+            const __m256 s1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+            const __m256 s2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+            const __m256 s3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+            const __m256 s4 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(1, 0, 1, 0));
+            const __m256 s5 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(3, 2, 3, 2));
+            const __m256 s6 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(1, 0, 1, 0));
+            const __m256 s7 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(3, 2, 3, 2));
+
+            const __m256 out[8] = {
+                _mm256_permute2f128_ps(s0, s4, 0x20),
+                _mm256_permute2f128_ps(s1, s5, 0x20),
+                _mm256_permute2f128_ps(s2, s6, 0x20),
+                _mm256_permute2f128_ps(s3, s7, 0x20),
+                _mm256_permute2f128_ps(s0, s4, 0x31),
+                _mm256_permute2f128_ps(s1, s5, 0x31),
+                _mm256_permute2f128_ps(s2, s6, 0x31),
+                _mm256_permute2f128_ps(s3, s7, 0x31),
+            };
+            for (int k = 0; k < 8; ++k)
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(columns[c + k] + offset + r), _mm256_castps_si256(out[k]));
+        }
+
+        // Leftover channels. Reading a full vector past the last channel could run off the end of the datagram
+        for (; c < numChannels; ++c) {
+            const size_t off = c * BLD_CHANNEL_SIZE;
+            uint32_t* col = columns[c] + offset + r;
+            for (int k = 0; k < 8; ++k)
+                col[k] = load_unaligned<uint32_t>(p[k] + off);
+        }
+    }
+
+    if (r < count)
+        transpose_rows_sse2(rows + r, count - r, numChannels, columns, offset + r);
+}
+
+void unpack_severity_avx2(const uint64_t* masks, size_t count, unsigned numChannels, uint8_t* const* columns, size_t offset) {
+    const __m256i three = _mm256_set1_epi32(3);
+    const __m256i evenOdd = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+    const __m256i interleave = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        // Split the masks of 8 events into the low (channels 0-15) and high (channels 16-30) words
+        const __m256i a = _mm256_permutevar8x32_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(masks + i)), evenOdd);
+        const __m256i b = _mm256_permutevar8x32_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(masks + i + 4)), evenOdd);
+        const __m256i lo = _mm256_permute2x128_si256(a, b, 0x20);
+        const __m256i hi = _mm256_permute2x128_si256(a, b, 0x31);
+
+        // 4 channels at a time. Channel groups never straddle the two words
+        for (unsigned c = 0; c < numChannels; c += 4) {
+            const __m256i src = c < 16 ? lo : hi;
+            const int shift = 2 * (c % 16);
+            const __m256i v0 = _mm256_and_si256(_mm256_srl_epi32(src, _mm_cvtsi32_si128(shift)), three);
+            const __m256i v1 = _mm256_and_si256(_mm256_srl_epi32(src, _mm_cvtsi32_si128(shift + 2)), three);
+            const __m256i v2 = _mm256_and_si256(_mm256_srl_epi32(src, _mm_cvtsi32_si128(shift + 4)), three);
+            const __m256i v3 = _mm256_and_si256(_mm256_srl_epi32(src, _mm_cvtsi32_si128(shift + 6)), three);
+
+            // Narrow to bytes. Each 128-bit lane holds 4 events of channels c..c+3, the permute joins the two
+            // lanes into 8 events of channel c, then c+1, c+2 and c+3
+            const __m256i bytes = _mm256_permutevar8x32_epi32(
+                _mm256_packus_epi16(_mm256_packs_epi32(v0, v1), _mm256_packs_epi32(v2, v3)), interleave);
+
+            uint64_t out[4];
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), bytes);
+            for (unsigned k = 0; k < 4 && c + k < numChannels; ++k)
+                memcpy(columns[c + k] + offset + i, &out[k], sizeof(out[k]));
+        }
+    }
+
+    if (i < count)
+        unpack_severity_sse2(masks + i, count - i, numChannels, columns, offset + i);
+}
+
+#else
+
+// Built without AVX2 support, detect_simd_level() never selects these
+bool avx2_kernels_available() {
+    return false;
+}
+
+void transpose_rows_avx2(const uint8_t* const* rows, size_t count, unsigned numChannels, uint32_t* const* columns, size_t offset) {
+    transpose_rows_scalar(rows, count, numChannels, columns, offset);
+}
+
+void unpack_severity_avx2(const uint64_t* masks, size_t count, unsigned numChannels, uint8_t* const* columns, size_t offset) {
+    unpack_severity_scalar(masks, count, numChannels, columns, offset);
+}
+
+#endif
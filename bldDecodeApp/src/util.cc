@@ -28,6 +28,50 @@ std::string format_ts(uint32_t sec, uint32_t nsec) {
     return tmbuf;
 }
 
+static const char BASE64_TABLE[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static_assert(sizeof(BASE64_TABLE) == 64 + 1, "base64 table must have 64 characters");
+
+// Same mapping as BASE64_TABLE, computed instead of looked up so the loop using it vectorizes.
+// Each step moves a range onto the next one: 'a' at 26, '0' at 52, '+' at 62 and '/' at 63
+static inline uint8_t base64_char(uint8_t v) {
+    uint8_t c = v + 'A';
+    c += uint8_t(-(v >= 26)) & 6;
+    c -= uint8_t(-(v >= 52)) & 75;
+    c -= uint8_t(-(v >= 62)) & 15;
+    c += uint8_t(-(v >= 63)) & 3;
+    return c;
+}
+
+size_t base64_encode(const void* data, size_t len, char* out) {
+    const uint8_t* in = static_cast<const uint8_t*>(data);
+    uint8_t* o = reinterpret_cast<uint8_t*>(out);
+    const size_t groups = len / 3;
+
+    // Split every 3 bytes into 4 sextets, then map the sextets to characters in place. Both loops are branch free
+    for (size_t i = 0; i < groups; ++i) {
+        const uint8_t a = in[i * 3], b = in[i * 3 + 1], c = in[i * 3 + 2];
+        o[i * 4] = a >> 2;
+        o[i * 4 + 1] = ((a & 0x03) << 4) | (b >> 4);
+        o[i * 4 + 2] = ((b & 0x0F) << 2) | (c >> 6);
+        o[i * 4 + 3] = c & 0x3F;
+    }
+    for (size_t i = 0; i < groups * 4; ++i)
+        o[i] = base64_char(o[i]);
+
+    char* p = out + groups * 4;
+    const size_t rem = len - groups * 3;
+    if (rem) {
+        const uint8_t a = in[groups * 3], b = rem > 1 ? in[groups * 3 + 1] : 0;
+        *p++ = BASE64_TABLE[a >> 2];
+        *p++ = BASE64_TABLE[((a & 0x03) << 4) | (b >> 4)];
+        *p++ = rem > 1 ? BASE64_TABLE[(b & 0x0F) << 2] : '=';
+        *p++ = '=';
+    }
+    return p - out;
+}
+
 int num_str_base(const char* str) {
     if (str[0] == '0') {
         switch(str[1]) {
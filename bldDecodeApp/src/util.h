@@ -10,13 +10,12 @@
 #pragma once
 
 #include <cstdint>
+#include <cstring>
 #include <string>
 
 #include <compilerSpecific.h>
 #include <epicsTime.h>
 
-#define CHANNEL_SIZE 4
-
 void extract_ts(uint64_t ts, uint32_t& sec, uint32_t& nsec);
 std::string format_ts(uint32_t sec, uint32_t nsec);
 
@@ -36,6 +35,20 @@ const char* sevr_to_string(int sevr);
  */
 int num_str_base(const char* str);
 
+/**
+ * \brief Length of the base64 encoding of len bytes, including padding
+ */
+inline constexpr size_t base64_length(size_t len) {
+    return (len + 2) / 3 * 4;
+}
+
+/**
+ * \brief Encode data as padded base64 (RFC 4648) straight into out, which must hold base64_length(len) characters.
+ * The output is not NULL terminated.
+ * \returns Number of characters written
+ */
+size_t base64_encode(const void* data, size_t len, char* out);
+
 /**
  * Create an EPICS timestamp from the uint64_t encoded one in a BLD packet
  */